@@ -164,6 +164,12 @@ static inline int down_read_killable(struct rw_semaphore *sem)
 #define BIO_HAS_BI_STATUS 1
 #endif
 
+#ifdef BIO_HAS_BI_STATUS
+#define kio_bio_failed(bio) ( (bio)->bi_status != BLK_STS_OK )
+#else
+#define kio_bio_failed(bio) ( (bio)->bi_error != 0 )
+#endif
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
 #define BIO_HAS_BI_ISSUE
 #endif
@@ -205,6 +211,44 @@ static inline blk_qc_t submit_bio_noacct(struct bio *bio)
 #define HAVE_SUBMIT_BIO_NOACCT 1
 #endif
 
+/* sectors one discard can cover, 0 if not supported; 5.19 dropped the
+ * queue flag */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+#define kio_bdev_max_discard_sectors(bdev) bdev_max_discard_sectors(bdev)
+#else
+static inline unsigned kio_bdev_max_discard_sectors(struct block_device *bdev)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+
+	return blk_queue_discard(q) ? q->limits.max_discard_sectors : 0;
+}
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+#define KIO_BIO_MAX_VECS BIO_MAX_VECS
+#else
+#define KIO_BIO_MAX_VECS BIO_MAX_PAGES
+#endif
+
+/* polled completions: REQ_HIPRI and blk_poll() on the cookie returned by
+ * submit_bio(), until 5.16 replaced them with REQ_POLLED and bio_poll() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,16,0)
+#define HAVE_BIO_POLL 1
+#define KIO_REQ_POLLED REQ_POLLED
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+#define HAVE_BLK_POLL 1
+#define KIO_REQ_POLLED REQ_HIPRI
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+#define BLK_POLL_HAS_SPIN 1
+#endif
+#endif
+
+/* cpu to hardware queue maps of blk-mq: one per hctx type (default, read,
+ * poll) in the tag set since 5.0, a single q->mq_map before */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+#define HAVE_BLK_MQ_QUEUE_MAPS 1
+#endif
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0)
 #define HAVE_PRANDOM_H 1
 #else
@@ -235,6 +279,18 @@ static inline u32 prandom_u32(void)
 #undef BIOSET_CREATE_HAS_FLAGS
 #endif
 
+/* 868941b14441 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+#define no_llseek NULL
+#endif
+
+/* bin_attribute read and write callbacks take a const attribute */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,16,0)
+#define KIO_BIN_ATTR_CONST const
+#else
+#define KIO_BIN_ATTR_CONST
+#endif
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,16,0)
 #define TASK_STRUCT_HAS_RECENT_USED_CPU 1
 #endif
@@ -7,14 +7,42 @@
 #include <linux/sysfs.h>
 #include <linux/init.h>
 #include <linux/log2.h>
+#include <linux/cpumask.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
 
 #include "kio_config.h"
 #include "kio_io.h"
 #include "kio_run.h"
+#include "kio_results.h"
+#include "kio_compat.h"
+#include "kio_dist.h"
+#include "kio_trace.h"
+#include "kio_steady.h"
 
 static struct kobject *kio_kobj;
 static struct kio_config kio_config = {};
 
+const char *kio_sweep_param_name[KIO_SWEEP_NR] = {
+	[KIO_SWEEP_NONE]        = "none",
+	[KIO_SWEEP_QUEUE_DEPTH] = "queue_depth",
+	[KIO_SWEEP_RATE_IOPS]   = "rate_iops",
+	[KIO_SWEEP_RATE_BPS]    = "rate_bps",
+};
+
+const char *kio_queue_placement_name[KIO_QUEUE_NR] = {
+	[KIO_QUEUE_ANY]         = "any",
+	[KIO_QUEUE_SPREAD]      = "spread",
+	[KIO_QUEUE_CONCENTRATE] = "concentrate",
+};
+
+const char *kio_data_pattern_name[KIO_PATTERN_NR] = {
+	[KIO_PATTERN_ZEROS]    = "zeros",
+	[KIO_PATTERN_RANDOM]   = "random",
+	[KIO_PATTERN_COMPRESS] = "compress",
+	[KIO_PATTERN_DEDUP]    = "dedup",
+};
+
 // ------------------------------------------------------------------------
 
 #define CHECK_VAR(_name,_fmt,_min,_max) \
@@ -46,14 +74,26 @@ static struct kio_config kio_config = {};
 static bool kio_config_is_valid(void)
 {
 	int i;
-	const char *dev_name = kio_io_dev_name();
-	u64 dev_size = kio_io_dev_byte_size();
+	const struct kio_io_target *tgt;
+	const char *dev_name;
+	u64 dev_size;
 
 	CHECK_VAR(num_threads, "%d", 1, num_online_cpus());
 	CHECK_VAR(runtime_seconds, "%d", 1, KIO_MAX_RUNTIME_SECONDS);
 
 	for (i=0; i<kio_config.num_threads; i++) {
 
+		/* target must be a block device we have open */
+
+		tgt = kio_io_target_get(kio_config.threads[i].target);
+		if (!tgt) {
+			pr_warn("kio: thread %u target %d does not exist\n",
+				i, kio_config.threads[i].target);
+			return false;
+		}
+		dev_name = kio_io_dev_name(tgt);
+		dev_size = kio_io_dev_byte_size(tgt);
+
 		/* range checks */
 
 		CHECK_THRD_VAR(i, block_size, "%d", 512, 1<<20);
@@ -66,6 +106,94 @@ static bool kio_config_is_valid(void)
 		CHECK_THRD_VAR(i, write_burst, "%d", 0, 1024);
 		CHECK_THRD_VAR(i, read_sleep_usec, "%d", 0, 100000);
 		CHECK_THRD_VAR(i, write_sleep_usec, "%d", 0, 100000);
+		CHECK_THRD_VAR(i, submit_batch, "%d", 0, 1024);
+		CHECK_THRD_VAR(i, rate_iops, "%u", 0, KIO_MAX_RATE_IOPS);
+		CHECK_THRD_VAR(i, rate_bps, "%llu", 0, KIO_MAX_RATE_BPS);
+		CHECK_THRD_VAR(i, data_pattern, "%u", 0, KIO_PATTERN_NR - 1);
+		CHECK_THRD_VAR(i, compress_percent, "%u", 0, 100);
+		CHECK_THRD_VAR(i, dedup_percent, "%u", 0, 100);
+		CHECK_THRD_VAR(i, offset_dist, "%u", 0, KIO_DIST_NR - 1);
+		CHECK_THRD_VAR(i, hot_io_percent, "%u", 0, 100);
+		CHECK_THRD_VAR(i, replay, "%u", 0, KIO_REPLAY_NR - 1);
+		CHECK_THRD_VAR(i, fua_percent, "%u", 0, 100);
+		CHECK_THRD_VAR(i, discard_percent, "%u", 0, 100);
+		CHECK_THRD_VAR(i, write_zeroes_percent, "%u", 0, 100);
+		CHECK_THRD_VAR(i, flush_percent, "%u", 0, 100);
+
+		/* ops without data replace IOs, they cannot replace more
+		 * than all of them */
+
+		if (kio_config.threads[i].discard_percent
+		    + kio_config.threads[i].write_zeroes_percent
+		    + kio_config.threads[i].flush_percent > 100) {
+			pr_warn("kio: thread %u discard_percent, "
+				"write_zeroes_percent and flush_percent "
+				"add up to more than 100\n", i);
+			return false;
+		}
+
+		if (kio_config.threads[i].discard_percent
+		    && kio_config.threads[i].block_size
+		       > kio_io_dev_max_op_size(tgt, KIO_OP_DISCARD)) {
+			pr_warn("kio: thread %u discards %u bytes, device %s "
+				"discards at most %u\n", i,
+				kio_config.threads[i].block_size, dev_name,
+				kio_io_dev_max_op_size(tgt, KIO_OP_DISCARD));
+			return false;
+		}
+
+		if (kio_config.threads[i].write_zeroes_percent
+		    && kio_config.threads[i].block_size
+		       > kio_io_dev_max_op_size(tgt, KIO_OP_WRITE_ZEROES)) {
+			pr_warn("kio: thread %u writes %u bytes of zeroes, "
+				"device %s writes at most %u\n", i,
+				kio_config.threads[i].block_size, dev_name,
+				kio_io_dev_max_op_size(tgt, KIO_OP_WRITE_ZEROES));
+			return false;
+		}
+
+		/* thousandths; zipf theta can go above 1, the others not */
+		if (kio_config.threads[i].offset_dist == KIO_DIST_ZIPF)
+			CHECK_THRD_VAR(i, offset_dist_param, "%u", 0, 5000);
+		else
+			CHECK_THRD_VAR(i, offset_dist_param, "%u", 0, 999);
+
+		/* placement must refer to online cpus and nodes */
+
+		if (kio_config.threads[i].cpu != KIO_CPU_ANY
+		    && (kio_config.threads[i].cpu < 0
+			|| kio_config.threads[i].cpu >= nr_cpu_ids
+			|| !cpu_online(kio_config.threads[i].cpu))) {
+			pr_warn("kio: thread %u cpu %d is not online\n",
+				i, kio_config.threads[i].cpu);
+			return false;
+		}
+
+		if (kio_config.threads[i].numa_node != NUMA_NO_NODE
+		    && kio_config.threads[i].numa_node != KIO_NUMA_NODE_AUTO
+		    && (kio_config.threads[i].numa_node < 0
+			|| kio_config.threads[i].numa_node >= MAX_NUMNODES
+			|| !node_online(kio_config.threads[i].numa_node))) {
+			pr_warn("kio: thread %u numa_node %d is not online\n",
+				i, kio_config.threads[i].numa_node);
+			return false;
+		}
+
+		if (kio_config.threads[i].cpu != KIO_CPU_ANY
+		    && kio_config.threads[i].numa_node >= 0
+		    && cpu_to_node(kio_config.threads[i].cpu)
+				!= kio_config.threads[i].numa_node) {
+			pr_warn("kio: thread %u cpu %d is not on numa_node %d\n",
+				i, kio_config.threads[i].cpu,
+				kio_config.threads[i].numa_node);
+			return false;
+		}
+
+		if (kio_config.threads[i].poll && !kio_io_poll_supported()) {
+			pr_warn("kio: thread %u poll is not supported "
+				"by this kernel\n", i);
+			return false;
+		}
 
 		/* block size is a power of 2 */
 
@@ -85,6 +213,19 @@ static bool kio_config_is_valid(void)
 		}
 #endif
 
+		/* block size must fit in one bio, on device block boundaries */
+
+		if (kio_config.threads[i].block_size < kio_io_dev_block_size(tgt)
+		    || kio_config.threads[i].block_size > kio_io_dev_max_io_size(tgt)) {
+			pr_warn("kio: thread %u block_size value %u "
+				"must be in range [%u,%u] for device %s\n",
+				i, kio_config.threads[i].block_size,
+				kio_io_dev_block_size(tgt),
+				kio_io_dev_max_io_size(tgt),
+				dev_name);
+			return false;
+		}
+
 		/* check offset_low against device size */
 
 		if (kio_config.threads[i].offset_low
@@ -121,6 +262,43 @@ static bool kio_config_is_valid(void)
 			return false;
 		}
 
+		/* a replayed trace has to fit the buffers and the device */
+
+		if (kio_config.threads[i].replay) {
+			const struct kio_trace *trace = kio_trace_get();
+
+			if (!trace) {
+				pr_warn("kio: thread %u replays a trace, but "
+					"none is loaded\n", i);
+				return false;
+			}
+
+			if (trace->max_len > kio_config.threads[i].block_size) {
+				pr_warn("kio: thread %u block_size value %u "
+					"is smaller than trace IOs of %u\n",
+					i, kio_config.threads[i].block_size,
+					trace->max_len);
+				return false;
+			}
+
+			if ((trace->flag_bits & KIO_TRACE_DISCARD)
+			    && trace->max_len
+			       > kio_io_dev_max_op_size(tgt, KIO_OP_DISCARD)) {
+				pr_warn("kio: thread %u trace has discards, "
+					"device %s discards at most %u\n", i,
+					dev_name,
+					kio_io_dev_max_op_size(tgt, KIO_OP_DISCARD));
+				return false;
+			}
+
+			if (trace->len_bits & (kio_io_dev_block_size(tgt) - 1)) {
+				pr_warn("kio: thread %u trace IOs are not aligned "
+					"to device %s block size %u\n",
+					i, dev_name, kio_io_dev_block_size(tgt));
+				return false;
+			}
+		}
+
 		/* either read_burst or write_burst are set */
 
 		if (!kio_config.threads[i].read_burst
@@ -149,6 +327,33 @@ static bool kio_config_is_valid(void)
 		}
 	}
 
+	/* every step of a sweep must be valid for all threads */
+
+	for (i=0; i<kio_config.sweep.nr_steps; i++) {
+		u64 val = kio_config.sweep.values[i], min = 0, max = 0;
+
+		switch (kio_config.sweep.param) {
+		case KIO_SWEEP_QUEUE_DEPTH: min = 1; max = 1024;              break;
+		case KIO_SWEEP_RATE_IOPS:   min = 0; max = KIO_MAX_RATE_IOPS; break;
+		case KIO_SWEEP_RATE_BPS:    min = 0; max = KIO_MAX_RATE_BPS;  break;
+		default: break;
+		}
+
+		if (val < min || val > max) {
+			pr_warn("kio: sweep step %u %s value %llu "
+				"is out of range [%llu,%llu]\n", i,
+				kio_sweep_param_name[kio_config.sweep.param],
+				val, min, max);
+			return false;
+		}
+	}
+
+	if (kio_config.sweep.warmup_seconds > KIO_MAX_RUNTIME_SECONDS) {
+		pr_warn("kio: sweep warmup %u is out of range [0,%u]\n",
+			kio_config.sweep.warmup_seconds, KIO_MAX_RUNTIME_SECONDS);
+		return false;
+	}
+
 	return true;
 }
 
@@ -171,6 +376,26 @@ enum {
 	KIO_WRITE_BURST,
 	KIO_READ_SLEEP_USEC,
 	KIO_WRITE_SLEEP_USEC,
+	KIO_SUBMIT_BATCH,
+	KIO_POLL,
+	KIO_CPU,
+	KIO_NUMA_NODE,
+	KIO_TARGET,
+	KIO_RATE_IOPS,
+	KIO_RATE_BPS,
+	KIO_VERIFY,
+	KIO_DATA_PATTERN,
+	KIO_COMPRESS_PERCENT,
+	KIO_DEDUP_PERCENT,
+	KIO_OFFSET_DIST,
+	KIO_OFFSET_DIST_PARAM,
+	KIO_REPLAY,
+	KIO_HOT_IO_PERCENT,
+	KIO_SEED,
+	KIO_FUA_PERCENT,
+	KIO_DISCARD_PERCENT,
+	KIO_WRITE_ZEROES_PERCENT,
+	KIO_FLUSH_PERCENT,
 };
 
 static inline struct kio_thread_config *kio_thread_config_from_kobj(struct kobject *kobj)
@@ -206,27 +431,92 @@ static ssize_t kio_thread_var_show(struct kobject *kobj, struct kobj_attribute *
 	case KIO_WRITE_BURST:      value = ktc->write_burst;      break;
 	case KIO_READ_SLEEP_USEC:  value = ktc->read_sleep_usec;  break;
 	case KIO_WRITE_SLEEP_USEC: value = ktc->write_sleep_usec; break;
+	case KIO_SUBMIT_BATCH:     value = ktc->submit_batch;     break;
+	case KIO_POLL:             value = ktc->poll;             break;
+	case KIO_CPU:              value = ktc->cpu;              break;
+	case KIO_NUMA_NODE:        value = ktc->numa_node;        break;
+	case KIO_TARGET:           value = ktc->target;           break;
+	case KIO_RATE_IOPS:        value = ktc->rate_iops;        break;
+	case KIO_RATE_BPS:         value = ktc->rate_bps;         break;
+	case KIO_VERIFY:           value = ktc->verify;           break;
+	case KIO_DATA_PATTERN:     value = ktc->data_pattern;     break;
+	case KIO_COMPRESS_PERCENT: value = ktc->compress_percent; break;
+	case KIO_DEDUP_PERCENT:    value = ktc->dedup_percent;    break;
+	case KIO_OFFSET_DIST:      value = ktc->offset_dist;      break;
+	case KIO_OFFSET_DIST_PARAM: value = ktc->offset_dist_param; break;
+	case KIO_REPLAY:           value = ktc->replay;           break;
+	case KIO_FUA_PERCENT:      value = ktc->fua_percent;      break;
+	case KIO_DISCARD_PERCENT:  value = ktc->discard_percent;  break;
+	case KIO_WRITE_ZEROES_PERCENT: value = ktc->write_zeroes_percent; break;
+	case KIO_FLUSH_PERCENT:    value = ktc->flush_percent;    break;
+	case KIO_HOT_IO_PERCENT:   value = ktc->hot_io_percent;   break;
+	case KIO_SEED:             value = ktc->seed;             break;
 	default: return -ENOENT;
 	}
+
+	if (var_index == KIO_NUMA_NODE && value == KIO_NUMA_NODE_AUTO)
+		return sprintf(buf, "auto\n");
+
+	if (var_index == KIO_DATA_PATTERN && value < KIO_PATTERN_NR)
+		return sprintf(buf, "%s\n", kio_data_pattern_name[value]);
+
+	if (var_index == KIO_OFFSET_DIST && value < KIO_DIST_NR)
+		return sprintf(buf, "%s\n", kio_offset_dist_name[value]);
+
+	if (var_index == KIO_REPLAY && value < KIO_REPLAY_NR)
+		return sprintf(buf, "%s\n", kio_replay_mode_name[value]);
+
+	/* seeds use all 64 bits, bandwidth more than a long on 32-bit */
+	if (var_index == KIO_SEED)
+		return sprintf(buf, "%llu\n", ktc->seed);
+	if (var_index == KIO_RATE_BPS)
+		return sprintf(buf, "%llu\n", ktc->rate_bps);
+
 	return sprintf(buf, "%ld\n", value);
 }
 
 static ssize_t kio_thread_var_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count, int var_index)
 {
 	struct kio_thread_config *ktc;
+	ssize_t result = count;
 	long value = -1;
+	u64 value64 = 0;                // of seed and rate_bps
 	int rc;
 
-	if (kio_is_running())
-		return -EBUSY;
-
 	ktc = kio_thread_config_from_kobj(kobj);
 	if (!ktc)
 		return -ENODEV;
 
-	rc = kstrtol(buf, 0, &value);
-	if (rc<0)
-		return rc;
+	if (var_index == KIO_NUMA_NODE && sysfs_streq(buf, "auto"))
+		value = KIO_NUMA_NODE_AUTO;
+	else if (var_index == KIO_DATA_PATTERN
+		 && (rc = sysfs_match_string(kio_data_pattern_name, buf)) >= 0)
+		value = rc;
+	else if (var_index == KIO_OFFSET_DIST
+		 && (rc = sysfs_match_string(kio_offset_dist_name, buf)) >= 0)
+		value = rc;
+	else if (var_index == KIO_REPLAY
+		 && (rc = sysfs_match_string(kio_replay_mode_name, buf)) >= 0)
+		value = rc;
+	else if (var_index == KIO_SEED || var_index == KIO_RATE_BPS) {
+		rc = kstrtoull(buf, 0, &value64);
+		if (rc<0)
+			return rc;
+		/* more would overflow the fixed point token bucket */
+		if (var_index == KIO_RATE_BPS && value64 > KIO_MAX_RATE_BPS)
+			return -ERANGE;
+	} else {
+		rc = kstrtol(buf, 0, &value);
+		if (rc<0)
+			return rc;
+	}
+
+	/* a run reads the config without locks, it cannot change under it */
+	mutex_lock(&kio_config.mutex);
+	if (kio_is_running()) {
+		mutex_unlock(&kio_config.mutex);
+		return -EBUSY;
+	}
 
 	switch (var_index) {
 	case KIO_BLOCK_SIZE:       ktc->block_size       = value; break;
@@ -242,10 +532,32 @@ static ssize_t kio_thread_var_store(struct kobject *kobj, struct kobj_attribute
 	case KIO_WRITE_BURST:      ktc->write_burst      = value; break;
 	case KIO_READ_SLEEP_USEC:  ktc->read_sleep_usec  = value; break;
 	case KIO_WRITE_SLEEP_USEC: ktc->write_sleep_usec = value; break;
-	default: return -ENOENT;
+	case KIO_SUBMIT_BATCH:     ktc->submit_batch     = value; break;
+	case KIO_POLL:             ktc->poll             = value; break;
+	case KIO_CPU:              ktc->cpu              = value; break;
+	case KIO_NUMA_NODE:        ktc->numa_node        = value; break;
+	case KIO_TARGET:           ktc->target           = value; break;
+	case KIO_RATE_IOPS:        ktc->rate_iops        = value; break;
+	case KIO_RATE_BPS:         ktc->rate_bps         = value64; break;
+	case KIO_VERIFY:           ktc->verify           = value; break;
+	case KIO_DATA_PATTERN:     ktc->data_pattern     = value; break;
+	case KIO_COMPRESS_PERCENT: ktc->compress_percent = value; break;
+	case KIO_DEDUP_PERCENT:    ktc->dedup_percent    = value; break;
+	case KIO_OFFSET_DIST:      ktc->offset_dist      = value; break;
+	case KIO_OFFSET_DIST_PARAM: ktc->offset_dist_param = value; break;
+	case KIO_REPLAY:           ktc->replay           = value; break;
+	case KIO_FUA_PERCENT:      ktc->fua_percent      = value; break;
+	case KIO_DISCARD_PERCENT:  ktc->discard_percent  = value; break;
+	case KIO_WRITE_ZEROES_PERCENT: ktc->write_zeroes_percent = value; break;
+	case KIO_FLUSH_PERCENT:    ktc->flush_percent    = value; break;
+	case KIO_HOT_IO_PERCENT:   ktc->hot_io_percent   = value; break;
+	case KIO_SEED:             ktc->seed             = value64; break;
+	default: result = -ENOENT; break;
 	}
 
-	return count;
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
 }
 
 #define VAR_ATTR_SHOW_STORE(_name_, _index_) \
@@ -276,9 +588,44 @@ VAR_ATTR_SHOW_STORE(read_burst, KIO_READ_BURST);
 VAR_ATTR_SHOW_STORE(write_burst, KIO_WRITE_BURST);
 VAR_ATTR_SHOW_STORE(read_sleep_usec, KIO_READ_SLEEP_USEC);
 VAR_ATTR_SHOW_STORE(write_sleep_usec, KIO_WRITE_SLEEP_USEC);
+VAR_ATTR_SHOW_STORE(submit_batch, KIO_SUBMIT_BATCH);
+VAR_ATTR_SHOW_STORE(poll, KIO_POLL);
+VAR_ATTR_SHOW_STORE(cpu, KIO_CPU);
+VAR_ATTR_SHOW_STORE(numa_node, KIO_NUMA_NODE);
+VAR_ATTR_SHOW_STORE(target, KIO_TARGET);
+VAR_ATTR_SHOW_STORE(rate_iops, KIO_RATE_IOPS);
+VAR_ATTR_SHOW_STORE(rate_bps, KIO_RATE_BPS);
+VAR_ATTR_SHOW_STORE(verify, KIO_VERIFY);
+VAR_ATTR_SHOW_STORE(data_pattern, KIO_DATA_PATTERN);
+VAR_ATTR_SHOW_STORE(compress_percent, KIO_COMPRESS_PERCENT);
+VAR_ATTR_SHOW_STORE(dedup_percent, KIO_DEDUP_PERCENT);
+VAR_ATTR_SHOW_STORE(offset_dist, KIO_OFFSET_DIST);
+VAR_ATTR_SHOW_STORE(offset_dist_param, KIO_OFFSET_DIST_PARAM);
+VAR_ATTR_SHOW_STORE(replay, KIO_REPLAY);
+VAR_ATTR_SHOW_STORE(hot_io_percent, KIO_HOT_IO_PERCENT);
+VAR_ATTR_SHOW_STORE(seed, KIO_SEED);
+VAR_ATTR_SHOW_STORE(fua_percent, KIO_FUA_PERCENT);
+VAR_ATTR_SHOW_STORE(discard_percent, KIO_DISCARD_PERCENT);
+VAR_ATTR_SHOW_STORE(write_zeroes_percent, KIO_WRITE_ZEROES_PERCENT);
+VAR_ATTR_SHOW_STORE(flush_percent, KIO_FLUSH_PERCENT);
 
 #undef VAR_ATTR_SHOW_STORE
 
+static ssize_t kio_thread_results_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	struct kio_thread_config *ktc;
+
+	ktc = kio_thread_config_from_kobj(kobj);
+	if (!ktc)
+		return -ENODEV;
+
+	return kio_run_results_show(buf, ktc - kio_config.threads);
+}
+
+static struct kobj_attribute kio_config_results_attribute
+	= __ATTR(results, 0444, kio_thread_results_show, NULL);
+
 // ------------------------------------------------------------------------
 
 static int kio_config_create_thread(unsigned tid)
@@ -287,6 +634,9 @@ static int kio_config_create_thread(unsigned tid)
 	char name[20];
 	int retval;
 
+	ktc->cpu = KIO_CPU_ANY;
+	ktc->numa_node = NUMA_NO_NODE;
+
 	sprintf(name, "%d", tid);
 	ktc->kobj = kobject_create_and_add(name, kio_kobj);
 	if (!ktc->kobj)
@@ -310,6 +660,27 @@ static int kio_config_create_thread(unsigned tid)
 	VAR_CREATE_FILE(write_burst);
 	VAR_CREATE_FILE(read_sleep_usec);
 	VAR_CREATE_FILE(write_sleep_usec);
+	VAR_CREATE_FILE(submit_batch);
+	VAR_CREATE_FILE(poll);
+	VAR_CREATE_FILE(cpu);
+	VAR_CREATE_FILE(numa_node);
+	VAR_CREATE_FILE(target);
+	VAR_CREATE_FILE(rate_iops);
+	VAR_CREATE_FILE(rate_bps);
+	VAR_CREATE_FILE(verify);
+	VAR_CREATE_FILE(data_pattern);
+	VAR_CREATE_FILE(compress_percent);
+	VAR_CREATE_FILE(dedup_percent);
+	VAR_CREATE_FILE(offset_dist);
+	VAR_CREATE_FILE(offset_dist_param);
+	VAR_CREATE_FILE(replay);
+	VAR_CREATE_FILE(hot_io_percent);
+	VAR_CREATE_FILE(seed);
+	VAR_CREATE_FILE(fua_percent);
+	VAR_CREATE_FILE(discard_percent);
+	VAR_CREATE_FILE(write_zeroes_percent);
+	VAR_CREATE_FILE(flush_percent);
+	VAR_CREATE_FILE(results);
 
 #undef VAR_CREATE_FILE
 
@@ -434,6 +805,408 @@ static struct kobj_attribute runtime_seconds_attribute
 
 // ------------------------------------------------------------------------
 
+static ssize_t kio_ramp_seconds_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%u\n", kio_config.ramp_seconds);
+}
+static ssize_t kio_ramp_seconds_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int result = -1;
+	unsigned seconds;
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running()) {
+		result = -EBUSY;
+		goto unlock_and_return_result;
+	}
+
+	result = kstrtouint(buf, 0, &seconds);
+	if (result < 0)
+		goto unlock_and_return_result;
+
+	if (seconds > KIO_MAX_RUNTIME_SECONDS) {
+		result = -EOVERFLOW;
+		goto unlock_and_return_result;
+	}
+
+	kio_config.ramp_seconds = seconds;
+	result = count;
+
+unlock_and_return_result:
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
+}
+
+static struct kobj_attribute ramp_seconds_attribute
+	= __ATTR(ramp_seconds, 0664, kio_ramp_seconds_show, kio_ramp_seconds_store);
+
+// ------------------------------------------------------------------------
+
+static ssize_t kio_stats_interval_msec_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%u\n", kio_config.stats_interval_msec);
+}
+static ssize_t kio_stats_interval_msec_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int result = -1;
+	unsigned msec;
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running()) {
+		result = -EBUSY;
+		goto unlock_and_return_result;
+	}
+
+	result = kstrtouint(buf, 0, &msec);
+	if (result < 0)
+		goto unlock_and_return_result;
+
+	if (msec && (msec < KIO_MIN_STATS_INTERVAL_MSEC
+		     || msec > KIO_MAX_STATS_INTERVAL_MSEC)) {
+		result = -EOVERFLOW;
+		goto unlock_and_return_result;
+	}
+
+	kio_config.stats_interval_msec = msec;
+	result = count;
+
+unlock_and_return_result:
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
+}
+
+static struct kobj_attribute stats_interval_msec_attribute
+	= __ATTR(stats_interval_msec, 0664, kio_stats_interval_msec_show,
+		 kio_stats_interval_msec_store);
+
+// ------------------------------------------------------------------------
+
+/* values are a comma separated list, start:end:step, or start:end:xfactor */
+static int kio_sweep_parse_values(struct kio_sweep_plan *plan, char *spec)
+{
+	char *first, *last, *step;
+	u64 val, start, end, inc;
+	bool mul = false;
+
+	if (!strchr(spec, ':')) {
+		while ((first = strsep(&spec, ",")) != NULL) {
+			if (!*first)
+				continue;
+			if (plan->nr_steps == KIO_MAX_SWEEP_STEPS)
+				return -E2BIG;
+			if (kstrtoull(first, 0, &val))
+				return -EINVAL;
+			plan->values[plan->nr_steps++] = val;
+		}
+		return plan->nr_steps ? 0 : -EINVAL;
+	}
+
+	first = strsep(&spec, ":");
+	last = strsep(&spec, ":");
+	step = spec;
+	if (!last || !step)
+		return -EINVAL;
+
+	if (*step == 'x') {
+		mul = true;
+		step++;
+	}
+
+	if (kstrtoull(first, 0, &start) || kstrtoull(last, 0, &end)
+	    || kstrtoull(step, 0, &inc))
+		return -EINVAL;
+
+	if (start > end || !inc || (mul && (inc < 2 || !start)))
+		return -EINVAL;
+
+	for (val = start; val <= end; ) {
+		if (plan->nr_steps == KIO_MAX_SWEEP_STEPS)
+			return -E2BIG;
+		plan->values[plan->nr_steps++] = val;
+
+		if (mul ? val > end / inc : val > end - inc)
+			break;
+		val = mul ? val * inc : val + inc;
+	}
+
+	return 0;
+}
+
+/* "<param>=<values> [warmup=<seconds>]", or "none" */
+static int kio_sweep_parse(struct kio_sweep_plan *plan, const char *buf)
+{
+	char *copy, *cur, *tok, *val;
+	int rc = 0, i;
+
+	memset(plan, 0, sizeof(*plan));
+
+	copy = kstrdup(buf, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	cur = strim(copy);
+	if (!*cur || !strcmp(cur, kio_sweep_param_name[KIO_SWEEP_NONE]))
+		goto free_and_return_rc;
+
+	while ((tok = strsep(&cur, " \t")) != NULL) {
+		if (!*tok)
+			continue;
+
+		val = strchr(tok, '=');
+		if (!val) {
+			rc = -EINVAL;
+			goto free_and_return_rc;
+		}
+		*val++ = 0;
+
+		if (!strcmp(tok, "warmup")) {
+			rc = kstrtouint(val, 0, &plan->warmup_seconds);
+			if (rc)
+				goto free_and_return_rc;
+			continue;
+		}
+
+		for (i = KIO_SWEEP_NONE + 1; i < KIO_SWEEP_NR; i++)
+			if (!strcmp(tok, kio_sweep_param_name[i]))
+				break;
+		if (i == KIO_SWEEP_NR || plan->param) {
+			rc = -EINVAL;
+			goto free_and_return_rc;
+		}
+
+		plan->param = i;
+		rc = kio_sweep_parse_values(plan, val);
+		if (rc)
+			goto free_and_return_rc;
+	}
+
+	if (!plan->param)
+		rc = -EINVAL;
+
+free_and_return_rc:
+	kfree(copy);
+	if (rc)
+		memset(plan, 0, sizeof(*plan));
+	return rc;
+}
+
+static ssize_t kio_sweep_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	const struct kio_sweep_plan *plan = &kio_config.sweep;
+	ssize_t len;
+	int i;
+
+	len = scnprintf(buf, PAGE_SIZE, "%s", kio_sweep_param_name[plan->param]);
+	for (i = 0; i < plan->nr_steps; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%c%llu",
+				 i ? ',' : '=', plan->values[i]);
+	if (plan->param)
+		len += scnprintf(buf + len, PAGE_SIZE - len, " warmup=%u",
+				 plan->warmup_seconds);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+
+	return len;
+}
+static ssize_t kio_sweep_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct kio_sweep_plan *plan;
+	int result = -1;
+
+	plan = kzalloc(sizeof(*plan), GFP_KERNEL);
+	if (!plan)
+		return -ENOMEM;
+
+	result = kio_sweep_parse(plan, buf);
+	if (result < 0) {
+		pr_warn("kio: cannot parse sweep plan '%s'\n", buf);
+		goto free_and_return_result;
+	}
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running()) {
+		result = -EBUSY;
+		goto unlock_and_return_result;
+	}
+
+	kio_config.sweep = *plan;
+	result = count;
+
+unlock_and_return_result:
+	mutex_unlock(&kio_config.mutex);
+free_and_return_result:
+	kfree(plan);
+
+	return result;
+}
+
+static struct kobj_attribute sweep_attribute
+	= __ATTR(sweep, 0664, kio_sweep_show, kio_sweep_store);
+
+// ------------------------------------------------------------------------
+
+/* "<metric> [window=<n>] [interval=<msec>] [range=<pct>] [slope=<pct>]",
+ * or "none" */
+static int kio_steady_parse(struct kio_steady_plan *plan, const char *buf)
+{
+	char *copy, *cur, *tok, *val;
+	u32 *field;
+	int rc = 0, i;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->window = KIO_STEADY_DEFAULT_WINDOW;
+	plan->interval_msec = KIO_STEADY_DEFAULT_INTERVAL_MSEC;
+	plan->range_percent = KIO_STEADY_DEFAULT_RANGE_PERCENT;
+	plan->slope_percent = KIO_STEADY_DEFAULT_SLOPE_PERCENT;
+
+	copy = kstrdup(buf, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	cur = strim(copy);
+	tok = strsep(&cur, " \t");
+	i = sysfs_match_string(kio_steady_metric_name, tok);
+	if (i < 0) {
+		rc = -EINVAL;
+		goto free_and_return_rc;
+	}
+	plan->metric = i;
+
+	while ((tok = strsep(&cur, " \t")) != NULL) {
+		if (!*tok)
+			continue;
+
+		val = strchr(tok, '=');
+		if (!val) {
+			rc = -EINVAL;
+			goto free_and_return_rc;
+		}
+		*val++ = 0;
+
+		if (!strcmp(tok, "window"))
+			field = &plan->window;
+		else if (!strcmp(tok, "interval"))
+			field = &plan->interval_msec;
+		else if (!strcmp(tok, "range"))
+			field = &plan->range_percent;
+		else if (!strcmp(tok, "slope"))
+			field = &plan->slope_percent;
+		else {
+			rc = -EINVAL;
+			goto free_and_return_rc;
+		}
+
+		rc = kstrtouint(val, 0, field);
+		if (rc)
+			goto free_and_return_rc;
+	}
+
+	if (plan->window < 2 || plan->window > KIO_MAX_STEADY_WINDOW
+	    || plan->interval_msec < KIO_MIN_STATS_INTERVAL_MSEC
+	    || plan->interval_msec > KIO_MAX_STATS_INTERVAL_MSEC
+	    || plan->range_percent > 100 || plan->slope_percent > 100)
+		rc = -EOVERFLOW;
+
+free_and_return_rc:
+	kfree(copy);
+	return rc;
+}
+
+static ssize_t kio_steady_state_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	const struct kio_steady_plan *plan = &kio_config.steady;
+
+	if (!plan->metric)
+		return sprintf(buf, "%s\n",
+			       kio_steady_metric_name[KIO_STEADY_NONE]);
+
+	return sprintf(buf, "%s window=%u interval=%u range=%u slope=%u\n",
+		       kio_steady_metric_name[plan->metric], plan->window,
+		       plan->interval_msec, plan->range_percent,
+		       plan->slope_percent);
+}
+static ssize_t kio_steady_state_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct kio_steady_plan plan;
+	int result = -1;
+
+	result = kio_steady_parse(&plan, buf);
+	if (result < 0) {
+		pr_warn("kio: cannot parse steady state criteria '%s'\n", buf);
+		return result;
+	}
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running()) {
+		result = -EBUSY;
+		goto unlock_and_return_result;
+	}
+
+	kio_config.steady = plan;
+	result = count;
+
+unlock_and_return_result:
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
+}
+
+static struct kobj_attribute steady_state_attribute
+	= __ATTR(steady_state, 0664, kio_steady_state_show,
+		 kio_steady_state_store);
+
+// ------------------------------------------------------------------------
+
+static ssize_t kio_queue_placement_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n",
+		       kio_queue_placement_name[kio_config.queue_placement]);
+}
+static ssize_t kio_queue_placement_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int result = -1;
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running()) {
+		result = -EBUSY;
+		goto unlock_and_return_result;
+	}
+
+	result = sysfs_match_string(kio_queue_placement_name, buf);
+	if (result < 0)
+		goto unlock_and_return_result;
+
+	kio_config.queue_placement = result;
+	result = count;
+
+unlock_and_return_result:
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
+}
+
+static struct kobj_attribute queue_placement_attribute
+	= __ATTR(queue_placement, 0664, kio_queue_placement_show,
+		 kio_queue_placement_store);
+
+// ------------------------------------------------------------------------
+
 static ssize_t kio_run_workload_show(struct kobject *kobj,
 				struct kobj_attribute *attr, char *buf)
 {
@@ -461,9 +1234,9 @@ static ssize_t kio_run_workload_store(struct kobject *kobj,
 		goto unlock_and_return_result;
 	}
 
-	kio_run(&kio_config);
-
-	result = count;
+	result = kio_run_start(&kio_config);
+	if (!result)
+		result = count;
 
 unlock_and_return_result:
 	mutex_unlock(&kio_config.mutex);
@@ -476,6 +1249,150 @@ static struct kobj_attribute run_workload_attribute
 
 // ------------------------------------------------------------------------
 
+static ssize_t kio_stop_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	kio_run_stop();
+	return count;
+}
+
+static struct kobj_attribute stop_attribute
+	= __ATTR(stop, 0220, NULL, kio_stop_store);
+
+static ssize_t kio_status_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return kio_run_status_show(buf);
+}
+
+static struct kobj_attribute status_attribute
+	= __ATTR(status, 0444, kio_status_show, NULL);
+
+// ------------------------------------------------------------------------
+
+static ssize_t kio_targets_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return kio_io_targets_show(buf);
+}
+
+static struct kobj_attribute targets_attribute
+	= __ATTR(targets, 0444, kio_targets_show, NULL);
+
+static ssize_t kio_add_target_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int result = -1;
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running()) {
+		result = -EBUSY;
+		goto unlock_and_return_result;
+	}
+
+	result = kio_io_add_target(buf);
+	if (result >= 0)
+		result = count;
+
+unlock_and_return_result:
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
+}
+
+static struct kobj_attribute add_target_attribute
+	= __ATTR(add_target, 0220, NULL, kio_add_target_store);
+
+static ssize_t kio_remove_target_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int result = -1, index;
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running()) {
+		result = -EBUSY;
+		goto unlock_and_return_result;
+	}
+
+	result = kstrtoint(buf, 0, &index);
+	if (result < 0)
+		goto unlock_and_return_result;
+
+	result = kio_io_remove_target(index);
+	if (!result)
+		result = count;
+
+unlock_and_return_result:
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
+}
+
+static struct kobj_attribute remove_target_attribute
+	= __ATTR(remove_target, 0220, NULL, kio_remove_target_store);
+
+// ------------------------------------------------------------------------
+
+static ssize_t kio_results_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return kio_run_results_show(buf, -1);
+}
+
+static struct kobj_attribute results_attribute
+	= __ATTR(results, 0444, kio_results_show, NULL);
+
+static ssize_t kio_results_json_read(struct file *file, struct kobject *kobj,
+				     KIO_BIN_ATTR_CONST struct bin_attribute *attr,
+				     char *buf, loff_t off, size_t count)
+{
+	return kio_run_results_json_read(buf, off, count);
+}
+
+static struct bin_attribute results_json_attribute = {
+	.attr = { .name = "results.json", .mode = 0444 },
+	.read = kio_results_json_read,
+};
+
+static ssize_t kio_sweep_json_read(struct file *file, struct kobject *kobj,
+				   KIO_BIN_ATTR_CONST struct bin_attribute *attr,
+				   char *buf, loff_t off, size_t count)
+{
+	return kio_sweep_results_json_read(buf, off, count);
+}
+
+static struct bin_attribute sweep_results_json_attribute = {
+	.attr = { .name = "sweep_results.json", .mode = 0444 },
+	.read = kio_sweep_json_read,
+};
+
+static ssize_t kio_trace_bin_write(struct file *file, struct kobject *kobj,
+				   KIO_BIN_ATTR_CONST struct bin_attribute *attr,
+				   char *buf, loff_t off, size_t count)
+{
+	ssize_t result;
+
+	mutex_lock(&kio_config.mutex);
+
+	if (kio_is_running())
+		result = -EBUSY;
+	else
+		result = kio_trace_write(buf, off, count);
+
+	mutex_unlock(&kio_config.mutex);
+
+	return result;
+}
+
+static struct bin_attribute trace_attribute = {
+	.attr = { .name = "trace", .mode = 0200 },
+	.write = kio_trace_bin_write,
+};
+
+// ------------------------------------------------------------------------
+
 int kio_config_init(void)
 {
 	int retval;
@@ -500,23 +1417,119 @@ int kio_config_init(void)
 	if (retval)
 		goto err_runtime_seconds;
 
+	// Create the ramp_seconds file
+	retval = sysfs_create_file(kio_kobj,
+				   &ramp_seconds_attribute.attr);
+	if (retval)
+		goto err_ramp_seconds;
+
+	// Create the stats_interval_msec file
+	retval = sysfs_create_file(kio_kobj,
+				   &stats_interval_msec_attribute.attr);
+	if (retval)
+		goto err_stats_interval_msec;
+
+	// Create the sweep file
+	retval = sysfs_create_file(kio_kobj,
+				   &sweep_attribute.attr);
+	if (retval)
+		goto err_sweep;
+
+	// Create the steady_state file
+	retval = sysfs_create_file(kio_kobj,
+				   &steady_state_attribute.attr);
+	if (retval)
+		goto err_steady_state;
+
+	// Create the queue_placement file
+	retval = sysfs_create_file(kio_kobj,
+				   &queue_placement_attribute.attr);
+	if (retval)
+		goto err_queue_placement;
+
 	// Create the run_workload file
 	retval = sysfs_create_file(kio_kobj,
 				   &run_workload_attribute.attr);
 	if (retval)
 		goto err_run_workload;
 
+	// Create the stop and status files
+	retval = sysfs_create_file(kio_kobj,
+				   &stop_attribute.attr);
+	if (retval)
+		goto err_status;
+
+	retval = sysfs_create_file(kio_kobj,
+				   &status_attribute.attr);
+	if (retval)
+		goto err_status;
+
+	// Create the results file
+	retval = sysfs_create_file(kio_kobj,
+				   &results_attribute.attr);
+	if (retval)
+		goto err_results;
+
+	retval = sysfs_create_bin_file(kio_kobj,
+				       &results_json_attribute);
+	if (retval)
+		goto err_results;
+
+	retval = sysfs_create_bin_file(kio_kobj,
+				       &sweep_results_json_attribute);
+	if (retval)
+		goto err_results;
+
+	// Create the trace file, for replay
+	retval = sysfs_create_bin_file(kio_kobj,
+				       &trace_attribute);
+	if (retval)
+		goto err_results;
+
+	// Create the targets, add_target, and remove_target files
+	retval = sysfs_create_file(kio_kobj,
+				   &targets_attribute.attr);
+	if (retval)
+		goto err_targets;
+
+	retval = sysfs_create_file(kio_kobj,
+				   &add_target_attribute.attr);
+	if (retval)
+		goto err_targets;
+
+	retval = sysfs_create_file(kio_kobj,
+				   &remove_target_attribute.attr);
+	if (retval)
+		goto err_targets;
+
 	return 0;
 
+err_targets:
+err_results:
+err_status:
 err_run_workload:
+err_queue_placement:
+err_steady_state:
+err_sweep:
+err_stats_interval_msec:
+err_ramp_seconds:
 err_runtime_seconds:
 err_num_threads:
 	kobject_put(kio_kobj);
 	return retval;
 }
+void kio_config_close(void)
+{
+	mutex_lock(&kio_config.mutex);
+	kio_config.exiting = true;
+	mutex_unlock(&kio_config.mutex);
+}
+
 void kio_config_exit(void)
 {
 	kio_config_destroy_all_threads();
 
 	kobject_put(kio_kobj);
+
+	kio_trace_exit();
 }
@@ -9,10 +9,81 @@ struct kio_thread_config;
 
 #define KIO_MAX_RUNTIME_SECONDS 3600
 
+#define KIO_MAX_RATE_IOPS       100000000
+#define KIO_MAX_RATE_BPS        (1ULL << 44)    // 16 TiB/s, fits the bucket
+
+#define KIO_MIN_STATS_INTERVAL_MSEC 100
+#define KIO_MAX_STATS_INTERVAL_MSEC 60000
+
+#define KIO_CPU_ANY            -1       // let the scheduler place the thread
+#define KIO_NUMA_NODE_AUTO     -2       // use the block device's node
+
+/* a sweep runs one step per value, back to back, setting the swept
+ * parameter on all threads for each step */
+#define KIO_MAX_SWEEP_STEPS 64
+
+enum kio_sweep_param {
+	KIO_SWEEP_NONE,
+	KIO_SWEEP_QUEUE_DEPTH,
+	KIO_SWEEP_RATE_IOPS,
+	KIO_SWEEP_RATE_BPS,
+	KIO_SWEEP_NR
+};
+
+extern const char *kio_sweep_param_name[KIO_SWEEP_NR];
+
+struct kio_sweep_plan {
+	enum kio_sweep_param param;
+	uint32_t warmup_seconds;        // discarded run before each step
+	uint32_t nr_steps;
+	uint64_t values[KIO_MAX_SWEEP_STEPS];
+};
+
+/* ends a run once the device has settled, see kio_steady.h */
+#define KIO_MAX_STEADY_WINDOW 32
+
+struct kio_steady_plan {
+	uint8_t metric;                 // enum kio_steady_metric, 0 for none
+	uint32_t window;                // samples that have to agree
+	uint32_t interval_msec;         // between samples
+	uint32_t range_percent;         // max-min, of the window average
+	uint32_t slope_percent;         // best fit change, of the average
+};
+
+/* where threads that do not set a cpu run, relative to the blk-mq
+ * hardware queues of their device; the queue of an IO follows the cpu it
+ * is submitted from */
+enum kio_queue_placement {
+	KIO_QUEUE_ANY,                  // wherever the scheduler puts them
+	KIO_QUEUE_SPREAD,               // a queue each, round robin
+	KIO_QUEUE_CONCENTRATE,          // all on the first queue
+	KIO_QUEUE_NR
+};
+
+extern const char *kio_queue_placement_name[KIO_QUEUE_NR];
+
+/* what writes carry, see kio_pattern.h */
+enum kio_data_pattern {
+	KIO_PATTERN_ZEROS,              // whatever is in the buffers
+	KIO_PATTERN_RANDOM,             // incompressible, unique
+	KIO_PATTERN_COMPRESS,           // compress_percent of each block is zeroes
+	KIO_PATTERN_DEDUP,              // dedup_percent of writes are duplicates
+	KIO_PATTERN_NR
+};
+
+extern const char *kio_data_pattern_name[KIO_PATTERN_NR];
+
 struct kio_config {
 	struct mutex mutex;
+	bool exiting;                   // module is unloading, no more runs
 
 	uint32_t runtime_seconds;
+	uint32_t ramp_seconds;          // not measured, before runtime_seconds
+	uint32_t stats_interval_msec;   // live stats period, 0 to disable
+
+	struct kio_sweep_plan sweep;    // run a sweep, if param is set
+	struct kio_steady_plan steady;  // end runs early, if metric is set
+	uint8_t queue_placement;        // enum kio_queue_placement
 
 	uint32_t num_threads;
 	struct kio_thread_config *threads;
@@ -29,17 +100,46 @@ struct kio_thread_config {
 	int32_t offset_stride;          // offset increment, if non-zero
 
 	uint32_t offset_random:1;       // if set random offsets
+	uint8_t offset_dist;            // of random offsets, enum kio_offset_dist
+	uint32_t offset_dist_param;     // see kio_dist.h, 0 for the default
+	uint8_t hot_io_percent;         // for the hotset distribution
+	uint8_t replay;                 // the loaded trace, enum kio_replay_mode
 	uint32_t burst_delay:1;         // delay applied on burst, not IOs
 	uint32_t burst_finish:1;        // finish burst before starting another
+	uint32_t poll:1;                // poll for completions, don't sleep
+	uint32_t verify:1;              // write checked patterns, verify reads
 
 	uint8_t read_mix_percent;       // mix of bursts, not IOs
+	uint8_t fua_percent;            // of writes, with forced unit access
+	uint8_t discard_percent;        // of IOs, instead of a read or write
+	uint8_t write_zeroes_percent;   // same for write zeroes ...
+	uint8_t flush_percent;          // ... and for flushes
 
 	uint32_t read_burst;            // keep reading for this many IOs
 	uint32_t write_burst;           // keep writing for this many IOs
 
 	uint32_t read_sleep_usec;       // delay after each read
 	uint32_t write_sleep_usec;      // delay after each write
+
+	uint32_t submit_batch;          // plug this many submissions together
+
+	uint32_t rate_iops;             // pace IOs to this rate, if non-zero
+	uint64_t rate_bps;              // pace IOs to this bandwidth, if non-zero
+
+	uint8_t data_pattern;           // enum kio_data_pattern
+	uint8_t compress_percent;       // for KIO_PATTERN_COMPRESS
+	uint8_t dedup_percent;          // for KIO_PATTERN_DEDUP
+
+	int32_t target;                 // index of target block device
+
+	uint64_t seed;                  // of random choices, 0 for a random seed
+
+	int32_t cpu;                    // bind thread to cpu, or KIO_CPU_ANY
+	int32_t numa_node;              // thread and buffer node, NUMA_NO_NODE,
+	                                // or KIO_NUMA_NODE_AUTO
 };
 
 extern int kio_config_init(void);
+/* refuse new runs, before the current one is stopped on unload */
+extern void kio_config_close(void);
 extern void kio_config_exit(void);
@@ -0,0 +1,248 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+
+#include "kio_dist.h"
+#include "kio_config.h"
+
+const char *kio_offset_dist_name[KIO_DIST_NR] = {
+	[KIO_DIST_UNIFORM] = "uniform",
+	[KIO_DIST_ZIPF]    = "zipf",
+	[KIO_DIST_PARETO]  = "pareto",
+	[KIO_DIST_NORMAL]  = "normal",
+	[KIO_DIST_HOTSET]  = "hotset",
+};
+
+const u32 kio_offset_dist_default[KIO_DIST_NR] = {
+	[KIO_DIST_ZIPF]    = 990,       // as in YCSB
+	[KIO_DIST_PARETO]  = 200,       // 80% of IOs to 20% of blocks
+	[KIO_DIST_NORMAL]  = 100,       // 10% of the range
+	[KIO_DIST_HOTSET]  = 100,       // 10% of the range ...
+};
+
+#define KIO_DIST_HOT_IO_PERCENT 90      // ... gets 90% of IOs
+
+// ------------------------------------------------------------------------
+// fixed point: logs are s64 with 32 fractional bits, values are u64 with
+// 16 fractional bits, which is plenty for a table of quantiles
+
+#define KIO_FP_LOG_SHIFT        32
+#define KIO_FP_VAL_SHIFT        16
+#define KIO_FP_VAL_ONE          (1ULL << KIO_FP_VAL_SHIFT)
+#define KIO_FP_VAL_MAX          (1ULL << 62)
+
+/* 2^(2^-k) for k=1..30, with 30 fractional bits */
+static const u32 kio_fp_exp2_frac[30] = {
+	1518500250, 1276901417, 1170923762, 1121280436, 1097253708,
+	1085434106, 1079572136, 1076653033, 1075196443, 1074468888,
+	1074105294, 1073923544, 1073832680, 1073787251, 1073764537,
+	1073753181, 1073747502, 1073744663, 1073743244, 1073742534,
+	1073742179, 1073742001, 1073741913, 1073741868, 1073741846,
+	1073741835, 1073741830, 1073741827, 1073741825, 1073741825,
+};
+
+/* log2 of a non-zero value */
+static s64 kio_fp_log2(u64 val)
+{
+	int msb = fls64(val) - 1;
+	s64 result = (s64)(msb - KIO_FP_VAL_SHIFT) << KIO_FP_LOG_SHIFT;
+	u64 y;
+	int bit;
+
+	/* mantissa in [1,2) with 30 fractional bits, squared repeatedly */
+	y = msb > 30 ? val >> (msb - 30) : val << (30 - msb);
+
+	for (bit = KIO_FP_LOG_SHIFT - 1; bit >= 0; bit--) {
+		y = (y * y) >> 30;
+		if (y >= (2ULL << 30)) {
+			y >>= 1;
+			result += 1LL << bit;
+		}
+	}
+
+	return result;
+}
+
+/* 2 to the power of a log, saturating */
+static u64 kio_fp_exp2(s64 log)
+{
+	s64 whole = log >> KIO_FP_LOG_SHIFT;
+	u32 frac = log & ((1ULL << KIO_FP_LOG_SHIFT) - 1);
+	u64 y = 1ULL << 30;
+	int k, shift;
+
+	for (k = 1; k <= ARRAY_SIZE(kio_fp_exp2_frac); k++)
+		if (frac & (1U << (KIO_FP_LOG_SHIFT - k)))
+			y = (y * kio_fp_exp2_frac[k - 1]) >> 30;
+
+	/* from 30 fractional bits to KIO_FP_VAL_SHIFT, times 2^whole */
+	shift = whole + KIO_FP_VAL_SHIFT - 30;
+	if (shift >= 0)
+		return shift >= 31 ? KIO_FP_VAL_MAX : y << shift;
+	return shift <= -63 ? 0 : y >> -shift;
+}
+
+/* log * num / den, where num/den is an exponent in thousandths */
+static s64 kio_fp_log_scale(s64 log, s64 num, s64 den)
+{
+	return div64_s64(log * num, den);
+}
+
+// ------------------------------------------------------------------------
+
+/* inverse CDF at quantile u = i/KIO_DIST_QUANTILES, as a 1-based rank
+ *
+ * zipf, continuous and bounded to [1, n+1):
+ *     x = (1 + u * ((n+1)^(1-theta) - 1)) ^ (1/(1-theta))
+ *     or (n+1)^u when theta is 1
+ * pareto, as in fio, where h of the blocks get 1-h of the IOs:
+ *     x = 1 + n * u^(log(h) / log(1-h))
+ */
+static u64 kio_dist_quantile(enum kio_offset_dist type, u32 param,
+			     s64 log_n, unsigned i)
+{
+	s64 one_minus = 1000 - (s64)param;
+	s64 log_u, power;
+	u64 a, b;
+
+	switch (type) {
+	case KIO_DIST_ZIPF:
+		if (!one_minus)
+			return kio_fp_exp2(mul_u64_u32_shr(log_n, i,
+						ilog2(KIO_DIST_QUANTILES)));
+
+		a = kio_fp_exp2(kio_fp_log_scale(log_n, one_minus, 1000));
+		if (a >= KIO_FP_VAL_ONE)
+			b = KIO_FP_VAL_ONE + mul_u64_u32_shr(a - KIO_FP_VAL_ONE,
+					i, ilog2(KIO_DIST_QUANTILES));
+		else
+			b = KIO_FP_VAL_ONE - mul_u64_u32_shr(KIO_FP_VAL_ONE - a,
+					i, ilog2(KIO_DIST_QUANTILES));
+		b = max_t(u64, b, 1);
+		return kio_fp_exp2(kio_fp_log_scale(kio_fp_log2(b),
+						    1000, one_minus));
+
+	case KIO_DIST_PARETO:
+		/* power with 16 fractional bits */
+		power = div64_s64(kio_fp_log2(div_u64((u64)param
+						<< KIO_FP_VAL_SHIFT, 1000))
+				  << KIO_FP_VAL_SHIFT,
+				  kio_fp_log2(div_u64((u64)one_minus
+						<< KIO_FP_VAL_SHIFT, 1000)));
+		log_u = kio_fp_log2(div_u64((u64)i << KIO_FP_VAL_SHIFT,
+					    KIO_DIST_QUANTILES));
+		a = kio_fp_exp2((log_u >> KIO_FP_VAL_SHIFT) * power);
+		b = kio_fp_exp2(log_n) - KIO_FP_VAL_ONE;
+		return KIO_FP_VAL_ONE + ((b >> KIO_FP_VAL_SHIFT) * a);
+
+	default:
+		return KIO_FP_VAL_ONE;
+	}
+}
+
+static int kio_dist_init_quantiles(struct kio_dist *d, u32 param, int nid)
+{
+	s64 log_n = kio_fp_log2((d->nr_blocks + 1) << KIO_FP_VAL_SHIFT);
+	u64 x, prev = 0;
+	unsigned i;
+
+	d->quantiles = kmalloc_node((KIO_DIST_QUANTILES + 1)
+				    * sizeof(*d->quantiles), GFP_KERNEL, nid);
+	if (!d->quantiles)
+		return -ENOMEM;
+
+	d->quantiles[0] = 0;
+	for (i = 1; i < KIO_DIST_QUANTILES; i++) {
+		/* ranks are 1-based, blocks are 0-based */
+		x = kio_dist_quantile(d->type, param, log_n, i)
+			>> KIO_FP_VAL_SHIFT;
+		x = clamp_t(u64, x ? x - 1 : 0, prev, d->nr_blocks);
+		d->quantiles[i] = prev = x;
+	}
+	d->quantiles[KIO_DIST_QUANTILES] = d->nr_blocks;
+
+	return 0;
+}
+
+int kio_dist_init(struct kio_dist *d, const struct kio_thread_config *ktc,
+		  u64 nr_blocks, int nid)
+{
+	u32 param = ktc->offset_dist_param
+		?: kio_offset_dist_default[ktc->offset_dist];
+
+	memset(d, 0, sizeof(*d));
+	d->type = ktc->offset_dist;
+	d->nr_blocks = max_t(u64, nr_blocks, 1);
+
+	switch (d->type) {
+	case KIO_DIST_ZIPF:
+	case KIO_DIST_PARETO:
+		return kio_dist_init_quantiles(d, param, nid);
+
+	case KIO_DIST_NORMAL:
+		/* the sum of 4 uniforms has a sigma of 1/sqrt(3) of its half
+		 * width, see kio_dist_next() */
+		d->center = d->nr_blocks / 2;
+		d->sigma = div_u64(d->nr_blocks * param * 1732, 1000 * 1000);
+		return 0;
+
+	case KIO_DIST_HOTSET:
+		d->hot_blocks = clamp_t(u64, div_u64(d->nr_blocks * param, 1000),
+					1, d->nr_blocks);
+		d->hot_io_percent = ktc->hot_io_percent
+			?: KIO_DIST_HOT_IO_PERCENT;
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+void kio_dist_free(struct kio_dist *d)
+{
+	kfree(d->quantiles);
+	d->quantiles = NULL;
+}
+
+u64 kio_dist_next(const struct kio_dist *d, struct kio_rand *r)
+{
+	u64 lo, hi;
+	s64 sum;
+	unsigned q;
+
+	switch (d->type) {
+	case KIO_DIST_ZIPF:
+	case KIO_DIST_PARETO:
+		q = kio_rand_u32(r) & (KIO_DIST_QUANTILES - 1);
+		lo = d->quantiles[q];
+		hi = d->quantiles[q + 1];
+		if (lo >= d->nr_blocks)
+			return d->nr_blocks - 1;
+		return hi > lo ? lo + kio_rand_below(r, hi - lo) : lo;
+
+	case KIO_DIST_NORMAL:
+		/* Irwin-Hall: sum of 4 uniforms, centered, in [-2, 2) << 32 */
+		sum = (s64)kio_rand_u32(r) + kio_rand_u32(r) + kio_rand_u32(r)
+			+ kio_rand_u32(r) - (2LL << 32);
+		sum = (s64)d->center + (((sum >> 16) * (s64)d->sigma) >> 16);
+		/* wrap around the ends, at most 3.5 sigma is a few ranges */
+		while (sum < 0)
+			sum += d->nr_blocks;
+		while (sum >= (s64)d->nr_blocks)
+			sum -= d->nr_blocks;
+		return sum;
+
+	case KIO_DIST_HOTSET:
+		if (kio_rand_below(r, 100) < d->hot_io_percent
+		    || d->hot_blocks >= d->nr_blocks)
+			return kio_rand_below(r, d->hot_blocks);
+		return d->hot_blocks
+			+ kio_rand_below(r, d->nr_blocks - d->hot_blocks);
+
+	default:
+		return kio_rand_below(r, d->nr_blocks);
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "kio_rand.h"
+
+struct kio_thread_config;
+
+/* random offset distributions
+ *
+ * The offset range of a thread is split into blocks of block_size, and
+ * each random IO picks a block.  Block 0, at offset_low, is the hottest
+ * for the skewed distributions:
+ *
+ *  - uniform: every block is equally likely,
+ *  - zipf: block k is picked with probability ~ 1/(k+1)^theta,
+ *  - pareto: 1-h of the IOs go to the first h of the blocks, as in fio,
+ *  - normal: centered on the middle of the range, wrapping at the ends,
+ *  - hotset: hot_io_percent of IOs go to the first part of the range.
+ *
+ * Everything that needs fractional powers is done once, by kio_dist_init(),
+ * into a table of inverse CDF quantiles.  Picking a block is O(1) and does
+ * not allocate: a random quantile, then a uniform pick inside it.
+ */
+
+enum kio_offset_dist {
+	KIO_DIST_UNIFORM,
+	KIO_DIST_ZIPF,                  // param: theta, in thousandths
+	KIO_DIST_PARETO,                // param: h, in thousandths
+	KIO_DIST_NORMAL,                // param: sigma, in thousandths of range
+	KIO_DIST_HOTSET,                // param: hot set, in thousandths of range
+	KIO_DIST_NR
+};
+
+extern const char *kio_offset_dist_name[KIO_DIST_NR];
+
+/* used when offset_dist_param is 0 */
+extern const u32 kio_offset_dist_default[KIO_DIST_NR];
+
+#define KIO_DIST_QUANTILES      1024    // power of 2
+
+struct kio_dist {
+	enum kio_offset_dist type;
+	u64 nr_blocks;
+
+	u64 *quantiles;                 // KIO_DIST_QUANTILES + 1 block indexes
+
+	u64 center;                     // normal
+	u64 sigma;                      // normal, in blocks, times sqrt(3)
+
+	u64 hot_blocks;                 // hotset
+	u32 hot_io_percent;
+};
+
+extern int kio_dist_init(struct kio_dist *d,
+			 const struct kio_thread_config *ktc,
+			 u64 nr_blocks, int nid);
+extern void kio_dist_free(struct kio_dist *d);
+
+/* index of the next block, less than nr_blocks */
+extern u64 kio_dist_next(const struct kio_dist *d, struct kio_rand *r);
@@ -0,0 +1,163 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/math64.h>
+
+#include "kio_config.h"
+#include "kio_op.h"
+#include "kio_rand.h"
+#include "kio_dist.h"
+#include "kio_results.h"
+
+/* the direction, op and offset of a thread's next IO
+ *
+ * Shared by the module and kio-uring, so that a thread with the same seed
+ * and config picks the same IOs in both: every choice draws from
+ * gen->rand, always in the same order.
+ */
+
+struct kio_dir {
+	u8 is_write;
+	u8 dir_changed;
+	u8 new_burst;
+	u8 op;                          // enum kio_op
+};
+
+struct kio_gen {
+	const struct kio_thread_config *config;
+	unsigned block_size;            // of the device, offsets are aligned to it
+	struct kio_rand rand;           // offsets, directions and stamps
+	struct kio_dist dist;           // of random offsets
+
+	u32 read_burst;                 // IOs left in the current burst
+	u32 write_burst;
+	off_t next_offset;              // of sequential IO
+	u8 was_write;
+};
+
+static inline struct kio_dir kio_gen_next_dir(struct kio_gen *gen)
+{
+	const struct kio_thread_config *ktc = gen->config;
+	u32 rnd;
+	struct kio_dir dir = {};
+
+	if (gen->read_burst) {
+		gen->read_burst --;
+		dir.is_write = false;
+		goto finish;
+	}
+
+	if (gen->write_burst) {
+		gen->write_burst --;
+		dir.is_write = true;
+		goto finish;
+	}
+
+	if (ktc->read_mix_percent >= 100) {
+		dir.is_write = false;
+		goto finish;
+	}
+
+	if (ktc->read_mix_percent < 1) {
+		dir.is_write = true;
+		goto finish;
+	}
+
+	dir.new_burst = 1;
+
+	rnd = kio_rand_below(&gen->rand, 100);
+	if (rnd < ktc->read_mix_percent) {
+		gen->read_burst = ktc->read_burst ? ktc->read_burst - 1 : 0;
+		dir.is_write = false;
+	} else {
+		gen->write_burst = ktc->write_burst ? ktc->write_burst - 1 : 0;
+		dir.is_write = true;
+	}
+
+finish:
+	dir.dir_changed = gen->was_write != dir.is_write;
+	gen->was_write = dir.is_write;
+	dir.op = dir.is_write ? KIO_OP_WRITE : KIO_OP_READ;
+	return dir;
+}
+
+/* some IOs are replaced by ops without data, and some writes get FUA;
+ * bursts count them as the IOs they replaced */
+static inline void kio_gen_next_op(struct kio_gen *gen, struct kio_dir *dir)
+{
+	const struct kio_thread_config *ktc = gen->config;
+	u32 rnd;
+
+	if (ktc->discard_percent || ktc->write_zeroes_percent
+	    || ktc->flush_percent) {
+		rnd = kio_rand_below(&gen->rand, 100);
+		if (rnd < ktc->discard_percent)
+			dir->op = KIO_OP_DISCARD;
+		else if ((rnd -= ktc->discard_percent)
+			 < ktc->write_zeroes_percent)
+			dir->op = KIO_OP_WRITE_ZEROES;
+		else if (rnd - ktc->write_zeroes_percent < ktc->flush_percent)
+			dir->op = KIO_OP_FLUSH;
+	}
+
+	if (dir->op == KIO_OP_WRITE && ktc->fua_percent
+	    && kio_rand_below(&gen->rand, 100) < ktc->fua_percent)
+		dir->op = KIO_OP_WRITE_FUA;
+}
+
+static inline off_t kio_gen_next_offset(struct kio_gen *gen)
+{
+	const struct kio_thread_config *ktc = gen->config;
+	off_t result, range, r_end;
+
+	range = ktc->offset_high - ktc->offset_low;
+	if (unlikely (!range))
+		return ktc->offset_low;
+
+	if (ktc->offset_random && gen->dist.type != KIO_DIST_UNIFORM) {
+		result = ktc->offset_low
+			+ kio_dist_next(&gen->dist, &gen->rand) * ktc->block_size;
+
+	} else if (ktc->offset_random) {
+		result = ktc->offset_low + kio_rand_below(&gen->rand, range);
+
+	} else {
+		int32_t stride = ktc->offset_stride;
+
+		result = gen->next_offset;
+
+		gen->next_offset += stride;
+		r_end = gen->next_offset + ktc->block_size;
+		if (r_end > ktc->offset_high) {
+			if (stride > 0)
+				gen->next_offset = ktc->offset_low;
+			else
+				gen->next_offset = r_end;
+		} else if (r_end < ktc->offset_low) {
+			if (stride < 0)
+				gen->next_offset = r_end;
+			else
+				gen->next_offset = ktc->offset_low;
+		}
+	}
+
+	/* must be a multiple of a block size */
+	result /= gen->block_size;
+	result *= gen->block_size;
+
+	return result;
+}
+
+/* which part of the offset range the IOs land in */
+static inline void kio_gen_coverage(const struct kio_thread_config *ktc,
+				    u64 *coverage, off_t offset)
+{
+	off_t pos = offset - ktc->offset_low;
+	u64 range = ktc->offset_high - ktc->offset_low;
+	u64 idx = 0;
+
+	if (pos > 0)
+		idx = min_t(u64, div64_u64((u64)pos * KIO_COVERAGE_BUCKETS,
+					   range), KIO_COVERAGE_BUCKETS - 1);
+	coverage[idx]++;
+}
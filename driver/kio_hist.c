@@ -0,0 +1,138 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+
+#include "kio_hist.h"
+
+const u32 kio_hist_pct_ppm[KIO_HIST_PCT_COUNT] = {
+	500000, 900000, 990000, 999000, 999900,
+};
+
+const char *kio_hist_pct_name[KIO_HIST_PCT_COUNT] = {
+	"p50", "p90", "p99", "p99.9", "p99.99",
+};
+
+struct kio_hist *kio_hist_alloc(unsigned count)
+{
+	/* all zero is a valid empty histogram */
+	return vzalloc(count * sizeof(struct kio_hist));
+}
+
+void kio_hist_free(struct kio_hist *h)
+{
+	vfree(h);
+}
+
+void kio_hist_merge(struct kio_hist *dst, const struct kio_hist *src)
+{
+	int i;
+
+	for (i = 0; i < KIO_HIST_BUCKETS; i++) {
+		s64 cnt = atomic64_read(&src->buckets[i]);
+		if (cnt)
+			atomic64_add(cnt, &dst->buckets[i]);
+	}
+
+	atomic64_add(atomic64_read(&src->count), &dst->count);
+	atomic64_add(atomic64_read(&src->sum), &dst->sum);
+	kio_hist_update_max(dst, atomic64_read(&src->max));
+}
+
+/* smallest value that maps into a bucket */
+u64 kio_hist_bucket_low(unsigned index)
+{
+	unsigned group = index >> KIO_HIST_SUB_BITS;
+	unsigned sub = index & (KIO_HIST_SUB_COUNT - 1);
+
+	if (!group)
+		return sub;
+
+	return (u64)(KIO_HIST_SUB_COUNT + sub) << (group - 1);
+}
+
+/* number of values that map into a bucket */
+u64 kio_hist_bucket_width(unsigned index)
+{
+	unsigned group = index >> KIO_HIST_SUB_BITS;
+
+	return group ? 1ULL << (group - 1) : 1;
+}
+
+/* value we report for a bucket, which is its midpoint */
+static u64 kio_hist_bucket_value(unsigned index)
+{
+	return kio_hist_bucket_low(index) + kio_hist_bucket_width(index) / 2;
+}
+
+/* what was added to cur since the last call, which saved cur in prev
+ *
+ * cur can still be updated concurrently, so count is recomputed from the
+ * buckets that were read.  The max of the interval is not tracked; it is
+ * approximated by the top of the highest bucket that changed.
+ */
+void kio_hist_delta(struct kio_hist *delta, const struct kio_hist *cur,
+		    struct kio_hist *prev)
+{
+	s64 val, old, count = 0, sum;
+	int i, top = -1;
+
+	for (i = 0; i < KIO_HIST_BUCKETS; i++) {
+		val = atomic64_read(&cur->buckets[i]);
+		old = atomic64_read(&prev->buckets[i]);
+		atomic64_set(&prev->buckets[i], val);
+		atomic64_set(&delta->buckets[i], val - old);
+		if (val != old) {
+			count += val - old;
+			top = i;
+		}
+	}
+
+	sum = atomic64_read(&cur->sum);
+	old = atomic64_read(&prev->sum);
+	atomic64_set(&prev->sum, sum);
+	atomic64_set(&delta->sum, sum - old);
+
+	atomic64_set(&prev->count, atomic64_read(&cur->count));
+	atomic64_set(&delta->count, count);
+
+	val = atomic64_read(&cur->max);
+	atomic64_set(&prev->max, val);
+	if (top >= 0 && top + 1 < KIO_HIST_BUCKETS)
+		val = min_t(s64, val, kio_hist_bucket_low(top + 1) - 1);
+	atomic64_set(&delta->max, top >= 0 ? val : 0);
+}
+
+void kio_hist_percentiles(const struct kio_hist *h, struct kio_hist_pct *pct)
+{
+	u64 count, cumulative = 0, want[KIO_HIST_PCT_COUNT];
+	int i, p = 0;
+
+	memset(pct, 0, sizeof(*pct));
+
+	count = atomic64_read(&h->count);
+	if (!count)
+		return;
+
+	pct->count = count;
+	pct->avg = div64_u64(atomic64_read(&h->sum), count);
+	pct->max = atomic64_read(&h->max);
+
+	/* number of samples at or below each percentile, rounded up */
+	for (i = 0; i < KIO_HIST_PCT_COUNT; i++)
+		want[i] = div64_u64(count * kio_hist_pct_ppm[i] + 999999,
+				    1000000) ?: 1;
+
+	for (i = 0; i < KIO_HIST_BUCKETS && p < KIO_HIST_PCT_COUNT; i++) {
+		cumulative += atomic64_read(&h->buckets[i]);
+		while (p < KIO_HIST_PCT_COUNT && cumulative >= want[p]) {
+			pct->pct[p] = min(kio_hist_bucket_value(i), pct->max);
+			p++;
+		}
+	}
+
+	/* buckets were still being updated while we were walking them */
+	for (; p < KIO_HIST_PCT_COUNT; p++)
+		pct->pct[p] = pct->max;
+}
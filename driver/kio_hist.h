@@ -0,0 +1,98 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+
+/* log-linear latency histogram
+ *
+ * Values below 2^KIO_HIST_SUB_BITS get a bucket each, after that every
+ * power of 2 is split into 2^KIO_HIST_SUB_BITS linear buckets.  With 4
+ * sub-bits the bucket midpoint is within ~3% of any recorded value.
+ * Values at or above 2^KIO_HIST_MAX_BITS nsec (~68 seconds) land in the
+ * last bucket, but are still accounted for in max.
+ *
+ * Updates are lock-free, and can be done concurrently from the submitting
+ * thread and from bio completion context.
+ */
+
+#define KIO_HIST_SUB_BITS  4
+#define KIO_HIST_SUB_COUNT (1 << KIO_HIST_SUB_BITS)
+#define KIO_HIST_MAX_BITS  36
+#define KIO_HIST_BUCKETS   ((KIO_HIST_MAX_BITS - KIO_HIST_SUB_BITS + 1) \
+			    * KIO_HIST_SUB_COUNT)
+
+struct kio_hist {
+	atomic64_t count;
+	atomic64_t sum;
+	atomic64_t max;
+	atomic64_t buckets[KIO_HIST_BUCKETS];
+};
+
+/* percentiles we report, in parts per million */
+#define KIO_HIST_PCT_COUNT 5
+extern const u32 kio_hist_pct_ppm[KIO_HIST_PCT_COUNT];
+extern const char *kio_hist_pct_name[KIO_HIST_PCT_COUNT];
+
+struct kio_hist_pct {
+	u64 count;
+	u64 avg;
+	u64 pct[KIO_HIST_PCT_COUNT];
+	u64 max;
+};
+
+static inline unsigned kio_hist_index(u64 val)
+{
+	unsigned msb, shift;
+
+	if (val < KIO_HIST_SUB_COUNT)
+		return val;
+
+	msb = fls64(val) - 1;
+	if (unlikely (msb >= KIO_HIST_MAX_BITS))
+		return KIO_HIST_BUCKETS - 1;
+
+	shift = msb - KIO_HIST_SUB_BITS;
+	return ((shift + 1) << KIO_HIST_SUB_BITS)
+		+ ((val >> shift) & (KIO_HIST_SUB_COUNT - 1));
+}
+
+static inline void kio_hist_update_max(struct kio_hist *h, s64 val)
+{
+	s64 max = atomic64_read(&h->max);
+
+	while (val > max) {
+		s64 old = atomic64_cmpxchg(&h->max, max, val);
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+static inline void kio_hist_add(struct kio_hist *h, s64 val)
+{
+	if (unlikely (val < 0))
+		val = 0;
+
+	atomic64_inc(&h->buckets[kio_hist_index(val)]);
+	atomic64_inc(&h->count);
+	atomic64_add(val, &h->sum);
+	kio_hist_update_max(h, val);
+}
+
+static inline u64 kio_hist_count(const struct kio_hist *h)
+{
+	return atomic64_read(&h->count);
+}
+
+extern struct kio_hist *kio_hist_alloc(unsigned count);
+extern void kio_hist_free(struct kio_hist *h);
+
+extern void kio_hist_merge(struct kio_hist *dst, const struct kio_hist *src);
+extern void kio_hist_delta(struct kio_hist *delta, const struct kio_hist *cur,
+			   struct kio_hist *prev);
+extern void kio_hist_percentiles(const struct kio_hist *h,
+				 struct kio_hist_pct *pct);
+
+extern u64 kio_hist_bucket_low(unsigned index);
+extern u64 kio_hist_bucket_width(unsigned index);
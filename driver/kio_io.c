@@ -10,13 +10,15 @@
 #include <linux/slab.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/cpumask.h>
 
 #include "kio_io.h"
 #include "kio_compat.h"
 
 static char *kio_block_device;
 module_param_named(block_device, kio_block_device, charp, S_IRUGO);
-MODULE_PARM_DESC(block_device, "target for IO");
+MODULE_PARM_DESC(block_device, "first target for IO, more can be added through sysfs");
 
 static unsigned kio_io_submit_mode = 0;
 module_param_named(io_submit_mode, kio_io_submit_mode, uint, S_IRUGO|S_IWUSR);
@@ -24,36 +26,63 @@ MODULE_PARM_DESC(io_submit_mode, "0 submit_bio, 1 generic_make_request, 2 q->mak
 
 struct kio_io kio_io = {};
 
-int kio_io_init(void)
+static void kio_io_target_put(struct kio_io_target *tgt)
 {
-	char *dev_name = NULL;
+	blkdev_put(tgt->bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
+	kfree(tgt->dev_name);
+	kfree(tgt);
+}
+
+int kio_io_add_target(const char *path)
+{
+	char *tmp, *dev_name = NULL;
+	struct kio_io_target *tgt;
 	struct block_device *bdev;
 	struct request_queue *q;
 	size_t dev_byte_size;
-	unsigned block_size = 0;
-	int rc;
+	unsigned block_size = 0, max_io_size, max_discard, max_write_zeroes;
+	int rc, i, index;
 
 	/* get the device */
 
-	if (!kio_block_device) {
-		pr_warn("kio: no block_device provided for IO\n");
-		return -EINVAL;
-	}
-
-	pr_debug("%s: block_device: %s\n", __func__, kio_block_device);
-
-	dev_name = strim(kstrdup(kio_block_device, GFP_KERNEL));
+	tmp = kstrdup(path, GFP_KERNEL);
+	if (tmp)
+		dev_name = kstrdup(strim(tmp), GFP_KERNEL);
+	kfree(tmp);
 	if (!dev_name) {
 		pr_warn("kio: could not to allocate space for devname %s\n",
-			kio_block_device);
+			path);
 		return -ENOMEM;
 	}
 
+	pr_debug("%s: block_device: %s\n", __func__, dev_name);
+
+	mutex_lock(&kio_io.mutex);
+
+	index = -1;
+	for (i = 0; i < KIO_MAX_TARGETS; i++) {
+		if (!kio_io.targets[i]) {
+			if (index < 0)
+				index = i;
+		} else if (!strcmp(kio_io.targets[i]->dev_name, dev_name)) {
+			pr_warn("kio: %s is already target %d\n",
+				dev_name, i);
+			rc = -EEXIST;
+			goto err_release_dev_name;
+		}
+	}
+	if (index < 0) {
+		pr_warn("kio: cannot add %s, all %u targets in use\n",
+			dev_name, KIO_MAX_TARGETS);
+		rc = -ENOSPC;
+		goto err_release_dev_name;
+	}
+
 	bdev = blkdev_get_by_path(dev_name, FMODE_READ|FMODE_WRITE|FMODE_EXCL,
 				  THIS_MODULE);
 	if (!bdev || IS_ERR(bdev)) {
 		pr_warn("kio: failed to get block device %s\n",
-			kio_block_device);
+			dev_name);
 		rc = PTR_ERR(bdev) ?: -ENODEV;
 		goto err_release_dev_name;
 	}
@@ -63,17 +92,27 @@ int kio_io_init(void)
 	q = bdev->bd_disk ? bdev->bd_disk->queue : NULL;
 	if (!q) {
 		pr_warn("kio: %s doeas not have a disk queue\n",
-			kio_block_device);
+			dev_name);
 		rc = -ENODEV;
-		goto err_no_queue;
+		goto err_put_back_bd;
 	}
 	block_size = queue_logical_block_size(q);
 
+	max_io_size = min_t(u64, (u64)queue_max_hw_sectors(q) << SECTOR_SHIFT,
+			    (u64)KIO_BIO_MAX_VECS * PAGE_SIZE);
+
+	/* dataless ops are only limited by the device, and a u32 bi_size */
+	max_discard = min_t(u64, (u64)kio_bdev_max_discard_sectors(bdev)
+			    << SECTOR_SHIFT, round_down(UINT_MAX, block_size));
+	max_write_zeroes = min_t(u64, (u64)bdev_write_zeroes_sectors(bdev)
+				 << SECTOR_SHIFT,
+				 round_down(UINT_MAX, block_size));
+
 	rc = set_blocksize(bdev, PAGE_SIZE);
 	pr_debug("%s: set_blocksize(4k): %d\n", __func__, rc);
 	if (rc) {
 		pr_warn("kio: failed to set blocksize of %s to %lu\n",
-			kio_block_device, PAGE_SIZE);
+			dev_name, PAGE_SIZE);
 		goto err_put_back_bd;
 	}
 
@@ -81,26 +120,113 @@ int kio_io_init(void)
 	pr_debug("%s: byte_size: %zu (%zu GiB)\n", __func__, dev_byte_size, dev_byte_size>>30);
 	if (dev_byte_size < (1<<30)) {
 		pr_warn("kio: %s is too small (%zu)\n",
-			kio_block_device, dev_byte_size);
+			dev_name, dev_byte_size);
 		rc = -ETOOSMALL;
 		goto err_put_back_bd;
 	}
 
 	pr_debug("%s: : %zu\n", __func__, dev_byte_size);
 
-	/* allocate the bio set */
+	tgt = kzalloc(sizeof(*tgt), GFP_KERNEL);
+	if (!tgt) {
+		rc = -ENOMEM;
+		goto err_put_back_bd;
+	}
+
+	/* finalize */
+
+	tgt->index = index;
+	tgt->dev_name = dev_name;
+	tgt->bdev = bdev;
+	tgt->dev_block_size = block_size;
+	tgt->dev_byte_size = dev_byte_size;
+	tgt->dev_max_io_size = max_io_size;
+	tgt->dev_max_discard = max_discard;
+	tgt->dev_max_write_zeroes = max_write_zeroes;
+
+	kio_io.targets[index] = tgt;
+
+	mutex_unlock(&kio_io.mutex);
+
+	pr_info("kio: target %d using %s with %zu bytes available, "
+		"with %u block size, %u max IO size, %u max discard, "
+		"%u max write zeroes\n",
+		index, tgt->dev_name, tgt->dev_byte_size,
+		block_size, max_io_size, max_discard, max_write_zeroes);
+
+	return index;
+
+err_put_back_bd:
+	blkdev_put(bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
+err_release_dev_name:
+	mutex_unlock(&kio_io.mutex);
+	kfree(dev_name);
+	return rc;
+}
+
+int kio_io_remove_target(int index)
+{
+	struct kio_io_target *tgt;
+
+	mutex_lock(&kio_io.mutex);
+	tgt = kio_io_target_get(index);
+	if (tgt)
+		kio_io.targets[index] = NULL;
+	mutex_unlock(&kio_io.mutex);
+
+	if (!tgt)
+		return -ENOENT;
+
+	pr_info("kio: removed target %d, %s\n", index, tgt->dev_name);
+	kio_io_target_put(tgt);
+	return 0;
+}
+
+ssize_t kio_io_targets_show(char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	mutex_lock(&kio_io.mutex);
+	for (i = 0; i < KIO_MAX_TARGETS; i++) {
+		struct kio_io_target *tgt = kio_io.targets[i];
+		if (!tgt)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%d %s size=%zu block_size=%u "
+				 "max_io_size=%u numa_node=%d "
+				 "max_discard=%u max_write_zeroes=%u\n",
+				 i, tgt->dev_name, tgt->dev_byte_size,
+				 tgt->dev_block_size, tgt->dev_max_io_size,
+				 kio_io_dev_numa_node(tgt),
+				 tgt->dev_max_discard,
+				 tgt->dev_max_write_zeroes);
+	}
+	mutex_unlock(&kio_io.mutex);
+
+	return len;
+}
+
+int kio_io_init(void)
+{
+	int rc;
+
+	mutex_init(&kio_io.mutex);
+
+	/* allocate the bio set, shared by all targets */
 
 #if KIO_USE_BIO_SET_MIN_COUNT
 #ifdef USE_BIOSET_INIT
 	rc = bioset_init(KIO_IO_BIO_SET(&kio_io),
-			 KIO_USE_BIO_SET_MIN_COUNT, sizeof(s64), BIOSET_NEED_BVECS);
+			 KIO_USE_BIO_SET_MIN_COUNT, sizeof(struct kio_io_bio_pad),
+			 BIOSET_NEED_BVECS);
 	if (unlikely (rc)) {
 		pr_warn("kio: could not create bio set\n");
 		goto err_bio_set_init;
 	}
 #else // USE_BIOSET_CREATE
 	KIO_IO_BIO_SET(&kio_io) = bioset_create(
-			KIO_USE_BIO_SET_MIN_COUNT, sizeof(s64)
+			KIO_USE_BIO_SET_MIN_COUNT, sizeof(struct kio_io_bio_pad)
 #ifdef BIOSET_CREATE_HAS_FLAGS
 			, BIOSET_NEED_BVECS
 #endif
@@ -113,19 +239,21 @@ int kio_io_init(void)
 #endif
 #endif
 
-	/* finalize */
+	/* the block_device parameter becomes the first target */
 
-	kio_io.dev_name = dev_name;
-	kio_io.bdev = bdev;
-	kio_io.dev_block_size = block_size;
-	kio_io.dev_byte_size = dev_byte_size;
+	if (!kio_block_device) {
+		pr_info("kio: no block_device provided, "
+			"add targets through sysfs\n");
+		return 0;
+	}
 
-	pr_info("kio: using %s with %zu bytes available, with %u block size\n",
-		kio_io.dev_name, kio_io.dev_byte_size, block_size);
+	rc = kio_io_add_target(kio_block_device);
+	if (rc < 0)
+		goto err_add_target;
 
 	return 0;
 
-err_put_back_bd:
+err_add_target:
 #if KIO_USE_BIO_SET_MIN_COUNT
 #ifdef USE_BIOSET_INIT
 	bioset_exit(KIO_IO_BIO_SET(&kio_io));
@@ -134,15 +262,125 @@ err_put_back_bd:
 #endif
 err_bio_set_init:
 #endif
-err_no_queue:
-	blkdev_put(bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
-err_release_dev_name:
-	kfree(dev_name);
 	return rc;
 }
 
+/* the cpu to hardware queue map that an IO is sent through, as
+ * blk_mq_map_queue() picks it; NULL if the device does not use blk-mq */
+static const unsigned int *kio_io_dev_mq_map(const struct kio_io_target *tgt,
+					     enum kio_op op, bool polled)
+{
+	struct request_queue *q = bdev_get_queue(tgt->bdev);
+#ifdef HAVE_BLK_MQ_QUEUE_MAPS
+	struct blk_mq_tag_set *set = q->tag_set;
+	enum hctx_type type = HCTX_TYPE_DEFAULT;
+
+	if (!q->mq_ops || !set)
+		return NULL;
+
+	if (polled)
+		type = HCTX_TYPE_POLL;
+	else if (op == KIO_OP_READ)
+		type = HCTX_TYPE_READ;
+
+	/* types without queues of their own use the default ones */
+	if (type >= set->nr_maps || !set->map[type].nr_queues)
+		type = HCTX_TYPE_DEFAULT;
+
+	return set->map[type].mq_map;
+#else
+	return q->mq_ops ? q->mq_map : NULL;
+#endif
+}
+
+unsigned kio_io_dev_nr_hctx(const struct kio_io_target *tgt)
+{
+	struct request_queue *q = bdev_get_queue(tgt->bdev);
+
+	return q->mq_ops ? q->nr_hw_queues : 0;
+}
+
+int kio_io_dev_hctx(const struct kio_io_target *tgt, int cpu,
+		    enum kio_op op, bool polled)
+{
+	const unsigned int *map = kio_io_dev_mq_map(tgt, op, polled);
+
+	return map ? map[cpu] : -1;
+}
+
+static unsigned kio_io_hctx_cpus(const unsigned int *map, unsigned hctx)
+{
+	unsigned count = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		count += map[cpu] == hctx;
+	return count;
+}
+
+int kio_io_dev_queue_cpu(const struct kio_io_target *tgt, enum kio_op op,
+			 bool polled, unsigned nth, bool spread)
+{
+	const unsigned int *map = kio_io_dev_mq_map(tgt, op, polled);
+	unsigned nr = kio_io_dev_nr_hctx(tgt), used = 0, hctx, count, n;
+	int cpu;
+
+	if (!map)
+		return -1;
+
+	/* only queues that some online cpu submits to */
+	for (hctx = 0; hctx < nr; hctx++)
+		used += !!kio_io_hctx_cpus(map, hctx);
+	if (!used)
+		return -1;
+
+	/* spread: queue nth, then the next cpu of each queue on every lap;
+	 * concentrate: the first queue, one of its cpus after another */
+	n = spread ? nth / used : nth;
+	nth = spread ? nth % used : 0;
+
+	for (hctx = 0; hctx < nr; hctx++) {
+		count = kio_io_hctx_cpus(map, hctx);
+		if (!count || nth--)
+			continue;
+
+		n %= count;
+		for_each_online_cpu(cpu)
+			if (map[cpu] == hctx && !n--)
+				return cpu;
+	}
+
+	return -1;
+}
+
+int kio_io_dev_numa_node(const struct kio_io_target *tgt)
+{
+	struct gendisk *disk = tgt->bdev ? tgt->bdev->bd_disk : NULL;
+	struct device *dev;
+	int nid = NUMA_NO_NODE;
+
+	if (!disk)
+		return NUMA_NO_NODE;
+
+	/* the disk rarely has a node of its own, but its controller does */
+	for (dev = disk_to_dev(disk); dev && nid == NUMA_NO_NODE; dev = dev->parent)
+		nid = dev_to_node(dev);
+
+	if (nid == NUMA_NO_NODE)
+		nid = disk->node_id;
+
+	return nid;
+}
+
 void kio_io_exit(void)
 {
+	int i;
+
+	for (i = 0; i < KIO_MAX_TARGETS; i++) {
+		if (kio_io.targets[i])
+			kio_io_target_put(kio_io.targets[i]);
+	}
+
 #if KIO_USE_BIO_SET_MIN_COUNT
 #ifdef USE_BIOSET_INIT
 	bioset_exit(KIO_IO_BIO_SET(&kio_io));
@@ -151,8 +389,6 @@ void kio_io_exit(void)
 #endif
 #endif
 
-	kfree(kio_io.dev_name);
-	blkdev_put(kio_io.bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
 	memset(&kio_io, 0, sizeof(kio_io));
 }
 
@@ -169,9 +405,9 @@ static struct hd_struct *kio_disk_get_part(struct gendisk *disk, int partno)
 
 #endif
 
-static inline void blk_partition_remap(struct bio *bio)
+static inline void blk_partition_remap(struct block_device *bdev,
+				       struct bio *bio)
 {
-	struct block_device *bdev = kio_io.bdev;
         struct block_device *whole = bdev_whole(bdev);
 	if (unlikely (bdev != whole)) {
 #ifdef BDEV_HAS_BD_PART
@@ -193,71 +429,169 @@ static inline void blk_partition_remap(struct bio *bio)
 	}
 }
 
-int kio_io_submit(off_t off, struct page *page, bool is_write,
-			     bio_end_io_t fn, void *bi_private)
+void kio_io_cookie_release(struct kio_io_cookie *cookie)
+{
+#ifdef HAVE_BIO_POLL
+	if (cookie->bio)
+		bio_put(cookie->bio);
+#endif
+	memset(cookie, 0, sizeof(*cookie));
+}
+
+static void kio_io_cookie_update(struct kio_io_cookie *cookie,
+				 const struct kio_io_target *tgt,
+				 struct bio *bio, blk_qc_t qc)
 {
+#if defined(HAVE_BIO_POLL)
+	/* reference was taken before submission */
+	kio_io_cookie_release(cookie);
+	cookie->bio = bio;
+#elif defined(HAVE_BLK_POLL)
+	cookie->q = bdev_get_queue(tgt->bdev);
+	cookie->qc = qc;
+#endif
+}
+
+int kio_io_poll(struct kio_io_cookie *cookie)
+{
+#if defined(HAVE_BIO_POLL)
+	if (!cookie->bio)
+		return 0;
+	return bio_poll(cookie->bio, NULL, 0);
+#elif defined(HAVE_BLK_POLL)
+	if (!cookie->q || !blk_qc_t_valid(cookie->qc))
+		return 0;
+#ifdef BLK_POLL_HAS_SPIN
+	return blk_poll(cookie->q, cookie->qc, false);
+#else
+	return blk_poll(cookie->q, cookie->qc);
+#endif
+#else
+	return 0;
+#endif
+}
+
+int kio_io_submit(const struct kio_io_target *tgt,
+		  off_t off, struct page **pages, unsigned len,
+		  enum kio_op op, s64 issue_time,
+		  struct kio_io_cookie *cookie,
+		  bio_end_io_t fn, void *bi_private)
+{
+	const bool has_data = kio_op_has_data(op);
 	struct bio *bio;
+	unsigned nr_pages, done, i;
 	int rc;
 	blk_qc_t qc;
 
-	if (unlikely (!page)) {
+	if (unlikely (cookie && !kio_io_poll_supported()))
+		return -EOPNOTSUPP;
+
+	/* only reads and writes go to the polled queues */
+	if (!has_data)
+		cookie = NULL;
+
+	if (unlikely (has_data && (!pages || !pages[0]))) {
 		pr_warn("%s: page==NULL, cannot queue %s bio\n",
-			__func__, is_write ? "write" : "read");
+			__func__, kio_op_name[op]);
 		return -EFAULT;
 	}
 
-	if (unlikely (!kio_io_offset_is_valid(off, PAGE_SIZE))) {
+	nr_pages = has_data ? DIV_ROUND_UP(len, PAGE_SIZE) : 0;
+	if (unlikely (!len || len > kio_io_dev_max_op_size(tgt, op)
+		      || len % tgt->dev_block_size)) {
+		pr_warn("%s: invalid len=%u max=%u, cannot queue %s bio\n",
+			__func__, len, kio_io_dev_max_op_size(tgt, op),
+			kio_op_name[op]);
+		return -EINVAL;
+	}
+
+	if (unlikely (!kio_io_offset_is_valid(tgt, off, len))) {
 		pr_warn("%s: invalid off=%lx max=%lx, cannot queue %s bio\n",
-			__func__, off, kio_io.dev_byte_size,
-			is_write ? "write" : "read");
+			__func__, off, tgt->dev_byte_size, kio_op_name[op]);
 		return -EINVAL;
 	}
 
-	/* NOTE: we use only 1 bvec, but allocate +1 */
+	/* NOTE: without a bio_set we allocate +1 bvec for the timestamps */
 #if KIO_USE_BIO_SET_MIN_COUNT
-	bio = bio_alloc_bioset(GFP_ATOMIC, 1, KIO_IO_BIO_SET(&kio_io));
+	bio = bio_alloc_bioset(GFP_ATOMIC, nr_pages, KIO_IO_BIO_SET(&kio_io));
 #else
-	bio = bio_alloc(GFP_ATOMIC, 2);
+	bio = bio_alloc(GFP_ATOMIC, max(nr_pages, 1U) + 1);
 #endif
 	if (unlikely (!bio))
 		return -ENOMEM;
 
-	/* the second bvec also holds the start time, see kio_io_bio_get_start_time() */
-	kio_io_bio_set_start_time(bio);
+	/* the front pad holds the timestamps, see kio_io_bio_pad() */
+	kio_io_bio_set_start_time(bio, issue_time);
 
 	bio->bi_iter.bi_sector = off >> SECTOR_SHIFT;
-	bio_set_dev(bio, kio_io.bdev);
+	bio_set_dev(bio, tgt->bdev);
 
-	rc = bio_add_page(bio, page, PAGE_SIZE, 0);
-	/* bio_add_page() returns length added on success */
-	if (unlikely (!rc)) {
-		bio_put(bio);
-		return -EIO;
+	for (i = 0, done = 0; i < nr_pages; i++) {
+		unsigned bytes = min_t(unsigned, len - done, PAGE_SIZE);
+
+		rc = bio_add_page(bio, pages[i], bytes, 0);
+		/* bio_add_page() returns length added on success */
+		if (unlikely (rc != bytes)) {
+			bio_put(bio);
+			return -EIO;
+		}
+		done += bytes;
 	}
 
-	if (is_write)
-		bio->bi_opf = REQ_OP_WRITE | REQ_SYNC;
-	else
+	switch (op) {
+	case KIO_OP_READ:
 		bio->bi_opf = REQ_OP_READ;
+		break;
+	case KIO_OP_WRITE:
+		bio->bi_opf = REQ_OP_WRITE | REQ_SYNC;
+		break;
+	case KIO_OP_WRITE_FUA:
+		bio->bi_opf = REQ_OP_WRITE | REQ_SYNC | REQ_FUA;
+		break;
+	case KIO_OP_DISCARD:
+		bio->bi_opf = REQ_OP_DISCARD;
+		bio->bi_iter.bi_size = len;
+		break;
+	case KIO_OP_WRITE_ZEROES:
+		bio->bi_opf = REQ_OP_WRITE_ZEROES;
+		bio->bi_iter.bi_size = len;
+		break;
+	case KIO_OP_FLUSH:
+	default:
+		bio->bi_opf = REQ_OP_WRITE | REQ_PREFLUSH;
+		break;
+	}
+
+#ifdef KIO_REQ_POLLED
+	if (cookie)
+		bio->bi_opf |= KIO_REQ_POLLED;
+#endif
 
 	bio->bi_end_io = fn;
 	bio->bi_private = bi_private;
 
 	if (unlikely(!bio_has_disk(bio))) {
 		pr_warn("%s: bio->...disk in NULL, cannot queue %s bio\n",
-			__func__, is_write ? "write" : "read");
+			__func__, kio_op_name[op]);
 		bio_put(bio);
 		return -EIO;
 	}
 
-	if (unlikely (!bio->bi_vcnt || !bio->bi_io_vec[0].bv_page)) {
+	if (unlikely (has_data
+		      && (!bio->bi_vcnt || !bio->bi_io_vec[0].bv_page))) {
 		pr_warn("%s: bi_vcnt=%u, bi_io_vec[0].bv_page=%px, cannot queue %s bio\n",
 			__func__, bio->bi_vcnt, bio->bi_io_vec[0].bv_page,
-			is_write ? "write" : "read");
+			kio_op_name[op]);
 		bio_put(bio);
 		return -EIO;
 	}
 
+#ifdef HAVE_BIO_POLL
+	/* polled bio can complete before submit returns, keep it around */
+	if (cookie)
+		bio_get(bio);
+#endif
+
 	switch (kio_io_submit_mode) {
 	default:
 	case 0:
@@ -269,17 +603,18 @@ int kio_io_submit(off_t off, struct page *page, bool is_write,
 	case 2: {
 #ifdef GENDISK_HAS_SUBMIT_BIO
                 struct gendisk *disk = bio->bi_bdev->bd_disk;
-		blk_partition_remap(bio);
+		blk_partition_remap(tgt->bdev, bio);
                 qc = disk->fops->submit_bio(bio);
 #else
-		struct request_queue *q = kio_io.bdev->bd_disk->queue;
-		blk_partition_remap(bio);
+		struct request_queue *q = tgt->bdev->bd_disk->queue;
+		blk_partition_remap(tgt->bdev, bio);
 		qc = q->make_request_fn(q, bio);
 #endif
 		break;
 		}
 	}
-	(void)qc; // not sure what to do with this now
+	if (cookie)
+		kio_io_cookie_update(cookie, tgt, bio, qc);
 
 	return 0;
 }
@@ -2,7 +2,9 @@
 #include <linux/kernel.h>
 #include <linux/types.h>
 #include <linux/blk_types.h>
+#include <linux/mutex.h>
 #include "kio_compat.h"
+#include "kio_op.h"
 
 extern int kio_io_init(void);
 extern void kio_io_exit(void);
@@ -10,11 +12,23 @@ extern void kio_io_exit(void);
 // preallocate this many BIOs
 #define KIO_USE_BIO_SET_MIN_COUNT 1024
 
-struct kio_io {
+// block devices that can be open at the same time
+#define KIO_MAX_TARGETS 64
+
+struct kio_io_target {
+	int index;
 	char *dev_name;
 	struct block_device *bdev;
 	size_t dev_byte_size;
 	unsigned dev_block_size;
+	unsigned dev_max_io_size;       // largest IO we can put in one bio
+	unsigned dev_max_discard;       // largest discard, 0 if not supported
+	unsigned dev_max_write_zeroes;  // same for write zeroes
+};
+
+struct kio_io {
+	struct mutex mutex;             // protects targets
+	struct kio_io_target *targets[KIO_MAX_TARGETS];
 #if KIO_USE_BIO_SET_MIN_COUNT
 #ifdef USE_BIOSET_INIT
 	struct bio_set bio_set;
@@ -27,72 +41,180 @@ struct kio_io {
 };
 extern struct kio_io kio_io;
 
-static inline u64 kio_io_dev_byte_size(void)
+/* targets are added and removed through sysfs, but not while running */
+extern int kio_io_add_target(const char *path);
+extern int kio_io_remove_target(int index);
+extern ssize_t kio_io_targets_show(char *buf);
+
+static inline struct kio_io_target *kio_io_target_get(int index)
+{
+	if (index < 0 || index >= KIO_MAX_TARGETS)
+		return NULL;
+	return kio_io.targets[index];
+}
+
+static inline u64 kio_io_dev_byte_size(const struct kio_io_target *tgt)
 {
-	return kio_io.dev_byte_size;
+	return tgt->dev_byte_size;
 }
 
-static inline unsigned kio_io_dev_block_size(void)
+static inline unsigned kio_io_dev_block_size(const struct kio_io_target *tgt)
+{
+	return tgt->dev_block_size;
+}
+
+static inline unsigned kio_io_dev_max_io_size(const struct kio_io_target *tgt)
+{
+	return tgt->dev_max_io_size;
+}
+
+/* largest len of one op, 0 if the device does not support it */
+static inline unsigned kio_io_dev_max_op_size(const struct kio_io_target *tgt,
+					      enum kio_op op)
+{
+	switch (op) {
+	case KIO_OP_DISCARD:      return tgt->dev_max_discard;
+	case KIO_OP_WRITE_ZEROES: return tgt->dev_max_write_zeroes;
+	default:                  return tgt->dev_max_io_size;
+	}
+}
+
+/* NUMA node closest to the device, or NUMA_NO_NODE if unknown */
+extern int kio_io_dev_numa_node(const struct kio_io_target *tgt);
+
+/* blk-mq hardware queues (hctx) of the device, 0 if it does not use blk-mq */
+extern unsigned kio_io_dev_nr_hctx(const struct kio_io_target *tgt);
+
+/* the hardware queue an IO submitted from cpu goes to, or -1 */
+extern int kio_io_dev_hctx(const struct kio_io_target *tgt, int cpu,
+			   enum kio_op op, bool polled);
+
+/* an online cpu for the nth thread that places its IOs on the device's
+ * queues: spread over all of them, or all on the first one; -1 if the
+ * device does not use blk-mq */
+extern int kio_io_dev_queue_cpu(const struct kio_io_target *tgt,
+				enum kio_op op, bool polled, unsigned nth,
+				bool spread);
+
+static inline bool kio_io_offset_is_valid(const struct kio_io_target *tgt,
+					  off_t off, size_t size)
 {
-	return kio_io.dev_block_size;
+	return (off+size) <= tgt->dev_byte_size
+		&& !(off % tgt->dev_block_size);
 }
 
-static inline bool kio_io_offset_is_valid(off_t off, size_t size)
+static inline const char * kio_io_dev_name(const struct kio_io_target *tgt)
 {
-	return (off+size) <= kio_io.dev_byte_size
-		&& !(off % kio_io.dev_block_size);
+	return tgt->dev_name;
 }
 
-static inline const char * kio_io_dev_name(void)
+/* what we need to poll for completion of the last polled bio */
+struct kio_io_cookie {
+#if defined(HAVE_BIO_POLL)
+	struct bio *bio;                // holds a reference
+#elif defined(HAVE_BLK_POLL)
+	struct request_queue *q;
+	blk_qc_t qc;
+#endif
+};
+
+static inline bool kio_io_poll_supported(void)
 {
-	return kio_io.dev_name;
+#ifdef KIO_REQ_POLLED
+	return true;
+#else
+	return false;
+#endif
 }
 
-extern int kio_io_submit(off_t off, struct page *page, bool is_write,
-			     bio_end_io_t fn, void *bi_private);
+/* submit len bytes, from as many pages as it takes, as one bio
+ *
+ * Ops without data ignore pages; discard and write zeroes cover len bytes
+ * at off, a flush covers the whole device.  When cookie is provided reads
+ * and writes are submitted for polled completion, and the cookie is
+ * updated so kio_io_poll() can reap them; the other ops always complete
+ * from an interrupt. */
+extern int kio_io_submit(const struct kio_io_target *tgt,
+			 off_t off, struct page **pages, unsigned len,
+			 enum kio_op op, s64 issue_time,
+			 struct kio_io_cookie *cookie,
+			 bio_end_io_t fn, void *bi_private);
 
-static inline int kio_io_submit_write(struct page *page, off_t off,
+static inline int kio_io_submit_write(const struct kio_io_target *tgt,
+			     struct page **pages, unsigned len,
+			     off_t off, s64 issue_time,
 			     bio_end_io_t fn, void *bi_private)
 {
-	return kio_io_submit(off, page, true, fn, bi_private);
+	return kio_io_submit(tgt, off, pages, len, KIO_OP_WRITE, issue_time,
+			     NULL, fn, bi_private);
 }
 
-static inline int kio_io_submit_read(off_t off, struct page *page,
+static inline int kio_io_submit_read(const struct kio_io_target *tgt,
+			   off_t off, struct page **pages,
+			   unsigned len, s64 issue_time,
 			   bio_end_io_t fn, void *bi_private)
 {
-	return kio_io_submit(off, page, false, fn, bi_private);
+	return kio_io_submit(tgt, off, pages, len, KIO_OP_READ, issue_time,
+			     NULL, fn, bi_private);
 }
 
-static inline s64* kio_io_bio_start_time_ptr(struct bio *bio)
+/* reap completions on the hardware queue of the cookie's bio */
+extern int kio_io_poll(struct kio_io_cookie *cookie);
+extern void kio_io_cookie_release(struct kio_io_cookie *cookie);
+
+/* per-bio timestamps, stored in front of the bio by the bio_set */
+struct kio_io_bio_pad {
+	s64 issue_time;         // when the caller started working on this IO
+	s64 start_time;         // when the bio was allocated and submitted
+};
+
+static inline struct kio_io_bio_pad* kio_io_bio_pad(struct bio *bio)
 {
 #if KIO_USE_BIO_SET_MIN_COUNT
-	return ((s64*)bio) - 1;
+	return ((struct kio_io_bio_pad*)bio) - 1;
 #else
-	struct bio_vec *vec = bio->bi_io_vec + 1;
-	s64 *time = ((s64*)&vec->bv_page) + 1;
+	/* the second bvec is unused and holds the timestamps */
+	BUILD_BUG_ON(sizeof(struct bio_vec) < sizeof(struct kio_io_bio_pad));
 	if (unlikely (bio->bi_max_vecs < 2))
 		return NULL;
-	return time;
+	return (struct kio_io_bio_pad*)(bio->bi_io_vec + 1);
 #endif
 }
 
-static inline void kio_io_bio_set_start_time(struct bio *bio)
+static inline void kio_io_bio_set_start_time(struct bio *bio, s64 issue_time)
 {
-	s64 *time = kio_io_bio_start_time_ptr(bio);
-	if (time)
-		*time = ktime_to_ns(ktime_get());
+	struct kio_io_bio_pad *pad = kio_io_bio_pad(bio);
+	if (pad) {
+		pad->start_time = ktime_to_ns(ktime_get());
+		pad->issue_time = issue_time ?: pad->start_time;
+	}
 }
 
 static inline s64 kio_io_bio_get_start_time(struct bio *bio)
 {
-	s64 *time = kio_io_bio_start_time_ptr(bio);
-	return time ? *time : 0;
+	struct kio_io_bio_pad *pad = kio_io_bio_pad(bio);
+	return pad ? pad->start_time : 0;
+}
+
+static inline s64 kio_io_bio_get_issue_time(struct bio *bio)
+{
+	struct kio_io_bio_pad *pad = kio_io_bio_pad(bio);
+	return pad ? pad->issue_time : 0;
+}
+
+static inline s64 kio_bio_latency_since(s64 now, s64 start)
+{
+	return (start && now>start) ? (now-start) : 0;
+}
+
+/* completion latency, from submission to now */
+static inline s64 kio_bio_get_latency(struct bio *bio, s64 now)
+{
+	return kio_bio_latency_since(now, kio_io_bio_get_start_time(bio));
 }
 
-static inline s64 kio_bio_get_latency(struct bio *bio)
+/* total latency, from when the caller started the IO to now */
+static inline s64 kio_bio_get_total_latency(struct bio *bio, s64 now)
 {
-	u64 now = ktime_to_ns(ktime_get());
-	u64 start = kio_io_bio_get_start_time(bio);
-	s64 diff = (start && now>start) ? (now-start) : 0;
-	return diff;
+	return kio_bio_latency_since(now, kio_io_bio_get_issue_time(bio));
 }
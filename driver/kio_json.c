@@ -0,0 +1,324 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/vmalloc.h>
+
+#include "kio_version.h"
+#include "kio_json.h"
+
+/* results are keyed by these names, which messages use as well */
+const char *kio_op_name[KIO_OP_NR] = {
+	[KIO_OP_READ]         = "read",
+	[KIO_OP_WRITE]        = "write",
+	[KIO_OP_WRITE_FUA]    = "fua",
+	[KIO_OP_DISCARD]      = "discard",
+	[KIO_OP_WRITE_ZEROES] = "write_zeroes",
+	[KIO_OP_FLUSH]        = "flush",
+};
+
+const char *kio_lat_name[KIO_LAT_NR] = {
+	[KIO_LAT_SLAT] = "slat",
+	[KIO_LAT_CLAT] = "clat",
+	[KIO_LAT_LAT]  = "lat",
+	[KIO_LAT_BATCH] = "bslat",
+	[KIO_LAT_VERIFY] = "verify",
+	[KIO_LAT_OP + KIO_OP_READ]         = "read",
+	[KIO_LAT_OP + KIO_OP_WRITE]        = "write",
+	[KIO_LAT_OP + KIO_OP_WRITE_FUA]    = "fua",
+	[KIO_LAT_OP + KIO_OP_DISCARD]      = "discard",
+	[KIO_LAT_OP + KIO_OP_WRITE_ZEROES] = "write_zeroes",
+	[KIO_LAT_OP + KIO_OP_FLUSH]        = "flush",
+};
+
+/* JSON is rendered twice, first to get the length, then into the buffer */
+struct kio_json {
+	char *buf;                      // NULL while measuring
+	size_t size;
+	size_t len;
+};
+
+static __printf(2, 3) void kio_json_printf(struct kio_json *js,
+					   const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	if (js->buf)
+		js->len += vscnprintf(js->buf + js->len, js->size - js->len,
+				      fmt, args);
+	else
+		js->len += vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+}
+
+/* a quoted string value; device names come from users, so anything that
+ * would end the string or is not printable is escaped */
+static void kio_json_string(struct kio_json *js, const char *str)
+{
+	const char *run = str;
+
+	kio_json_printf(js, "\"");
+	for (; *str; str++) {
+		unsigned char ch = *str;
+
+		if (ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\')
+			continue;
+
+		kio_json_printf(js, "%.*s", (int)(str - run), run);
+		if (ch == '"' || ch == '\\')
+			kio_json_printf(js, "\\%c", ch);
+		else
+			kio_json_printf(js, "\\u%04x", ch);
+		run = str + 1;
+	}
+	kio_json_printf(js, "%s\"", run);
+}
+
+static void kio_json_pct(struct kio_json *js, const struct kio_hist_pct *p)
+{
+	int i;
+
+	kio_json_printf(js, "\"count\":%llu,\"avg_ns\":%llu",
+			p->count, p->avg);
+	for (i = 0; i < KIO_HIST_PCT_COUNT; i++)
+		kio_json_printf(js, ",\"%s_ns\":%llu",
+				kio_hist_pct_name[i], p->pct[i]);
+	kio_json_printf(js, ",\"max_ns\":%llu", p->max);
+}
+
+static void kio_json_latency(struct kio_json *js, const struct kio_hist *h)
+{
+	struct kio_hist_pct p;
+	const char *sep = "";
+	int i;
+
+	kio_hist_percentiles(h, &p);
+
+	kio_json_printf(js, "{\"sum_ns\":%lld,", (s64)atomic64_read(&h->sum));
+	kio_json_pct(js, &p);
+	kio_json_printf(js, ",\"buckets\":[");
+
+	/* only the buckets in use, as [low_ns, width_ns, count] */
+	for (i = 0; i < KIO_HIST_BUCKETS; i++) {
+		s64 cnt = atomic64_read(&h->buckets[i]);
+		if (!cnt)
+			continue;
+		kio_json_printf(js, "%s[%llu,%llu,%lld]", sep,
+				kio_hist_bucket_low(i),
+				kio_hist_bucket_width(i), cnt);
+		sep = ",";
+	}
+
+	kio_json_printf(js, "]}");
+}
+
+static void kio_json_counters(struct kio_json *js,
+			      const struct kio_run_counters *c)
+{
+	int i;
+
+	kio_json_printf(js, "\"dispatched\":%llu,\"completed\":%llu,"
+			"\"bytes\":%llu,\"runtime_ns\":%llu,"
+			"\"slat_total_ns\":%llu,\"clat_total_ns\":%llu,"
+			"\"batch_ios\":%llu,\"verified\":%llu,"
+			"\"unwritten\":%llu,\"verify_errors\":%llu,"
+			"\"cpu_migrations\":%llu",
+			c->dispatched, c->completed, c->bytes, c->runtime,
+			c->slat_total, c->clat_total, c->batch_ios,
+			c->verified, c->unwritten, c->verify_errors,
+			c->cpu_migrations);
+
+	kio_json_printf(js, ",\"coverage\":[");
+	for (i = 0; i < KIO_COVERAGE_BUCKETS; i++)
+		kio_json_printf(js, "%s%llu", i ? "," : "", c->coverage[i]);
+	kio_json_printf(js, "]");
+
+	kio_json_printf(js, ",\"ops\":{");
+	for (i = 0; i < KIO_OP_NR; i++)
+		kio_json_printf(js, "%s\"%s\":{\"completed\":%llu,"
+				"\"bytes\":%llu,\"slat_total_ns\":%llu,"
+				"\"clat_total_ns\":%llu}", i ? "," : "",
+				kio_op_name[i], c->ops[i].completed,
+				c->ops[i].bytes, c->ops[i].slat_total,
+				c->ops[i].clat_total);
+	kio_json_printf(js, "}");
+}
+
+/* only the hardware queues the thread used, on blk-mq devices */
+static void kio_json_hctx(struct kio_json *js,
+			  const struct kio_run_counters *c)
+{
+	const char *sep = "";
+	u32 h;
+
+	if (!c->hctx)
+		return;
+
+	kio_json_printf(js, ",\"nr_hctx\":%u,\"hctx\":[", c->nr_hctx);
+	for (h = 0; h < c->nr_hctx; h++) {
+		const struct kio_hctx_counters *q = &c->hctx[h];
+
+		if (!q->completed)
+			continue;
+		kio_json_printf(js, "%s{\"index\":%u,\"completed\":%llu,"
+				"\"bytes\":%llu,\"clat_total_ns\":%llu,"
+				"\"remote\":%llu}", sep, h, q->completed,
+				q->bytes, q->clat_total, q->remote);
+		sep = ",";
+	}
+	kio_json_printf(js, "]");
+}
+
+static void kio_json_entry(struct kio_json *js,
+			   const struct kio_run_results *res, int tid)
+{
+	const struct kio_run_counters *c = kio_run_results_counters(res, tid);
+	const struct kio_hist *hist = kio_run_results_hist(res, tid);
+	int t;
+
+	if (tid >= 0) {
+		kio_json_printf(js, "{\"index\":%d,\"target\":%d,"
+				"\"device\":", tid, c->target);
+		kio_json_string(js, c->dev_name ?: "");
+		kio_json_printf(js, ",\"poll\":%s,\"seed\":%llu,",
+				c->poll ? "true" : "false", c->seed);
+	} else {
+		kio_json_printf(js, "{");
+	}
+
+	kio_json_counters(js, c);
+	if (tid >= 0)
+		kio_json_hctx(js, c);
+	kio_json_printf(js, ",\"latency\":{");
+
+	for (t = 0; t < KIO_LAT_NR; t++) {
+		kio_json_printf(js, "%s\"%s\":", t ? "," : "", kio_lat_name[t]);
+		kio_json_latency(js, &hist[t]);
+	}
+
+	kio_json_printf(js, "}}");
+}
+
+/* only for runs that were checked for steady state */
+static void kio_json_steady(struct kio_json *js,
+			    const struct kio_steady_result *r)
+{
+	if (r->metric == KIO_STEADY_NONE)
+		return;
+
+	kio_json_printf(js, "\"steady_state\":{\"metric\":");
+	kio_json_string(js, kio_steady_metric_name[r->metric]);
+	kio_json_printf(js, ",\"reached\":%s,\"msec\":%u,\"samples\":%u,"
+			"\"avg\":%llu,\"min\":%llu,\"max\":%llu,"
+			"\"range_ppm\":%u,\"slope_ppm\":%u},",
+			r->reached ? "true" : "false", r->msec, r->samples,
+			r->avg, r->min, r->max, r->range_ppm, r->slope_ppm);
+}
+
+static void kio_json_results(struct kio_json *js, const void *arg)
+{
+	const struct kio_run_results *res = arg;
+	int i;
+
+	kio_json_printf(js, "{\"version\":%u,\"kio_version\":",
+			KIO_RESULTS_JSON_VERSION);
+	kio_json_string(js, KIO_GIT_REVISION);
+	kio_json_printf(js, ",");
+
+	if (res->engine) {
+		kio_json_printf(js, "\"engine\":");
+		kio_json_string(js, res->engine);
+		kio_json_printf(js, ",\"sqpoll\":%s,",
+				res->sqpoll ? "true" : "false");
+	}
+
+	kio_json_printf(js, "\"result\":%d,\"timestamp\":%lld,"
+			"\"runtime_seconds\":%u,\"ramp_seconds\":%u,"
+			"\"num_threads\":%u,\"hist_sub_bits\":%u,",
+			res->result, (s64)res->timestamp,
+			res->runtime_seconds, res->ramp_seconds, res->num_threads,
+			KIO_HIST_SUB_BITS);
+
+	kio_json_steady(js, &res->steady);
+
+	kio_json_printf(js, "\"summary\":");
+
+	kio_json_entry(js, res, -1);
+
+	kio_json_printf(js, ",\"threads\":[");
+	for (i = 0; i < res->num_threads; i++) {
+		if (i)
+			kio_json_printf(js, ",");
+		kio_json_entry(js, res, i);
+	}
+	kio_json_printf(js, "]}\n");
+}
+
+static void kio_json_sweep(struct kio_json *js, const void *arg)
+{
+	const struct kio_sweep_results *sr = arg;
+	const struct kio_sweep_step *st;
+	int i, t;
+
+	kio_json_printf(js, "{\"version\":%u,\"kio_version\":",
+			KIO_RESULTS_JSON_VERSION);
+	kio_json_string(js, KIO_GIT_REVISION);
+	kio_json_printf(js, ",\"param\":");
+	kio_json_string(js, sr->param);
+	kio_json_printf(js, ",\"warmup_seconds\":%u,"
+			"\"runtime_seconds\":%u,\"steps\":[",
+			sr->warmup_seconds, sr->runtime_seconds);
+
+	for (i = 0; i < sr->nr_steps; i++) {
+		st = &sr->steps[i];
+
+		kio_json_printf(js, "%s{\"step\":%d,\"value\":%llu,"
+				"\"result\":%d,", i ? "," : "", i,
+				st->value, st->result);
+		kio_json_steady(js, &st->steady);
+		kio_json_counters(js, &st->sum);
+		kio_json_printf(js, ",\"latency\":{");
+		for (t = 0; t < KIO_LAT_NR; t++) {
+			kio_json_printf(js, "%s\"%s\":{", t ? "," : "",
+					kio_lat_name[t]);
+			kio_json_pct(js, &st->pct[t]);
+			kio_json_printf(js, "}");
+		}
+		kio_json_printf(js, "}}");
+	}
+
+	kio_json_printf(js, "]}\n");
+}
+
+static char *kio_json_render(void (*fn)(struct kio_json *, const void *),
+			     const void *arg, size_t *len)
+{
+	struct kio_json js = {};
+
+	fn(&js, arg);
+
+	js.size = js.len + 1;
+	js.len = 0;
+	js.buf = vmalloc(js.size);
+	if (!js.buf) {
+		pr_warn("kio: no memory for %zu bytes of JSON results\n",
+			js.size);
+		return NULL;
+	}
+
+	fn(&js, arg);
+
+	*len = js.len;
+	return js.buf;
+}
+
+
+char *kio_json_run_results(const struct kio_run_results *res, size_t *len)
+{
+	return kio_json_render(kio_json_results, res, len);
+}
+
+char *kio_json_sweep_results(const struct kio_sweep_results *sr, size_t *len)
+{
+	return kio_json_render(kio_json_sweep, sr, len);
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "kio_results.h"
+
+/* results.json and sweep_results.json
+ *
+ * Rendered from the raw counters and histograms of kio_results.h, by the
+ * module when results are published, and by kio-uring at the end of its
+ * run, so both are read by kio.py the same way.  The document has a
+ * version, KIO_RESULTS_JSON_VERSION, which changes when the format does.
+ */
+
+/* render into a vmalloc'ed buffer, NULL if there is no memory */
+extern char *kio_json_run_results(const struct kio_run_results *res,
+				  size_t *len);
+extern char *kio_json_sweep_results(const struct kio_sweep_results *sr,
+				    size_t *len);
@@ -33,6 +33,8 @@
 #include "kio_version.h"
 #include "kio_config.h"
 #include "kio_io.h"
+#include "kio_run.h"
+#include "kio_stream.h"
 
 static int __init kio_init(void)
 {
@@ -48,9 +50,14 @@ static int __init kio_init(void)
 	if (rc)
 		goto err_io;
 
+	rc = kio_stream_init();
+	if (rc)
+		goto err_stream;
+
 	return 0;
 
-	//kio_io_exit();
+err_stream:
+	kio_io_exit();
 err_io:
 	kio_config_exit();
 err_config:
@@ -61,6 +68,10 @@ static void __exit kio_exit(void)
 {
 	pr_info("kio: exit\n");
 
+	/* run_workload stays writable until kio_config_exit() */
+	kio_config_close();
+	kio_run_exit();
+	kio_stream_exit();
 	kio_io_exit();
 	kio_config_exit();
 }
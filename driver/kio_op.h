@@ -0,0 +1,26 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+/* what an IO does; reads and writes carry data, the others do not */
+enum kio_op {
+	KIO_OP_READ,
+	KIO_OP_WRITE,
+	KIO_OP_WRITE_FUA,               // write with forced unit access
+	KIO_OP_DISCARD,
+	KIO_OP_WRITE_ZEROES,
+	KIO_OP_FLUSH,                   // empty write with a preflush
+	KIO_OP_NR
+};
+
+extern const char *kio_op_name[KIO_OP_NR];
+
+static inline bool kio_op_has_data(enum kio_op op)
+{
+	return op <= KIO_OP_WRITE_FUA;
+}
+
+static inline bool kio_op_is_write(enum kio_op op)
+{
+	return op == KIO_OP_WRITE || op == KIO_OP_WRITE_FUA;
+}
@@ -0,0 +1,64 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/highmem.h>
+
+#include "kio_pattern.h"
+
+/* xorshift64, the data only has to look random to a compressor */
+static void kio_pattern_random(u64 *p, unsigned words, u64 state)
+{
+	while (words--) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		*p++ = state;
+	}
+}
+
+void kio_pattern_fill_buf(struct kio_pool *pool, struct kio_buf *buf,
+			  u32 seed, unsigned zero_percent)
+{
+	unsigned block = min_t(unsigned, min_t(unsigned, KIO_PATTERN_BLOCK,
+						PAGE_SIZE), pool->buf_size);
+	unsigned random_bytes = block - block * zero_percent / 100;
+	unsigned pos;
+	void *data;
+
+	for (pos = 0; pos + block <= buf->size; pos += block) {
+		data = kmap_atomic(buf->pages[pos >> PAGE_SHIFT])
+			+ (pos & ~PAGE_MASK);
+
+		/* same data at the same position in every buffer */
+		kio_pattern_random(data, random_bytes / sizeof(u64),
+				   ((u64)seed << 32 | (pos / block)) | 1);
+		memset(data + round_down(random_bytes, sizeof(u64)), 0,
+		       block - round_down(random_bytes, sizeof(u64)));
+
+		kunmap_atomic(data);
+	}
+
+	buf->dirty = false;
+}
+
+void kio_pattern_fill(struct kio_pool *pool, u32 seed, unsigned zero_percent)
+{
+	unsigned i;
+
+	for (i = 0; i < pool->count; i++)
+		kio_pattern_fill_buf(pool, &pool->bufs[i], seed, zero_percent);
+}
+
+void kio_pattern_stamp(struct kio_buf *buf, u64 stamp)
+{
+	unsigned block = min_t(unsigned, KIO_PATTERN_BLOCK, PAGE_SIZE);
+	unsigned pos;
+	u64 *data;
+
+	for (pos = 0; pos < buf->len; pos += block) {
+		data = kmap_atomic(buf->pages[pos >> PAGE_SHIFT])
+			+ (pos & ~PAGE_MASK);
+		*data = stamp;
+		kunmap_atomic(data);
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "kio_pool.h"
+
+/* write data patterns
+ *
+ * Zeroed buffers are perfectly compressible and dedupable, which devices
+ * with inline compression or dedup turn into unrealistic write bandwidth.
+ * Instead, the buffers of a thread's pool can be filled once, when the
+ * pool is created, with random data; zero_percent of every pattern block
+ * is left as zeroes to give a fixed compression ratio.
+ *
+ * Pattern blocks at the same position in every buffer hold the same data,
+ * so each write is made unique with a cheap stamp at the start of every
+ * pattern block, and made a duplicate by stamping it with 0.
+ *
+ * Reads land in the same buffers, so a buffer that was read into is
+ * filled again before it is written from.
+ */
+
+#define KIO_PATTERN_BLOCK       4096    // granularity of dedup and stamps
+
+extern void kio_pattern_fill(struct kio_pool *pool, u32 seed,
+			     unsigned zero_percent);
+/* the same, for one buffer of the pool */
+extern void kio_pattern_fill_buf(struct kio_pool *pool, struct kio_buf *buf,
+				 u32 seed, unsigned zero_percent);
+extern void kio_pattern_stamp(struct kio_buf *buf, u64 stamp);
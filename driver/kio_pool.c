@@ -0,0 +1,108 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+
+#include "kio_pool.h"
+
+static bool kio_pool_zero = true;
+module_param_named(zero_buffers, kio_pool_zero, bool, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(zero_buffers, "zero IO buffers when allocated (0 writes stale memory to the device)");
+
+static int kio_buf_alloc(struct kio_buf *buf, unsigned size, int nid,
+			 gfp_t gfp)
+{
+	int i;
+
+	buf->size = size;
+	buf->nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+
+	if (buf->nr_pages == 1) {
+		buf->pages = &buf->page;
+	} else {
+		buf->pages = kcalloc_node(buf->nr_pages, sizeof(*buf->pages),
+					  GFP_KERNEL, nid);
+		if (!buf->pages)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < buf->nr_pages; i++) {
+		buf->pages[i] = alloc_pages_node(nid, gfp, 0);
+		if (!buf->pages[i])
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void kio_buf_free(struct kio_buf *buf)
+{
+	int i;
+
+	if (!buf->pages)
+		return;
+
+	for (i = 0; i < buf->nr_pages; i++) {
+		if (buf->pages[i])
+			__free_page(buf->pages[i]);
+	}
+
+	if (buf->pages != &buf->page)
+		kfree(buf->pages);
+	buf->pages = NULL;
+}
+
+struct kio_pool *kio_pool_create(unsigned count, unsigned buf_size,
+				 int nid, void *owner)
+{
+	struct kio_pool *pool;
+	gfp_t gfp = GFP_KERNEL;
+	int i;
+
+	if (kio_pool_zero)
+		gfp |= __GFP_ZERO;
+	if (nid != NUMA_NO_NODE)
+		gfp |= __GFP_THISNODE;
+
+	pool = kzalloc_node(sizeof(*pool) + count * sizeof(pool->bufs[0]),
+			    GFP_KERNEL, nid);
+	if (!pool)
+		return NULL;
+
+	init_llist_head(&pool->free);
+	pool->count = count;
+	pool->buf_size = buf_size;
+	pool->nid = nid;
+
+	for (i = 0; i < count; i++) {
+		struct kio_buf *buf = &pool->bufs[i];
+
+		buf->owner = owner;
+		if (kio_buf_alloc(buf, buf_size, nid, gfp)) {
+			pr_warn("kio: failed to allocate %u byte buffer %d of %u "
+				"on node %d\n", buf_size, i, count, nid);
+			kio_pool_destroy(pool);
+			return NULL;
+		}
+
+		llist_add(&buf->node, &pool->free);
+	}
+
+	return pool;
+}
+
+void kio_pool_destroy(struct kio_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->count; i++)
+		kio_buf_free(&pool->bufs[i]);
+
+	kfree(pool);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/llist.h>
+#include <linux/mm_types.h>
+
+/* preallocated IO buffers
+ *
+ * Each thread gets a pool of queue_depth buffers, allocated up front on
+ * its NUMA node.  A buffer is made of enough order-0 pages to hold one
+ * block_size IO, and is submitted as a multi-bvec bio.
+ *
+ * The thread takes buffers out of the pool to submit IO, and the bio
+ * completion puts them back.  There is only one consumer (the thread),
+ * so the free list is a lock-free llist.
+ */
+
+struct kio_buf {
+	struct llist_node node;
+	void *owner;                    // passed to kio_pool_create()
+	unsigned size;                  // bytes available in pages
+	unsigned len;                   // bytes used by the IO in flight
+	u64 offset;                     // device offset of the IO in flight
+	u8 op;                          // enum kio_op of the IO in flight
+	bool ramp;                      // issued during the ramp, not counted
+	bool dirty;                     // read into since the pattern fill
+	int cpu;                        // submitted from
+	int hctx;                       // hardware queue, or -1
+	unsigned nr_pages;
+	struct page **pages;            // points at page if nr_pages==1
+	struct page *page;
+};
+
+struct kio_pool {
+	struct llist_head free;
+	unsigned count;
+	unsigned buf_size;
+	int nid;
+	struct kio_buf bufs[];
+};
+
+extern struct kio_pool *kio_pool_create(unsigned count, unsigned buf_size,
+				       int nid, void *owner);
+extern void kio_pool_destroy(struct kio_pool *pool);
+
+/* only called by the owning thread */
+static inline struct kio_buf *kio_pool_get(struct kio_pool *pool)
+{
+	struct llist_node *node = llist_del_first(&pool->free);
+	return node ? llist_entry(node, struct kio_buf, node) : NULL;
+}
+
+/* can be called from any context, including bio completion */
+static inline void kio_pool_put(struct kio_pool *pool, struct kio_buf *buf)
+{
+	llist_add(&buf->node, &pool->free);
+}
+
+static inline bool kio_pool_empty(struct kio_pool *pool)
+{
+	return llist_empty(&pool->free);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/math64.h>
+
+/* per-thread pseudo-random numbers
+ *
+ * xoshiro256** (Blackman and Vigna): a handful of shifts, rotates and
+ * multiplies per number, no locks and no shared state, so each thread owns
+ * its generator.  With the same seed a thread makes the same choices, and
+ * so the same stream of offsets and directions, run after run.
+ *
+ * Ranges are reduced with a multiply-shift (Lemire) instead of a modulo,
+ * which avoids a division and is unbiased enough for picking offsets.
+ */
+
+struct kio_rand {
+	u64 s[4];
+};
+
+static inline u64 kio_rand_rotl(u64 x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/* splitmix64, to spread a small seed over the whole state */
+static inline u64 kio_rand_splitmix(u64 *x)
+{
+	u64 z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline void kio_rand_seed(struct kio_rand *r, u64 seed)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(r->s); i++)
+		r->s[i] = kio_rand_splitmix(&seed);
+}
+
+static inline u64 kio_rand_u64(struct kio_rand *r)
+{
+	u64 *s = r->s;
+	u64 result = kio_rand_rotl(s[1] * 5, 7) * 9;
+	u64 t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = kio_rand_rotl(s[3], 45);
+
+	return result;
+}
+
+/* the upper bits are the better ones */
+static inline u32 kio_rand_u32(struct kio_rand *r)
+{
+	return kio_rand_u64(r) >> 32;
+}
+
+/* uniform in [0, n) */
+static inline u64 kio_rand_below(struct kio_rand *r, u64 n)
+{
+	if (n <= U32_MAX)
+		return ((u64)kio_rand_u32(r) * n) >> 32;
+	return mul_u64_u64_shr(kio_rand_u64(r), n, 64);
+}
@@ -0,0 +1,201 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/fs.h>
+
+#include "kio_results.h"
+#include "kio_json.h"
+
+static DEFINE_MUTEX(kio_results_mutex);
+static struct kio_run_results *kio_results;
+static struct kio_sweep_results *kio_sweep_results;
+
+struct kio_run_results *kio_run_results_alloc(u32 num_threads)
+{
+	struct kio_run_results *res;
+
+	res = kzalloc(sizeof(*res), GFP_KERNEL);
+	if (!res)
+		return NULL;
+
+	res->num_threads = num_threads;
+	res->counters = kcalloc(num_threads + 1, sizeof(*res->counters),
+				GFP_KERNEL);
+	res->hist = kio_hist_alloc((num_threads + 1) * KIO_LAT_NR);
+	if (!res->counters || !res->hist) {
+		kio_run_results_free(res);
+		return NULL;
+	}
+
+	kio_run_results_counters(res, -1)->target = -1;
+
+	return res;
+}
+
+void kio_run_results_free(struct kio_run_results *res)
+{
+	int i;
+
+	if (!res)
+		return;
+
+	if (res->counters) {
+		for (i = 0; i <= res->num_threads; i++) {
+			kfree(res->counters[i].dev_name);
+			kfree(res->counters[i].hctx);
+		}
+		kfree(res->counters);
+	}
+
+	kio_hist_free(res->hist);
+	vfree(res->json);
+	kfree(res);
+}
+
+// ------------------------------------------------------------------------
+
+void kio_run_results_publish(struct kio_run_results *res)
+{
+	struct kio_run_results *old;
+
+	if (res)
+		res->json = kio_json_run_results(res, &res->json_len);
+
+	mutex_lock(&kio_results_mutex);
+	old = kio_results;
+	kio_results = res;
+	mutex_unlock(&kio_results_mutex);
+
+	kio_run_results_free(old);
+}
+
+ssize_t kio_run_results_show(char *buf, int tid)
+{
+	struct kio_hist_pct p;
+	struct kio_hist *hist;
+	ssize_t len = 0;
+	int t;
+
+	mutex_lock(&kio_results_mutex);
+
+	if (!kio_results)
+		goto unlock_and_return_len;
+
+	if (tid >= (int)kio_results->num_threads) {
+		len = -ENOENT;
+		goto unlock_and_return_len;
+	}
+
+	hist = kio_run_results_hist(kio_results, tid);
+
+	for (t = 0; t < KIO_LAT_NR; t++) {
+		kio_hist_percentiles(&hist[t], &p);
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%s count=%llu avg=%llu p50=%llu p90=%llu "
+				 "p99=%llu p99.9=%llu p99.99=%llu max=%llu\n",
+				 kio_lat_name[t], p.count, p.avg,
+				 p.pct[0], p.pct[1], p.pct[2], p.pct[3],
+				 p.pct[4], p.max);
+	}
+
+unlock_and_return_len:
+	mutex_unlock(&kio_results_mutex);
+	return len;
+}
+
+ssize_t kio_run_results_json_read(char *buf, loff_t off, size_t count)
+{
+	ssize_t len = 0;
+
+	mutex_lock(&kio_results_mutex);
+	if (kio_results && kio_results->json)
+		len = memory_read_from_buffer(buf, count, &off,
+					      kio_results->json,
+					      kio_results->json_len);
+	mutex_unlock(&kio_results_mutex);
+
+	return len;
+}
+
+// ------------------------------------------------------------------------
+
+struct kio_sweep_results *kio_sweep_results_alloc(u32 nr_steps)
+{
+	struct kio_sweep_results *sr;
+
+	sr = kzalloc(sizeof(*sr), GFP_KERNEL);
+	if (!sr)
+		return NULL;
+
+	sr->steps = kcalloc(nr_steps, sizeof(*sr->steps), GFP_KERNEL);
+	if (!sr->steps) {
+		kfree(sr);
+		return NULL;
+	}
+
+	return sr;
+}
+
+void kio_sweep_results_free(struct kio_sweep_results *sr)
+{
+	if (!sr)
+		return;
+	kfree(sr->steps);
+	vfree(sr->json);
+	kfree(sr);
+}
+
+void kio_sweep_results_add(struct kio_sweep_results *sr, u64 value,
+			   int result, const struct kio_run_results *res)
+{
+	struct kio_sweep_step *st = &sr->steps[sr->nr_steps++];
+	const struct kio_hist *hist;
+	int t;
+
+	st->value = value;
+	st->result = result;
+	if (!res)
+		return;
+
+	st->steady = res->steady;
+	st->sum = *kio_run_results_counters(res, -1);
+	st->sum.dev_name = NULL;
+	st->sum.hctx = NULL;
+
+	hist = kio_run_results_hist(res, -1);
+	for (t = 0; t < KIO_LAT_NR; t++)
+		kio_hist_percentiles(&hist[t], &st->pct[t]);
+}
+
+void kio_sweep_results_publish(struct kio_sweep_results *sr)
+{
+	struct kio_sweep_results *old;
+
+	if (sr)
+		sr->json = kio_json_sweep_results(sr, &sr->json_len);
+
+	mutex_lock(&kio_results_mutex);
+	old = kio_sweep_results;
+	kio_sweep_results = sr;
+	mutex_unlock(&kio_results_mutex);
+
+	kio_sweep_results_free(old);
+}
+
+ssize_t kio_sweep_results_json_read(char *buf, loff_t off, size_t count)
+{
+	ssize_t len = 0;
+
+	mutex_lock(&kio_results_mutex);
+	if (kio_sweep_results && kio_sweep_results->json)
+		len = memory_read_from_buffer(buf, count, &off,
+					      kio_sweep_results->json,
+					      kio_sweep_results->json_len);
+	mutex_unlock(&kio_results_mutex);
+
+	return len;
+}
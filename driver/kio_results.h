@@ -0,0 +1,158 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/time64.h>
+#include <linux/math64.h>
+
+#include "kio_hist.h"
+#include "kio_op.h"
+#include "kio_steady.h"
+
+/* results of a run
+ *
+ * kio_run() collects raw counters and latency histograms for each thread
+ * and for all of them, and publishes them when the run is done.  The last
+ * published results are shown as percentiles in the sysfs results files,
+ * and in full in results.json, which is rendered once on publish, see
+ * kio_json.h.
+ */
+
+#define KIO_RESULTS_JSON_VERSION 1
+
+enum kio_lat_type {
+	KIO_LAT_SLAT,                   // submission latency
+	KIO_LAT_CLAT,                   // completion latency
+	KIO_LAT_LAT,                    // total latency, from issue to completion
+	KIO_LAT_BATCH,                  // submission latency of a plugged batch
+	KIO_LAT_VERIFY,                 // time to fill or check an IO's data
+	KIO_LAT_OP,                     // lat of each enum kio_op, from here
+	KIO_LAT_NR = KIO_LAT_OP + KIO_OP_NR
+};
+
+extern const char *kio_lat_name[KIO_LAT_NR];
+
+/* bigger counts than this are divided by msec, not nsec */
+#define KIO_RATE_NSEC_MAX_COUNT (U64_MAX / NSEC_PER_SEC)
+
+/* count per second, without overflowing on long runs with large IOs */
+static inline u64 kio_run_rate(u64 count, u64 runtime)
+{
+	if (!runtime)
+		return 0;
+	if (count <= KIO_RATE_NSEC_MAX_COUNT)
+		return div64_u64(count * NSEC_PER_SEC, runtime);
+	return div64_u64(count, div64_u64(runtime, NSEC_PER_MSEC) ?: 1)
+		* MSEC_PER_SEC;
+}
+
+/* IOs that landed in each 1% of a thread's offset range */
+#define KIO_COVERAGE_BUCKETS 100
+
+/* the part of kio_run_counters done by one op */
+struct kio_op_counters {
+	u64 completed;
+	u64 bytes;
+	u64 slat_total;
+	u64 clat_total;
+};
+
+/* IOs of a thread that went through one blk-mq hardware queue */
+struct kio_hctx_counters {
+	u64 completed;
+	u64 bytes;
+	u64 clat_total;
+	u64 remote;                     // completed on another cpu
+};
+
+/* what a thread did, or the sum of all threads; in nsec and bytes */
+struct kio_run_counters {
+	int target;                     // index, or -1 for the summary
+	char *dev_name;                 // of the target
+	bool poll;
+	u64 seed;                       // of the thread's random numbers
+	u64 dispatched;                 // still in flight when stopped
+	u64 completed;
+	u64 bytes;
+	u64 runtime;                    // longest thread, for the summary
+	u64 slat_total;
+	u64 clat_total;
+	u64 batch_ios;                  // IOs submitted in plugged batches
+	u64 verified;                   // chunks read back and checked
+	u64 unwritten;                  // chunks read back with no header
+	u64 verify_errors;              // chunks that did not match
+	u64 cpu_migrations;             // submissions from a new cpu
+	u64 coverage[KIO_COVERAGE_BUCKETS];
+	struct kio_op_counters ops[KIO_OP_NR];
+	u32 nr_hctx;                    // of the device, 0 if not blk-mq
+	struct kio_hctx_counters *hctx; // nr_hctx, only for threads
+};
+
+struct kio_run_results {
+	u32 num_threads;
+	int result;
+	u32 runtime_seconds;
+	u32 ramp_seconds;               // before runtime_seconds, not counted
+	struct kio_steady_result steady; // if the run was checked for it
+	time64_t timestamp;             // wall clock when the run started
+	const char *engine;             // what ran it, NULL for the module
+	bool sqpoll;                    // of the io_uring engine
+	struct kio_run_counters *counters; // per thread, then summary
+	struct kio_hist *hist;          // KIO_LAT_NR per thread, then summary
+
+	char *json;                     // rendered on publish
+	size_t json_len;
+};
+
+static inline struct kio_hist *kio_run_results_hist(
+		const struct kio_run_results *res, int tid)
+{
+	if (tid < 0)
+		tid = res->num_threads;
+	return res->hist + (tid * KIO_LAT_NR);
+}
+
+static inline struct kio_run_counters *kio_run_results_counters(
+		const struct kio_run_results *res, int tid)
+{
+	if (tid < 0)
+		tid = res->num_threads;
+	return res->counters + tid;
+}
+
+extern struct kio_run_results *kio_run_results_alloc(u32 num_threads);
+extern void kio_run_results_free(struct kio_run_results *res);
+/* replace the results of the last run, NULL to drop them */
+extern void kio_run_results_publish(struct kio_run_results *res);
+
+/* show results of the last run, for a thread or the summary if tid<0 */
+extern ssize_t kio_run_results_show(char *buf, int tid);
+extern ssize_t kio_run_results_json_read(char *buf, loff_t off, size_t count);
+
+/* results of a sweep, one summary per step */
+struct kio_sweep_step {
+	u64 value;                      // of the swept parameter
+	int result;
+	struct kio_steady_result steady;
+	struct kio_run_counters sum;
+	struct kio_hist_pct pct[KIO_LAT_NR];
+};
+
+struct kio_sweep_results {
+	const char *param;
+	u32 warmup_seconds;
+	u32 runtime_seconds;
+	u32 nr_steps;                   // completed so far
+	struct kio_sweep_step *steps;
+
+	char *json;                     // rendered on publish
+	size_t json_len;
+};
+
+extern struct kio_sweep_results *kio_sweep_results_alloc(u32 nr_steps);
+extern void kio_sweep_results_free(struct kio_sweep_results *sr);
+/* record the summary of a step from the results of its run */
+extern void kio_sweep_results_add(struct kio_sweep_results *sr, u64 value,
+				  int result, const struct kio_run_results *res);
+extern void kio_sweep_results_publish(struct kio_sweep_results *sr);
+extern ssize_t kio_sweep_results_json_read(char *buf, loff_t off,
+					   size_t count);
@@ -8,65 +8,238 @@
 #include <linux/blk_types.h>
 #include <linux/bio.h>
 #include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/blkdev.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/bitmap.h>
+#include <linux/random.h>
 
 #include "kio_run.h"
 #include "kio_config.h"
 #include "kio_compat.h"
 #include "kio_io.h"
+#include "kio_hist.h"
+#include "kio_pool.h"
+#include "kio_stream.h"
+#include "kio_results.h"
+#include "kio_verify.h"
+#include "kio_pattern.h"
+#include "kio_dist.h"
+#include "kio_rand.h"
+#include "kio_gen.h"
+#include "kio_trace.h"
+#include "kio_steady.h"
+
+/* runs execute on a work item, so run_workload does not block
+ *
+ * idle -> running -> stopping -> done -> running -> ...
+ *
+ * The config cannot change while running or stopping.  A run goes to
+ * stopping when runtime_seconds expire, when stop is written, or when a
+ * thread fails; and to done once the results are published.
+ *
+ * A sweep runs one step after another on the same work item, going back
+ * to running between steps, and is done after the last step.
+ */
+static atomic_t kio_state = ATOMIC_INIT(KIO_STATE_IDLE);
+static const char *kio_state_name[] = {
+	[KIO_STATE_IDLE]     = "idle",
+	[KIO_STATE_RUNNING]  = "running",
+	[KIO_STATE_STOPPING] = "stopping",
+	[KIO_STATE_DONE]     = "done",
+};
+
+static const struct kio_config *kio_run_config;
+static int kio_run_result;
+static s64 kio_run_start_time;
+static s64 kio_run_end_time;
+static bool kio_run_stop_requested;
+static u32 kio_run_sweep_step;
+static u32 kio_run_sweep_steps;
+static DECLARE_WAIT_QUEUE_HEAD(kio_run_wqh);
+
+static void kio_run_work_fn(struct work_struct *work);
+static DECLARE_WORK(kio_run_work, kio_run_work_fn);
 
-static atomic_t kio_running = {0};
 bool kio_is_running(void)
 {
-	return atomic_read(&kio_running);
+	int state = atomic_read(&kio_state);
+	return state == KIO_STATE_RUNNING || state == KIO_STATE_STOPPING;
 }
 
+/* shared by the threads of a run, to start and stop them together
+ *
+ * Threads are all created before any of them runs, get ready (buffers,
+ * offset tables, data), and then wait for the last one.  It sets the start
+ * of the run for all of them, and the end of the ramp from there.  At the
+ * end, kio_run() tells them all to stop before it reaps them one by one.
+ */
+struct kio_run_sync {
+	atomic_t waiting;               // threads not ready yet
+	wait_queue_head_t wqh;          // where ready threads wait
+	s64 ramp_nsec;
+	s64 start;                      // set by the last thread, 0 until then
+	s64 ramp_end;                   // start + ramp_nsec
+	bool stop;
+};
+
+/* IOs of a thread that went through one hardware queue of its device */
+struct kio_thread_hctx {
+	atomic64_t completed;
+	atomic64_t bytes;
+	atomic64_t clat_total;
+	atomic64_t remote;              // completed on another cpu
+};
+
 struct kio_thread {
 	unsigned index;
 	struct task_struct *thread;
+	int cpu;                        // bound to cpu, or KIO_CPU_ANY
+	int nid;                        // home node, or NUMA_NO_NODE
 	const struct kio_thread_config *config;
+	const struct kio_io_target *tgt;
 
 	wait_queue_head_t *run_wqh;
 	bool *emergency_stop;
 
 	wait_queue_head_t *bio_wqh;
 
+	struct kio_pool *pool;          // queue_depth preallocated buffers
+	struct kio_io_cookie cookie;    // last polled bio, if config->poll
+
 	atomic_t dispatched;
 	atomic_t completed;
+	atomic64_t bytes;               // transferred by completed IOs
 
-	u64 runtime;
+	struct kio_run_sync *sync;
+
+	u64 runtime;                    // of the measured part of the run
+	s64 window_start;               // when the measured part starts
+	bool ramping;                   // IOs are not counted yet
 	u64 slat_total;
 	atomic64_t clat_total;
-
-	uint32_t read_burst;
-	uint32_t write_burst;
-	off_t next_offset;
-
-	u8 was_write;
+	u64 batch_ios;                  // IOs submitted in plugged batches
+	s64 batch_slat;                 // slat of the current batch's IOs
+
+	struct kio_thread_hctx *hctx;   // nr_hctx, indexed by hardware queue
+	unsigned nr_hctx;               // of the device, 0 if not blk-mq
+	int last_cpu;                   // last submitted from, or -1
+	u64 cpu_migrations;             // submissions from a new cpu
+
+	/* the same, split by enum kio_op */
+	atomic64_t op_completed[KIO_OP_NR];
+	atomic64_t op_bytes[KIO_OP_NR];
+	atomic64_t op_clat_total[KIO_OP_NR];
+	u64 op_slat_total[KIO_OP_NR];
+
+	u64 seed;                       // of gen.rand, from config or random
+	struct kio_gen gen;             // picks the IOs, see kio_gen.h
+	u32 data_seed;                  // of write data
+	u64 verify_generation;          // writes filled so far
+	u64 pattern_stamps;             // unique writes stamped so far
+	atomic64_t verified;            // chunks checked by read completions
+	atomic64_t unwritten;
+	atomic64_t verify_errors;
+
+	struct kio_hist *hist;          // KIO_LAT_NR histograms
+
+	struct kio_hist *iv_hist;       // hist at the end of the last interval
+	u32 iv_completed;               // completed ...
+	u64 iv_bytes;                   // ... and bytes at the same point
+
+	u64 rate_interval;              // nsec between IOs, << KIO_RATE_SHIFT
+	u64 rate_frac;                  // fraction of a nsec carried over
+	s64 next_issue;                 // when the next IO is scheduled
+
+	u64 coverage[KIO_COVERAGE_BUCKETS];
+
+	const struct kio_trace *trace;  // replayed, if config->replay is set
+	u64 replay_next;                // index of the next record to issue
+	u32 replay_stride;              // number of threads sharing the trace
+	s64 replay_start;               // trace time 0, for timed replay
+	bool replay_done;               // out of records
+	atomic_t *replay_left;          // threads still replaying
+	bool *replay_finished;          // set by the last of them
 };
 
-static inline struct page *kio_new_page(void)
+/* check what a read brought back; runs after clat is taken, so the cost
+ * is only accounted in the verify histogram */
+static void kio_bio_verify(struct kio_thread *th, struct kio_buf *buf,
+			   s64 start)
 {
-	int nid = NUMA_NO_NODE;
-	return alloc_pages_node(nid, GFP_KERNEL|__GFP_ZERO|__GFP_THISNODE, 0);
+	struct kio_verify_result vr = {};
+
+	kio_verify_check(buf, buf->offset, kio_io_dev_block_size(th->tgt),
+			 &vr);
+
+	atomic64_add(vr.checked, &th->verified);
+	if (vr.unwritten)
+		atomic64_add(vr.unwritten, &th->unwritten);
+	if (unlikely(vr.errors))
+		atomic64_add(vr.errors, &th->verify_errors);
+
+	kio_hist_add(&th->hist[KIO_LAT_VERIFY],
+		     ktime_to_ns(ktime_get()) - start);
 }
 
 void kio_bio_completion (struct bio *bio)
 {
-	struct kio_thread *th = bio->bi_private;
-	struct page *page = bio->bi_io_vec[0].bv_page;
-	s64 clat_nsec;
+	struct kio_buf *buf = bio->bi_private;
+	struct kio_thread *th = buf->owner;
+	s64 now, clat_nsec, lat_nsec;
+
+	if (unlikely(buf->ramp))
+		goto done;
 
-	clat_nsec = kio_bio_get_latency(bio);
+	now = ktime_to_ns(ktime_get());
+	clat_nsec = kio_bio_get_latency(bio, now);
 	atomic64_add(clat_nsec, &th->clat_total);
 
-	atomic_dec(&th->dispatched);
+	lat_nsec = kio_bio_get_total_latency(bio, now);
+
+	kio_hist_add(&th->hist[KIO_LAT_CLAT], clat_nsec);
+	kio_hist_add(&th->hist[KIO_LAT_LAT], lat_nsec);
+	kio_hist_add(&th->hist[KIO_LAT_OP + buf->op], lat_nsec);
+	atomic64_add(clat_nsec, &th->op_clat_total[buf->op]);
+	atomic64_inc(&th->op_completed[buf->op]);
+
+	if (unlikely(th->config->verify) && buf->op == KIO_OP_READ
+	    && !kio_bio_failed(bio))
+		kio_bio_verify(th, buf, now);
+
+	/* discards and the like do not move data */
+	if (kio_op_has_data(buf->op)) {
+		atomic64_add(buf->len, &th->bytes);
+		atomic64_add(buf->len, &th->op_bytes[buf->op]);
+	}
+
+	if (buf->hctx >= 0 && buf->hctx < th->nr_hctx) {
+		struct kio_thread_hctx *q = &th->hctx[buf->hctx];
+
+		atomic64_inc(&q->completed);
+		atomic64_add(clat_nsec, &q->clat_total);
+		if (kio_op_has_data(buf->op))
+			atomic64_add(buf->len, &q->bytes);
+		if (raw_smp_processor_id() != buf->cpu)
+			atomic64_inc(&q->remote);
+	}
+
 	atomic_inc(&th->completed);
 
+done:
+	/* buffer must be back in the pool before the thread sees room in
+	 * the queue, and can try to take it again */
+	kio_pool_put(th->pool, buf);
+	bio_put(bio);
+
+	atomic_dec(&th->dispatched);
+
 	if (th->bio_wqh)
 		wake_up_interruptible(th->bio_wqh);
-
-	__free_page(page);
-	bio_put(bio);
 }
 
 static inline int kio_thread_busy(struct kio_thread *th)
@@ -81,101 +254,387 @@ static inline int kio_thread_too_busy(struct kio_thread *th)
 		&& atomic_read(&th->dispatched) >= ktc->queue_depth;
 }
 
-struct dir {
-	u8 is_write;
-	u8 dir_changed;
-	u8 new_burst;
-};
+static inline bool kio_thread_can_submit(struct kio_thread *th)
+{
+	return !kio_thread_too_busy(th) && !kio_pool_empty(th->pool);
+}
 
-static inline struct dir kio_thread_next_dir(struct kio_thread *th)
+/* all threads stop together, when kio_run() says so; kthread_stop() then
+ * only reaps them */
+static inline bool kio_thread_should_stop(struct kio_thread *th)
 {
-	const struct kio_thread_config *ktc = th->config;
-	u32 rnd;
-	struct dir dir = {};
+	return READ_ONCE(th->sync->stop) || kthread_should_stop();
+}
 
-	if (th->read_burst) {
-		th->read_burst --;
-		dir.is_write = false;
-		goto finish;
-	}
+/* wait for completions to satisfy a condition; either sleep until the bio
+ * completion wakes us up, or in polled mode spin reaping completions until
+ * the thread is stopped */
+#define kio_thread_wait_event(th, wqh, condition) \
+({ \
+	int __rc = 0; \
+	if ((th)->config->poll) { \
+		while (!(condition) && !kio_thread_should_stop(th)) { \
+			kio_io_poll(&(th)->cookie); \
+			cond_resched(); \
+		} \
+	} else { \
+		__rc = wait_event_interruptible(wqh, condition); \
+	} \
+	__rc; \
+})
+
+/* IOs still in flight this long after the stop are reported */
+#define KIO_DRAIN_WARN_NSEC (5 * NSEC_PER_SEC)
+
+/* wait for all IOs in flight to complete
+ *
+ * Their completions use the thread's buffers, counters and histograms, so
+ * there is no giving up.  A polled thread spins for KIO_DRAIN_WARN_NSEC,
+ * then only polls once a jiffy, for IOs that are slow to time out.
+ */
+static void kio_thread_drain(struct kio_thread *th, wait_queue_head_t *wqh)
+{
+	s64 deadline = ktime_to_ns(ktime_get()) + KIO_DRAIN_WARN_NSEC;
+	bool warned = false;
+
+	while (atomic_read(&th->dispatched)) {
+		if (!warned && ktime_to_ns(ktime_get()) >= deadline) {
+			pr_warn("kio: thread[%u]: still waiting for %u requests\n",
+				th->index, atomic_read(&th->dispatched));
+			warned = true;
+		}
 
-	if (th->write_burst) {
-		th->write_burst --;
-		dir.is_write = true;
-		goto finish;
-	}
+		if (!th->config->poll) {
+			wait_event_timeout(*wqh, !atomic_read(&th->dispatched),
+					   nsecs_to_jiffies(KIO_DRAIN_WARN_NSEC));
+			continue;
+		}
 
-	if (ktc->read_mix_percent >= 100) {
-		dir.is_write = false;
-		goto finish;
+		kio_io_poll(&th->cookie);
+		if (warned)
+			schedule_timeout_uninterruptible(1);
+		else
+			cond_resched();
 	}
+}
+
+/* waits shorter than this spin, longer ones sleep on an hrtimer */
+#define KIO_SLEEP_SPIN_NSEC 10000
+#define KIO_SLEEP_SLACK_NSEC 1000
 
-	if (ktc->read_mix_percent < 1) {
-		dir.is_write = true;
-		goto finish;
+/* wait until the given ktime_get() nsec, or until the thread is stopped */
+static void kio_thread_wait_until(struct kio_thread *th, s64 when)
+{
+	ktime_t kt = ns_to_ktime(when);
+
+	if (th->config->poll || when - ktime_to_ns(ktime_get())
+					< KIO_SLEEP_SPIN_NSEC) {
+		while (ktime_to_ns(ktime_get()) < when
+		       && !kio_thread_should_stop(th)) {
+			if (th->config->poll)
+				kio_io_poll(&th->cookie);
+			cpu_relax();
+		}
+		return;
 	}
 
-	dir.new_burst = 1;
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (!kio_thread_should_stop(th))
+		schedule_hrtimeout_range(&kt, KIO_SLEEP_SLACK_NSEC,
+					 HRTIMER_MODE_ABS);
+	__set_current_state(TASK_RUNNING);
+}
 
-	rnd = prandom_u32() % 100;
-	if (rnd < ktc->read_mix_percent) {
-		th->read_burst = ktc->read_burst ? ktc->read_burst - 1 : 0;
-		dir.is_write = false;
-	} else {
-		th->write_burst = ktc->write_burst ? ktc->write_burst - 1 : 0;
-		dir.is_write = true;
+/* rate limiting is a token bucket, refilled every rate_interval
+ *
+ * Each IO gets a scheduled issue time, one interval after the previous
+ * one.  The thread waits for that time when it is ahead, and catches up
+ * without waiting when it is behind (because the queue was full).  This is
+ * open loop: lat is measured from the scheduled time, so time spent
+ * waiting for a slot in the queue is counted, not omitted.
+ */
+#define KIO_RATE_SHIFT 16
+
+static void kio_thread_rate_init(struct kio_thread *th, s64 start)
+{
+	const struct kio_thread_config *ktc = th->config;
+	u64 iops_fp;
+
+	BUILD_BUG_ON(KIO_MAX_RATE_BPS > U64_MAX >> KIO_RATE_SHIFT);
+
+	th->rate_interval = 0;
+	th->rate_frac = 0;
+	th->next_issue = start;
+
+	if (ktc->rate_iops)
+		th->rate_interval = div64_u64(NSEC_PER_SEC << KIO_RATE_SHIFT,
+					      ktc->rate_iops);
+
+	if (ktc->rate_bps) {
+		/* IOs per second, then nsec per IO, both in fixed point */
+		iops_fp = div64_u64(ktc->rate_bps << KIO_RATE_SHIFT,
+				    ktc->block_size) ?: 1;
+		th->rate_interval = max(th->rate_interval,
+			div64_u64(NSEC_PER_SEC << (2 * KIO_RATE_SHIFT), iops_fp));
 	}
+}
+
+/* returns the scheduled issue time of the next IO, waiting for it */
+static s64 kio_thread_rate_wait(struct kio_thread *th)
+{
+	s64 when = th->next_issue;
+
+	th->rate_frac += th->rate_interval;
+	th->next_issue += th->rate_frac >> KIO_RATE_SHIFT;
+	th->rate_frac &= (1 << KIO_RATE_SHIFT) - 1;
+
+	if (when > ktime_to_ns(ktime_get()))
+		kio_thread_wait_until(th, when);
+
+	return when;
+}
 
-finish:
-	dir.dir_changed = th->was_write != dir.is_write;
-	th->was_write = dir.is_write;
-	return dir;
+/* whether the rate limit, not a timed replay, says when IOs are issued */
+static inline bool kio_thread_rate_limited(const struct kio_thread *th)
+{
+	return th->rate_interval
+		&& !(th->trace && th->config->replay == KIO_REPLAY_TIMED);
 }
 
-static inline off_t kio_thread_next_offset(struct kio_thread *th)
+/* the ramp is not part of the coverage either */
+static inline void kio_thread_coverage(struct kio_thread *th, off_t offset)
+{
+	if (likely(!th->ramping))
+		kio_gen_coverage(th->config, th->coverage, offset);
+}
+
+/* share of each pattern block that is left as zeroes */
+static inline unsigned kio_thread_pattern_zeros(const struct kio_thread_config *ktc)
+{
+	return ktc->data_pattern == KIO_PATTERN_COMPRESS
+		? ktc->compress_percent : 0;
+}
+
+/* stamp that makes a write unique, or 0 to make it a duplicate */
+static inline u64 kio_thread_next_stamp(struct kio_thread *th)
 {
-	const unsigned block_size = kio_io_dev_block_size();
 	const struct kio_thread_config *ktc = th->config;
-	off_t result, range, r_end;
 
-	if (!block_size)
+	if (ktc->data_pattern == KIO_PATTERN_DEDUP
+	    && kio_rand_below(&th->gen.rand, 100) < ktc->dedup_percent)
 		return 0;
 
-	range = ktc->offset_high - ktc->offset_low;
-	if (unlikely (!range))
-		return ktc->offset_low;
+	return ((u64)th->data_seed << 32) + ++th->pattern_stamps;
+}
 
-	if (ktc->offset_random) {
-		u32 lo = prandom_u32();
-		u32 hi = prandom_u32();
-		u64 rnd = (u64)hi<<32 | lo;
-		result = ktc->offset_low + (rnd % range);
+/* the thread's next record of the trace, false when it has none left */
+static inline bool kio_thread_next_replay(struct kio_thread *th,
+					  struct kio_dir *dir, off_t *offset,
+					  unsigned *len, s64 *when)
+{
+	const unsigned block_size = kio_io_dev_block_size(th->tgt);
+	const struct kio_thread_config *ktc = th->config;
+	const struct kio_trace_io *io;
+	u64 range = ktc->offset_high - ktc->offset_low, pos;
+	off_t result;
 
-	} else {
-		int32_t stride = ktc->offset_stride;
-
-		result = th->next_offset;
-
-		th->next_offset += stride;
-		r_end = th->next_offset + ktc->block_size;
-		if (r_end > ktc->offset_high) {
-			if (stride > 0)
-				th->next_offset = ktc->offset_low;
-			else
-				th->next_offset = r_end;
-		} else if (r_end < ktc->offset_low) {
-			if (stride < 0)
-				th->next_offset = r_end;
-			else
-				th->next_offset = ktc->offset_low;
-		}
-	}
+	if (th->replay_next >= th->trace->nr)
+		return false;
+
+	io = &th->trace->ios[th->replay_next];
+	th->replay_next += th->replay_stride;
+
+	/* traces from bigger devices wrap around the offset range */
+	pos = io->offset;
+	if (pos > range)
+		div64_u64_rem(pos, range + 1, &pos);
 
 	/* must be a multiple of a block size */
+	result = ktc->offset_low + pos;
 	result /= block_size;
 	result *= block_size;
 
-	return result;
+	kio_thread_coverage(th, result);
+
+	dir->is_write = !!(io->flags & (KIO_TRACE_WRITE | KIO_TRACE_DISCARD));
+	dir->dir_changed = th->gen.was_write != dir->is_write;
+	dir->new_burst = dir->dir_changed;
+	th->gen.was_write = dir->is_write;
+
+	if (io->flags & KIO_TRACE_DISCARD)
+		dir->op = KIO_OP_DISCARD;
+	else if (io->flags & KIO_TRACE_WRITE)
+		dir->op = io->flags & KIO_TRACE_FUA ? KIO_OP_WRITE_FUA
+						    : KIO_OP_WRITE;
+	else
+		dir->op = KIO_OP_READ;
+
+	*offset = result;
+	*len = io->len;
+	*when = th->replay_start + io->time;
+	return true;
+}
+
+/* the ramp ends for all threads at the same time */
+static inline void kio_thread_ramp_check(struct kio_thread *th)
+{
+	if (ktime_to_ns(ktime_get()) >= th->window_start)
+		th->ramping = false;
+}
+
+/* submit one IO from the thread
+ *
+ * Returns 1 if the IO was submitted, 0 if there is no room in the queue,
+ * the thread was stopped, or the rate limit would have to be waited for
+ * and may_wait is false; negative on error.
+ */
+static int kio_thread_submit_one(struct kio_thread *th, wait_queue_head_t *wqh,
+				 bool may_wait)
+{
+	const struct kio_thread_config *ktc = th->config;
+	off_t offset;
+	struct kio_buf *buf;
+	s64 issue_time = 0, replay_time = 0, io_start, slat_nsec;
+	struct kio_dir dir;
+	unsigned len;
+	u32 sleep_usec;
+	int rc;
+
+	if (unlikely(kio_thread_too_busy(th)))
+		return 0;
+
+	if (!may_wait && kio_thread_rate_limited(th)
+	    && th->next_issue > ktime_to_ns(ktime_get()))
+		return 0;
+
+	if (unlikely(th->ramping))
+		kio_thread_ramp_check(th);
+
+	buf = kio_pool_get(th->pool);
+	if (unlikely(!buf))
+		return 0;
+
+	if (th->trace) {
+		if (!kio_thread_next_replay(th, &dir, &offset, &len,
+					    &replay_time)) {
+			th->replay_done = true;
+			kio_pool_put(th->pool, buf);
+			return 0;
+		}
+	} else {
+		dir = kio_gen_next_dir(&th->gen);
+		kio_gen_next_op(&th->gen, &dir);
+		offset = kio_gen_next_offset(&th->gen);
+		kio_thread_coverage(th, offset);
+		len = ktc->block_size;
+	}
+
+	buf->len = len;
+	buf->offset = offset;
+	buf->op = dir.op;
+	buf->ramp = th->ramping;
+
+	/* done before waiting on the rate, so it is not part of lat */
+	if (unlikely(ktc->verify) && kio_op_has_data(dir.op)) {
+		s64 verify_start = ktime_to_ns(ktime_get());
+
+		if (kio_op_is_write(dir.op))
+			kio_verify_fill(buf, offset,
+					kio_io_dev_block_size(th->tgt),
+					th->data_seed,
+					th->verify_generation++, th->index);
+		else
+			kio_verify_clear(buf, kio_io_dev_block_size(th->tgt));
+
+		if (!buf->ramp)
+			kio_hist_add(&th->hist[KIO_LAT_VERIFY],
+				     ktime_to_ns(ktime_get()) - verify_start);
+
+	} else if (kio_op_is_write(dir.op)
+		   && ktc->data_pattern != KIO_PATTERN_ZEROS) {
+		/* a read left device data where the pattern was */
+		if (unlikely(buf->dirty))
+			kio_pattern_fill_buf(th->pool, buf, th->data_seed,
+					     kio_thread_pattern_zeros(ktc));
+		kio_pattern_stamp(buf, kio_thread_next_stamp(th));
+	} else if (dir.op == KIO_OP_READ) {
+		buf->dirty = true;
+	}
+
+	if (ktc->burst_finish && dir.new_burst) {
+		rc = kio_thread_wait_event(th, *wqh,
+				      !kio_thread_busy(th));
+		(void)rc;
+		if (kio_thread_should_stop(th)) {
+			kio_pool_put(th->pool, buf);
+			return 0;
+		}
+	}
+
+	/* the trace's timing takes the place of the rate limit */
+	if (th->trace && ktc->replay == KIO_REPLAY_TIMED) {
+		issue_time = replay_time;
+		if (issue_time > ktime_to_ns(ktime_get()))
+			kio_thread_wait_until(th, issue_time);
+		if (kio_thread_should_stop(th)) {
+			kio_pool_put(th->pool, buf);
+			return 0;
+		}
+	} else if (kio_thread_rate_limited(th)) {
+		issue_time = kio_thread_rate_wait(th);
+		if (kio_thread_should_stop(th)) {
+			kio_pool_put(th->pool, buf);
+			return 0;
+		}
+	}
+
+	/* the hardware queue follows from the cpu the bio is submitted on;
+	 * unbound threads can be moved between IOs */
+	buf->cpu = raw_smp_processor_id();
+	buf->hctx = kio_io_dev_hctx(th->tgt, buf->cpu, dir.op,
+				    ktc->poll && kio_op_has_data(dir.op));
+	if (buf->cpu != th->last_cpu) {
+		if (th->last_cpu >= 0 && !th->ramping)
+			th->cpu_migrations++;
+		th->last_cpu = buf->cpu;
+	}
+
+	/* slat covers just the submission of the bio */
+	io_start = ktime_to_ns(ktime_get());
+
+	atomic_inc(&th->dispatched);
+
+	rc = kio_io_submit(th->tgt, offset, buf->pages, buf->len,
+			   dir.op, issue_time ?: io_start,
+			   ktc->poll ? &th->cookie : NULL,
+			   kio_bio_completion, buf);
+	if (unlikely(rc<0)) {
+		pr_warn("kio: thread[%u]: failed %s dispatch at %ld, with %d\n",
+			th->index, kio_op_name[dir.op], offset, rc);
+		kio_pool_put(th->pool, buf);
+		atomic_dec(&th->dispatched);
+		return rc;
+	}
+
+	slat_nsec = ktime_to_ns(ktime_get()) - io_start;
+	th->batch_slat += slat_nsec;
+
+	/* buf may already be back in the pool, th->ramping is still what
+	 * it was when it was issued */
+	if (likely(!th->ramping)) {
+		th->slat_total += slat_nsec;
+		th->op_slat_total[dir.op] += slat_nsec;
+		kio_hist_add(&th->hist[KIO_LAT_SLAT], slat_nsec);
+	}
+
+	sleep_usec = dir.is_write ? ktc->write_sleep_usec : ktc->read_sleep_usec;
+	if (unlikely(sleep_usec)) {
+		if (!ktc->burst_delay || dir.dir_changed)
+			kio_thread_wait_until(th, ktime_to_ns(ktime_get())
+					      + (s64)sleep_usec * NSEC_PER_USEC);
+	}
+
+	return 1;
 }
 
 static int kio_thread_fn(void *data)
@@ -186,97 +645,161 @@ static int kio_thread_fn(void *data)
 	int result = 0, rc;
 	s64 thread_start;
 
-	pr_info("kio: thread[%u]: start\n",
-		th->index);
-
-	th->bio_wqh = &wqh;
-	th->runtime = 0;
-	thread_start = ktime_to_ns(ktime_get());
+	pr_info("kio: thread[%u]: start on cpu %d node %d seed %llu\n",
+		th->index, th->cpu, th->nid, th->seed);
+
+	th->pool = kio_pool_create(ktc->queue_depth, ktc->block_size,
+				   th->nid != NUMA_NO_NODE ? th->nid
+				   : numa_node_id(), th);
+	if (!th->pool) {
+		pr_warn("kio: thread[%u]: failed to allocate %u buffers of %u bytes\n",
+			th->index, ktc->queue_depth, ktc->block_size);
+		result = -ENOMEM;
+		goto emergency_stop;
+	}
 
-	while (!kthread_should_stop()) {
-		off_t offset;
-		struct page *page;
-		s64 io_start, slat_nsec;
-		struct dir dir;
-		u32 sleep_usec;
-
-		if (unlikely(kio_thread_too_busy(th))) {
-			rc = wait_event_interruptible(wqh,
-					      !kio_thread_too_busy(th));
-			(void)rc;
-			if (kthread_should_stop())
-				break;
+	th->nr_hctx = kio_io_dev_nr_hctx(th->tgt);
+	if (th->nr_hctx) {
+		th->hctx = kzalloc_node(th->nr_hctx * sizeof(*th->hctx),
+					GFP_KERNEL, th->pool->nid);
+		if (!th->hctx) {
+			pr_warn("kio: thread[%u]: failed to allocate counters for %u hardware queues\n",
+				th->index, th->nr_hctx);
+			kio_pool_destroy(th->pool);
+			th->pool = NULL;
+			result = -ENOMEM;
+			goto emergency_stop;
 		}
+	}
 
-		page = kio_new_page();
-		if (unlikely(!page)) {
-			pr_warn("kio: thread[%u]: failed allocate page\n",
-				th->index);
-			result = -ENOMEM;
-			break;
+	if (ktc->offset_random) {
+		result = kio_dist_init(&th->gen.dist, ktc,
+				       div64_u64(ktc->offset_high - ktc->offset_low,
+						 ktc->block_size),
+				       th->pool->nid);
+		if (result < 0) {
+			pr_warn("kio: thread[%u]: failed to set up %s offsets\n",
+				th->index, kio_offset_dist_name[ktc->offset_dist]);
+			kio_pool_destroy(th->pool);
+			th->pool = NULL;
+			goto emergency_stop;
 		}
+	}
+
+	/* generated once, writes only pay for a stamp, unless the buffer
+	 * was read into since */
+	if (ktc->data_pattern != KIO_PATTERN_ZEROS)
+		kio_pattern_fill(th->pool, th->data_seed,
+				 kio_thread_pattern_zeros(ktc));
 
-		dir = kio_thread_next_dir(th);
-		offset = kio_thread_next_offset(th);
+	th->bio_wqh = &wqh;
+	th->runtime = 0;
 
-		io_start = ktime_to_ns(ktime_get());
+	/* the last thread to be ready starts everyone */
+	if (atomic_dec_and_test(&th->sync->waiting)) {
+		s64 now = ktime_to_ns(ktime_get());
 
-		if (ktc->burst_finish && dir.new_burst) {
-			rc = wait_event_interruptible(wqh,
-					      !kio_thread_busy(th));
+		th->sync->ramp_end = now + th->sync->ramp_nsec;
+		smp_wmb();
+		WRITE_ONCE(th->sync->start, now);
+		wake_up_all(&th->sync->wqh);
+		wake_up_interruptible(th->run_wqh);
+	}
+	wait_event_interruptible(th->sync->wqh, READ_ONCE(th->sync->start)
+				 || kio_thread_should_stop(th));
+	thread_start = READ_ONCE(th->sync->start);
+	smp_rmb();
+
+	kio_thread_rate_init(th, thread_start);
+	th->replay_start = thread_start;
+	th->window_start = th->sync->ramp_end;
+	th->ramping = th->window_start > thread_start;
+
+	while (thread_start && !kio_thread_should_stop(th)) {
+		struct blk_plug plug;
+		unsigned n, batch = max_t(unsigned, ktc->submit_batch, 1);
+		s64 flush_start;
+
+		if (unlikely(!kio_thread_can_submit(th))) {
+			rc = kio_thread_wait_event(th, wqh,
+					      kio_thread_can_submit(th));
 			(void)rc;
-			if (kthread_should_stop()) {
-				__free_page(page);
+			if (kio_thread_should_stop(th))
 				break;
-			}
 		}
 
-		atomic_inc(&th->dispatched);
+		/* a batch waits for the rate limit before it is plugged, and
+		 * ends at the first IO that is not due yet, instead of holding
+		 * the IOs already queued while it waits */
+		if (batch > 1 && kio_thread_rate_limited(th)
+		    && th->next_issue > ktime_to_ns(ktime_get())) {
+			kio_thread_wait_until(th, th->next_issue);
+			if (kio_thread_should_stop(th))
+				break;
+		}
 
-		result = kio_io_submit(offset, page, dir.is_write,
-				       kio_bio_completion, th);
-		if (unlikely(result<0)) {
-			pr_warn("kio: thread[%u]: failed read dispatch at %ld, with %d\n",
-				th->index, offset, result);
-			break;
+		if (batch > 1) {
+			th->batch_slat = 0;
+			blk_start_plug(&plug);
 		}
 
-		slat_nsec = ktime_to_ns(ktime_get()) - io_start;
+		for (n = 0; n < batch; n++) {
+			rc = kio_thread_submit_one(th, &wqh, batch == 1);
+			if (rc <= 0)
+				break;
+		}
 
-		th->slat_total += slat_nsec;
+		if (batch > 1) {
+			flush_start = ktime_to_ns(ktime_get());
+			blk_finish_plug(&plug);
 
-		sleep_usec = dir.is_write ? ktc->write_sleep_usec : ktc->read_sleep_usec;
-		if (unlikely(sleep_usec)) {
-			if (!ktc->burst_delay || dir.dir_changed) {
-				unsigned long hz = usecs_to_jiffies(sleep_usec);
-				if (hz)
-					schedule_timeout(hz);
-				else
-					udelay(ktc->read_sleep_usec);
+			/* time to queue the batch's IOs and flush them to the
+			 * device, without the waits and fills between them */
+			if (n && !th->ramping) {
+				kio_hist_add(&th->hist[KIO_LAT_BATCH], th->batch_slat
+					     + ktime_to_ns(ktime_get()) - flush_start);
+				th->batch_ios += n;
 			}
 		}
 
+		if (unlikely(rc < 0)) {
+			result = rc;
+			break;
+		}
+
+		if (unlikely(th->replay_done))
+			break;
+
 		if (unlikely(signal_pending(current))) {
 			result = -EINTR;
 			break;
 		}
 	}
 
-	rc = wait_event_interruptible(wqh, !atomic_read(&th->dispatched));
+	kio_thread_drain(th, &wqh);
+	kio_io_cookie_release(&th->cookie);
 
-	th->runtime = ktime_to_ns(ktime_get()) - thread_start;
+	/* a thread that never got past the ramp has nothing measured */
+	if (thread_start && !th->ramping)
+		th->runtime = ktime_to_ns(ktime_get()) - th->window_start;
 
-	if (atomic_read(&th->dispatched)) {
-		pr_warn("kio: thread[%u]: %u pending requests, completed=%d, result=%d\n",
-			th->index, atomic_read(&th->dispatched),
-			atomic_read(&th->completed), result);
-	} else {
-		pr_info("kio: thread[%u]: done, completed=%d, result=%d\n",
-			th->index, atomic_read(&th->completed), result);
-	}
+	pr_info("kio: thread[%u]: done, completed=%d, result=%d\n",
+		th->index, atomic_read(&th->completed), result);
 
 	th->bio_wqh = NULL;
 
+	kio_pool_destroy(th->pool);
+	th->pool = NULL;
+
+	/* the run ends once all replaying threads are out of records */
+	if (th->replay_done && atomic_dec_and_test(th->replay_left)) {
+		WRITE_ONCE(*th->replay_finished, true);
+		wake_up_interruptible(th->run_wqh);
+	}
+
+emergency_stop:
+	kio_dist_free(&th->gen.dist);
+
 	if (result<0) {
 		mb();
 		*(th->emergency_stop) = true;
@@ -284,40 +807,203 @@ static int kio_thread_fn(void *data)
 		wake_up_interruptible(th->run_wqh);
 	}
 
+	/* kio_run() reaps every thread with kthread_stop(), so stay around
+	 * until it does */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+
 	return result;
 }
 
+/* what the threads of a run add up to
+ *
+ * Threads run side by side, so the rates of the run are its counts over
+ * its wall clock, which is the runtime of the longest thread, and latency
+ * is averaged over all IOs of all threads.  The thread rates added up are
+ * kept to check the summary against.
+ */
 struct kio_run_stats {
 	u32 num_threads;
 	u64 dispatched;
 	u64 completed;
+	u64 bytes;
 	u64 slat_total;
 	u64 clat_total;
+	u64 runtime_min;                // of the shortest thread
+	u64 runtime_max;                // of the longest, the run's wall clock
+	u64 iops_total;                 // of each thread, added up
 	u64 bps_total;
-	u64 runtime_total;
+	u32 verify_threads;
+	u64 verified;
+	u64 unwritten;
+	u64 verify_errors;
+	struct kio_op_counters ops[KIO_OP_NR];
 };
 
+static void kio_thread_op_counters(const struct kio_thread *th,
+				   struct kio_op_counters *ops)
+{
+	int op;
+
+	for (op = 0; op < KIO_OP_NR; op++) {
+		ops[op].completed = atomic64_read(&th->op_completed[op]);
+		ops[op].bytes = atomic64_read(&th->op_bytes[op]);
+		ops[op].slat_total = th->op_slat_total[op];
+		ops[op].clat_total = atomic64_read(&th->op_clat_total[op]);
+	}
+}
+
+/* one line per op, but only when there was more than one kind of op,
+ * otherwise it would repeat the line before */
+static void kio_run_stats_ops(const char *who,
+			      const struct kio_op_counters *ops,
+			      const u64 *iops, const u64 *bps)
+{
+	u64 slat, clat, lat;
+	int op, kinds = 0;
+
+	for (op = 0; op < KIO_OP_NR; op++)
+		kinds += !!ops[op].completed;
+	if (kinds < 2)
+		return;
+
+	for (op = 0; op < KIO_OP_NR; op++) {
+		if (!ops[op].completed)
+			continue;
+
+		slat = div64_u64(ops[op].slat_total, ops[op].completed);
+		clat = div64_u64(ops[op].clat_total, ops[op].completed);
+		lat = slat + clat;
+
+		pr_warn("kio: %s: %s completed=%llu "
+			"lat=%llu.%03llu(%llu.%03llu+%llu.%03llu) iops=%llu "
+			"MB/s=%llu.%03llu\n",
+			who, kio_op_name[op], ops[op].completed,
+			lat/1000, lat%1000,
+			slat/1000, slat%1000,
+			clat/1000, clat%1000,
+			iops[op],
+			bps[op]/1000000, (bps[op]/1000)%1000);
+	}
+}
+
+static void kio_run_stats_pct(const char *who, const struct kio_hist *hist)
+{
+	struct kio_hist_pct p;
+	int t;
+
+	for (t = 0; t < KIO_LAT_NR; t++) {
+		/* batch, verify and the ops are only there when used */
+		if (t > KIO_LAT_LAT && !kio_hist_count(&hist[t]))
+			continue;
+
+		kio_hist_percentiles(&hist[t], &p);
+
+		pr_warn("kio: %s: %s_usec p50=%llu.%03llu p90=%llu.%03llu "
+			"p99=%llu.%03llu p99.9=%llu.%03llu p99.99=%llu.%03llu "
+			"max=%llu.%03llu\n",
+			who, kio_lat_name[t],
+			p.pct[0]/1000, p.pct[0]%1000,
+			p.pct[1]/1000, p.pct[1]%1000,
+			p.pct[2]/1000, p.pct[2]%1000,
+			p.pct[3]/1000, p.pct[3]%1000,
+			p.pct[4]/1000, p.pct[4]%1000,
+			p.max/1000, p.max%1000);
+	}
+}
+
+/* how many 1% slices of the offset range were hit, and the share of IOs
+ * that went to the hottest 1% and 10% of them */
+static void kio_run_stats_coverage(const struct kio_thread *th)
+{
+	DECLARE_BITMAP(picked, KIO_COVERAGE_BUCKETS) = {};
+	u64 total = 0, top1 = 0, top10 = 0, best;
+	int i, n, touched = 0, idx;
+
+	for (i = 0; i < KIO_COVERAGE_BUCKETS; i++) {
+		total += th->coverage[i];
+		touched += !!th->coverage[i];
+	}
+	if (!total)
+		return;
+
+	for (n = 0; n < KIO_COVERAGE_BUCKETS / 10; n++) {
+		best = 0;
+		idx = -1;
+		for (i = 0; i < KIO_COVERAGE_BUCKETS; i++) {
+			if (!test_bit(i, picked) && th->coverage[i] >= best) {
+				best = th->coverage[i];
+				idx = i;
+			}
+		}
+		__set_bit(idx, picked);
+		if (!n)
+			top1 = best;
+		top10 += best;
+	}
+
+	top1 = div64_u64(top1 * 100000, total);
+	top10 = div64_u64(top10 * 100000, total);
+
+	pr_warn("kio: thread[%u]: coverage touched=%d/%d hot1=%llu.%03llu%% "
+		"hot10=%llu.%03llu%%\n", th->index, touched,
+		KIO_COVERAGE_BUCKETS, top1/1000, top1%1000,
+		top10/1000, top10%1000);
+}
+
+/* how the IOs of a thread spread over the device's hardware queues */
+static void kio_run_stats_hctx(const struct kio_thread *th)
+{
+	u64 cnt = atomic_read(&th->completed), done, remote, share;
+	unsigned h;
+
+	if (th->cpu_migrations)
+		pr_warn("kio: thread[%u]: cpu_migrations=%llu\n",
+			th->index, th->cpu_migrations);
+
+	if (!th->hctx || !cnt)
+		return;
+
+	for (h = 0; h < th->nr_hctx; h++) {
+		done = atomic64_read(&th->hctx[h].completed);
+		if (!done)
+			continue;
+
+		remote = atomic64_read(&th->hctx[h].remote);
+		share = div64_u64(done * 100000, cnt);
+		pr_warn("kio: thread[%u]: hctx[%u] completed=%llu "
+			"share=%llu.%03llu%% remote=%llu\n", th->index, h,
+			done, share/1000, share%1000, remote);
+	}
+}
+
 static void kio_run_stats_thread(const struct kio_thread *th,
 				 struct kio_run_stats *st)
 {
-	const struct kio_thread_config *ktc = th->config;
-	u32 cnt=0, iops=0;
-	u64 slat=0, clat=0, lat=0, bps=0;
+	u32 cnt=0;
+	u64 slat=0, clat=0, lat=0, iops=0, bps=0, bytes, batches;
+	struct kio_op_counters ops[KIO_OP_NR];
+	u64 op_iops[KIO_OP_NR], op_bps[KIO_OP_NR];
+	char who[20];
+	int op;
 
 	cnt = atomic_read(&th->completed);
+	bytes = atomic64_read(&th->bytes);
 	if (cnt) {
 		slat = th->slat_total / cnt;
 		clat = atomic64_read(&th->clat_total) / cnt;
 		lat = slat + clat;
 	}
 
-	if (th->runtime) {
-		iops = ((u64)cnt * NSEC_PER_SEC) / th->runtime;
-		bps = ((u64)cnt * ktc->block_size * NSEC_PER_SEC) / th->runtime;
-	}
+	iops = kio_run_rate(cnt, th->runtime);
+	bps = kio_run_rate(bytes, th->runtime);
 
 	pr_warn("kio: thread[%u]: completed=%u "
-		"lat=%llu.%03llu(%llu.%03llu+%llu.%03llu) iops=%u MB/s=%llu.%03llu\n",
+		"lat=%llu.%03llu(%llu.%03llu+%llu.%03llu) iops=%llu MB/s=%llu.%03llu\n",
 		th->index, cnt,
 		lat/1000, lat%1000,
 		slat/1000, slat%1000,
@@ -325,82 +1011,760 @@ static void kio_run_stats_thread(const struct kio_thread *th,
 		iops,
 		bps/1000000, (bps/1000)%1000);
 
+	snprintf(who, sizeof(who), "thread[%u]", th->index);
+
+	kio_thread_op_counters(th, ops);
+	for (op = 0; op < KIO_OP_NR; op++) {
+		op_iops[op] = kio_run_rate(ops[op].completed, th->runtime);
+		op_bps[op] = kio_run_rate(ops[op].bytes, th->runtime);
+	}
+	kio_run_stats_ops(who, ops, op_iops, op_bps);
+
+	kio_run_stats_pct(who, th->hist);
+
+	batches = kio_hist_count(&th->hist[KIO_LAT_BATCH]);
+	if (batches && th->batch_ios) {
+		/* submission cost of each IO, amortized over its batch */
+		u64 per_batch = div64_u64(th->batch_ios * 1000, batches);
+		u64 per_io = div64_u64(atomic64_read(&th->hist[KIO_LAT_BATCH].sum),
+				       th->batch_ios);
+
+		pr_warn("kio: thread[%u]: batches=%llu ios/batch=%llu.%03llu "
+			"bslat/io=%llu.%03llu\n",
+			th->index, batches,
+			per_batch/1000, per_batch%1000,
+			per_io/1000, per_io%1000);
+	}
+
+	kio_run_stats_coverage(th);
+	kio_run_stats_hctx(th);
+
+	if (th->config->verify)
+		pr_warn("kio: thread[%u]: verified=%lld unwritten=%lld "
+			"mismatches=%lld\n", th->index,
+			(s64)atomic64_read(&th->verified),
+			(s64)atomic64_read(&th->unwritten),
+			(s64)atomic64_read(&th->verify_errors));
+
+	if (!st->num_threads || th->runtime < st->runtime_min)
+		st->runtime_min = th->runtime;
+	st->runtime_max = max(st->runtime_max, th->runtime);
+
 	st->num_threads ++;
 	st->dispatched += atomic_read(&th->dispatched);
 	st->completed += cnt;
+	st->bytes += bytes;
 	st->slat_total += th->slat_total;
 	st->clat_total += atomic64_read(&th->clat_total);
+	st->iops_total += iops;
 	st->bps_total += bps;
-	st->runtime_total += th->runtime;
+	for (op = 0; op < KIO_OP_NR; op++) {
+		st->ops[op].completed += ops[op].completed;
+		st->ops[op].bytes += ops[op].bytes;
+		st->ops[op].slat_total += ops[op].slat_total;
+		st->ops[op].clat_total += ops[op].clat_total;
+	}
+	if (th->config->verify) {
+		st->verify_threads ++;
+		st->verified += atomic64_read(&th->verified);
+		st->unwritten += atomic64_read(&th->unwritten);
+		st->verify_errors += atomic64_read(&th->verify_errors);
+	}
+}
+
+/* val * ppm / 10^6, without overflowing for any val */
+static u64 kio_run_stats_scale(u64 val, u32 ppm)
+{
+	u32 rem;
+	u64 quot = div_u64_rem(val, 1000000, &rem);
+
+	return quot * ppm + div_u64((u64)rem * ppm, 1000000);
+}
+
+/* kio_run_rate() rounds down, so each rate is short by less than this */
+#define KIO_RATE_ROUNDING 1
+
+/* how far the run's rate and the threads' rates, added up, can be apart
+ * from rounding alone
+ *
+ * Each of them is rounded down by less than KIO_RATE_ROUNDING.  For counts
+ * that kio_run_rate() divides by msec, each is a whole number of msec
+ * worth, so off by up to MSEC_PER_SEC, and the runtime is rounded down to
+ * msec, which makes a rate up to 1/runtime_msec too high.
+ */
+static u64 kio_run_stats_rate_slack(const struct kio_run_stats *st,
+				    u64 count, u64 rate, u64 total)
+{
+	u64 rates = st->num_threads + 1;
+	u64 slack = rates * KIO_RATE_ROUNDING;
+
+	/* no thread counted more than the run */
+	if (count > KIO_RATE_NSEC_MAX_COUNT)
+		slack += rates * MSEC_PER_SEC
+			+ div64_u64(rate + total,
+				    div64_u64(st->runtime_min, NSEC_PER_MSEC) ?: 1);
+
+	return slack;
+}
+
+/* check a rate of the run against the same rate of each thread, added up
+ *
+ * Every thread ran for at most the wall clock of the run, so the run's
+ * rate cannot be more than the sum.  It cannot be less than the sum scaled
+ * by how much shorter the shortest thread was.  Either way, it can be off
+ * by the rounding of the rates.
+ */
+static bool kio_run_stats_check_rate(const struct kio_run_stats *st,
+				     const char *name, u64 count, u64 rate,
+				     u64 total)
+{
+	u32 ppm = st->runtime_max
+		? div64_u64(st->runtime_min * 1000, st->runtime_max) * 1000
+		: 1000000;
+	u64 slack = kio_run_stats_rate_slack(st, count, rate, total);
+	u64 low = kio_run_stats_scale(total, ppm);
+
+	if (rate <= total + slack && rate + slack >= low)
+		return true;
+
+	pr_warn("kio: summary: self-check failed: %s=%llu, threads add up to "
+		"%llu, expected [%llu,%llu]\n", name, rate, total,
+		low > slack ? low - slack : 0, total + slack);
+	return false;
 }
 
-static void kio_run_stats_total(const struct kio_run_stats *st)
+/* the summary has to account for every IO of the threads, and agree with
+ * their rates; failures are reported, the numbers are still published */
+static bool kio_run_stats_check(const struct kio_run_stats *st,
+				const struct kio_hist *hist, u64 iops, u64 bps)
 {
-	u32 cnt=0, iops=0;
-	u64 slat=0, clat=0, lat=0, bps=0;
+	u64 op_completed = 0;
+	bool ok = true;
+	int op;
+
+	for (op = 0; op < KIO_OP_NR; op++)
+		op_completed += st->ops[op].completed;
+
+	if (op_completed != st->completed
+	    || kio_hist_count(&hist[KIO_LAT_LAT]) != st->completed) {
+		pr_warn("kio: summary: self-check failed: completed=%llu, "
+			"ops add up to %llu, histogram has %llu\n",
+			st->completed, op_completed,
+			kio_hist_count(&hist[KIO_LAT_LAT]));
+		ok = false;
+	}
+
+	ok &= kio_run_stats_check_rate(st, "iops", st->completed, iops,
+				       st->iops_total);
+	ok &= kio_run_stats_check_rate(st, "bps", st->bytes, bps,
+				       st->bps_total);
+
+	return ok;
+}
 
+static void kio_run_stats_total(const struct kio_run_stats *st,
+				const struct kio_hist *hist)
+{
+	u64 cnt=0, iops=0, slat=0, clat=0, lat=0, bps=0;
+	u64 op_iops[KIO_OP_NR], op_bps[KIO_OP_NR];
+	int op;
+
+	/* weighted by IOs, not by threads */
 	cnt = st->completed;
 	if (cnt) {
-		slat = st->slat_total / cnt;
-		clat = st->clat_total / cnt;
+		slat = div64_u64(st->slat_total, cnt);
+		clat = div64_u64(st->clat_total, cnt);
 		lat = slat + clat;
 	}
 
-	if (st->runtime_total && st->num_threads) {
-		iops = ((u64)cnt * NSEC_PER_SEC)
-			/ (st->runtime_total * st->num_threads);
-		bps = st->bps_total / st->num_threads;
-	}
+	/* over the wall clock of the run */
+	iops = kio_run_rate(cnt, st->runtime_max);
+	bps = kio_run_rate(st->bytes, st->runtime_max);
 
-	pr_warn("kio: summary: completed=%u "
-		"lat=%llu.%03llu(%llu.%03llu+%llu.%03llu) iops=%u MB/s=%llu.%03llu\n",
+	pr_warn("kio: summary: completed=%llu "
+		"lat=%llu.%03llu(%llu.%03llu+%llu.%03llu) iops=%llu MB/s=%llu.%03llu\n",
 		cnt,
 		lat/1000, lat%1000,
 		slat/1000, slat%1000,
 		clat/1000, clat%1000,
 		iops,
 		bps/1000000, (bps/1000)%1000);
+
+	for (op = 0; op < KIO_OP_NR; op++) {
+		op_iops[op] = kio_run_rate(st->ops[op].completed,
+					   st->runtime_max);
+		op_bps[op] = kio_run_rate(st->ops[op].bytes, st->runtime_max);
+	}
+	kio_run_stats_ops("summary", st->ops, op_iops, op_bps);
+
+	kio_run_stats_pct("summary", hist);
+
+	if (st->verify_threads)
+		pr_warn("kio: summary: verified=%llu unwritten=%llu "
+			"mismatches=%llu\n", st->verified, st->unwritten,
+			st->verify_errors);
+
+	kio_run_stats_check(st, hist, iops, bps);
 }
 
-int kio_run(const struct kio_config *kc)
+/* raw counters of a thread, and their sum, for the published results */
+static void kio_run_results_collect(struct kio_run_results *res,
+				    const struct kio_thread *th)
 {
-	int result = 0, i;
-	size_t ths_size;
-	struct kio_thread *ths;
-	DECLARE_WAIT_QUEUE_HEAD(wqh);
-	bool emergency_stop = false;
+	struct kio_run_counters *c = kio_run_results_counters(res, th->index);
+	struct kio_run_counters *sum = kio_run_results_counters(res, -1);
+	int i;
+
+	c->target = th->tgt->index;
+	c->dev_name = kstrdup(kio_io_dev_name(th->tgt), GFP_KERNEL);
+	c->poll = th->config->poll;
+	c->seed = th->seed;
+	c->dispatched = atomic_read(&th->dispatched);
+	c->completed = atomic_read(&th->completed);
+	c->bytes = atomic64_read(&th->bytes);
+	c->runtime = th->runtime;
+	c->slat_total = th->slat_total;
+	c->clat_total = atomic64_read(&th->clat_total);
+	c->batch_ios = th->batch_ios;
+	c->verified = atomic64_read(&th->verified);
+	c->unwritten = atomic64_read(&th->unwritten);
+	c->verify_errors = atomic64_read(&th->verify_errors);
+	c->cpu_migrations = th->cpu_migrations;
+	for (i = 0; i < KIO_COVERAGE_BUCKETS; i++) {
+		c->coverage[i] = th->coverage[i];
+		sum->coverage[i] += c->coverage[i];
+	}
 
-#if 1
-	for (i=0; i<kc->num_threads; i++) {
-		if (kc->threads[i].block_size != 4096) {
-			pr_warn("kio: current implementation only "
-				"supports block_size of 4096\n");
-			return -ERANGE;
+	kio_thread_op_counters(th, c->ops);
+	for (i = 0; i < KIO_OP_NR; i++) {
+		sum->ops[i].completed += c->ops[i].completed;
+		sum->ops[i].bytes += c->ops[i].bytes;
+		sum->ops[i].slat_total += c->ops[i].slat_total;
+		sum->ops[i].clat_total += c->ops[i].clat_total;
+	}
+
+	sum->dispatched += c->dispatched;
+	sum->completed += c->completed;
+	sum->bytes += c->bytes;
+	sum->runtime = max(sum->runtime, c->runtime);
+	sum->slat_total += c->slat_total;
+	sum->clat_total += c->clat_total;
+	sum->batch_ios += c->batch_ios;
+	sum->verified += c->verified;
+	sum->unwritten += c->unwritten;
+	sum->verify_errors += c->verify_errors;
+	sum->cpu_migrations += c->cpu_migrations;
+
+	/* results outlive the threads; without room the queues are left out */
+	c->hctx = th->hctx ? kcalloc(th->nr_hctx, sizeof(*c->hctx), GFP_KERNEL)
+		: NULL;
+	c->nr_hctx = c->hctx ? th->nr_hctx : 0;
+	for (i = 0; i < c->nr_hctx; i++) {
+		c->hctx[i].completed = atomic64_read(&th->hctx[i].completed);
+		c->hctx[i].bytes = atomic64_read(&th->hctx[i].bytes);
+		c->hctx[i].clat_total = atomic64_read(&th->hctx[i].clat_total);
+		c->hctx[i].remote = atomic64_read(&th->hctx[i].remote);
+	}
+}
+
+/* aggregate of all threads hitting each target, when there is more than
+ * one target in the run */
+static void kio_run_stats_targets(const struct kio_thread *ths, u32 count)
+{
+	struct kio_hist *hist;
+	const struct kio_io_target *used[KIO_MAX_TARGETS] = {};
+	int i, t, idx, nr_used = 0;
+
+	for (i = 0; i < count; i++) {
+		idx = ths[i].tgt->index;
+		if (!used[idx])
+			nr_used++;
+		used[idx] = ths[i].tgt;
+	}
+
+	if (nr_used < 2)
+		return;
+
+	hist = kio_hist_alloc(KIO_LAT_NR);
+	if (!hist)
+		return;
+
+	for (idx = 0; idx < KIO_MAX_TARGETS; idx++) {
+		u64 cnt = 0, bytes = 0, iops, bps, runtime = 0;
+		char who[20];
+
+		if (!used[idx])
+			continue;
+
+		memset(hist, 0, KIO_LAT_NR * sizeof(*hist));
+
+		/* threads run side by side, same as for the summary */
+		for (i = 0; i < count; i++) {
+			const struct kio_thread *th = &ths[i];
+
+			if (th->tgt->index != idx)
+				continue;
+
+			cnt += atomic_read(&th->completed);
+			bytes += atomic64_read(&th->bytes);
+			runtime = max(runtime, th->runtime);
+
+			for (t = 0; t < KIO_LAT_NR; t++)
+				kio_hist_merge(&hist[t], &th->hist[t]);
+		}
+
+		iops = kio_run_rate(cnt, runtime);
+		bps = kio_run_rate(bytes, runtime);
+
+		pr_warn("kio: target[%d]: device=%s completed=%llu "
+			"iops=%llu MB/s=%llu.%03llu\n",
+			idx, kio_io_dev_name(used[idx]), cnt,
+			iops, bps/1000000, (bps/1000)%1000);
+
+		snprintf(who, sizeof(who), "target[%d]", idx);
+		kio_run_stats_pct(who, hist);
+	}
+
+	kio_hist_free(hist);
+}
+
+void kio_run_exit(void)
+{
+	kio_run_stop();
+	flush_work(&kio_run_work);
+
+	kio_run_results_publish(NULL);
+	kio_sweep_results_publish(NULL);
+}
+
+/* live stats, streamed every stats_interval_msec while the run is going */
+struct kio_run_interval {
+	u32 msec;                       // 0 if not streaming
+	s64 start;                      // when the threads were released
+	s64 last;                       // end of the previous interval
+	struct kio_hist *hist;          // KIO_LAT_NR per thread, then two
+	                                // scratch sets: delta and total
+	char *line;
+};
+
+static void kio_run_interval_free(struct kio_run_interval *iv)
+{
+	kio_hist_free(iv->hist);
+	kfree(iv->line);
+	memset(iv, 0, sizeof(*iv));
+}
+
+static void kio_run_interval_init(struct kio_run_interval *iv,
+				  const struct kio_config *kc,
+				  struct kio_thread *ths)
+{
+	int i;
+
+	memset(iv, 0, sizeof(*iv));
+
+	if (!kc->stats_interval_msec)
+		return;
+
+	iv->hist = kio_hist_alloc((kc->num_threads + 2) * KIO_LAT_NR);
+	iv->line = kmalloc(KIO_STREAM_LINE_MAX, GFP_KERNEL);
+	if (!iv->hist || !iv->line) {
+		pr_warn("kio: no memory for live stats, not streaming\n");
+		kio_run_interval_free(iv);
+		return;
+	}
+
+	for (i = 0; i < kc->num_threads; i++)
+		ths[i].iv_hist = iv->hist + (i * KIO_LAT_NR);
+
+	/* start and last are set by kio_run_wait(), once the threads are
+	 * released */
+	iv->msec = kc->stats_interval_msec;
+
+	kio_stream_start(kc->num_threads, iv->msec);
+}
+
+/* one line of the stream, for a thread or for all of them */
+static void kio_run_interval_line(struct kio_run_interval *iv, s64 now,
+				  const char *who, u64 ios, u64 bytes,
+				  const struct kio_hist *hist)
+{
+	static const enum kio_lat_type types[] = { KIO_LAT_CLAT, KIO_LAT_LAT };
+	const size_t size = KIO_STREAM_LINE_MAX;
+	struct kio_hist_pct p;
+	u64 iops, bps, elapsed;
+	size_t len;
+	int t, i;
+
+	elapsed = div64_u64(now - iv->start, NSEC_PER_MSEC);
+	iops = kio_run_rate(ios, now - iv->last);
+	bps = kio_run_rate(bytes, now - iv->last);
+
+	len = scnprintf(iv->line, size,
+			"time_ms=%llu %s ios=%llu iops=%llu bw_MBps=%llu.%03llu",
+			elapsed, who, ios, iops,
+			bps/1000000, (bps/1000)%1000);
+
+	for (t = 0; t < ARRAY_SIZE(types); t++) {
+		const char *name = kio_lat_name[types[t]];
+
+		kio_hist_percentiles(&hist[types[t]], &p);
+
+		len += scnprintf(iv->line + len, size - len,
+				 " %s_avg_usec=%llu.%03llu",
+				 name, p.avg/1000, p.avg%1000);
+		for (i = 0; i < KIO_HIST_PCT_COUNT; i++)
+			len += scnprintf(iv->line + len, size - len,
+					 " %s_%s_usec=%llu.%03llu",
+					 name, kio_hist_pct_name[i],
+					 p.pct[i]/1000, p.pct[i]%1000);
+		len += scnprintf(iv->line + len, size - len,
+				 " %s_max_usec=%llu.%03llu",
+				 name, p.max/1000, p.max%1000);
+	}
+
+	len += scnprintf(iv->line + len, size - len, "\n");
+
+	kio_stream_write(iv->line, len);
+}
+
+/* report what each thread did since the last interval */
+static void kio_run_interval(struct kio_run_interval *iv,
+			     struct kio_thread *ths, u32 count)
+{
+	struct kio_hist *delta = iv->hist + (count * KIO_LAT_NR);
+	struct kio_hist *total = delta + KIO_LAT_NR;
+	u64 total_ios = 0, total_bytes = 0;
+	s64 now = ktime_to_ns(ktime_get());
+	char who[20];
+	int i, t;
+
+	memset(total, 0, KIO_LAT_NR * sizeof(*total));
+
+	for (i = 0; i < count; i++) {
+		struct kio_thread *th = &ths[i];
+		u32 completed = atomic_read(&th->completed);
+		u64 bytes = atomic64_read(&th->bytes);
+		u32 ios = completed - th->iv_completed;
+
+		th->iv_completed = completed;
+		bytes -= th->iv_bytes;
+		th->iv_bytes += bytes;
+
+		for (t = 0; t < KIO_LAT_NR; t++) {
+			kio_hist_delta(&delta[t], &th->hist[t], &th->iv_hist[t]);
+			kio_hist_merge(&total[t], &delta[t]);
 		}
+
+		snprintf(who, sizeof(who), "thread=%u", th->index);
+		kio_run_interval_line(iv, now, who, ios, bytes, delta);
+
+		total_ios += ios;
+		total_bytes += bytes;
+	}
+
+	kio_run_interval_line(iv, now, "thread=all", total_ios, total_bytes,
+			      total);
+
+	iv->last = now;
+}
+
+/* sample the totals of all threads; true once in steady state */
+static bool kio_run_steady(struct kio_steady *ss, struct kio_thread *ths,
+			   u32 count, s64 now)
+{
+	u64 ios = 0, lat = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		ios += atomic_read(&ths[i].completed);
+		lat += atomic64_read(&ths[i].hist[KIO_LAT_LAT].sum);
+	}
+
+	return kio_steady_sample(ss, now, ios, lat);
+}
+
+static void kio_run_steady_report(const struct kio_steady *ss)
+{
+	const struct kio_steady_result *r = &ss->res;
+
+	pr_warn("kio: steady state %s after %u.%03u seconds, %u samples of "
+		"%s avg=%llu min=%llu max=%llu range=%u.%02u%% slope=%u.%02u%%\n",
+		r->reached ? "reached" : "not reached",
+		r->msec / MSEC_PER_SEC, r->msec % MSEC_PER_SEC, r->samples,
+		kio_steady_metric_name[r->metric], r->avg, r->min, r->max,
+		r->range_ppm / 10000, (r->range_ppm / 100) % 100,
+		r->slope_ppm / 10000, (r->slope_ppm / 100) % 100);
+}
+
+/* jiffies until a ktime_get() nsec, at least 1 */
+static long kio_run_jiffies_until(s64 when, s64 now)
+{
+	if (when <= now)
+		return 1;
+	return max_t(long, nsecs_to_jiffies(when - now), 1);
+}
+
+/* wait for the run to finish, streaming live stats and checking for
+ * steady state along the way */
+static int kio_run_wait(const struct kio_config *kc, struct kio_thread *ths,
+			wait_queue_head_t *wqh, bool *emergency_stop,
+			bool *replay_finished, struct kio_run_interval *iv,
+			struct kio_run_sync *sync, struct kio_steady *ss)
+{
+	unsigned long deadline;
+	long left, timeout, rc;
+	s64 now;
+
+	/* the clock starts once all threads are ready */
+	rc = wait_event_interruptible(*wqh, READ_ONCE(sync->start)
+				      || *emergency_stop
+				      || READ_ONCE(kio_run_stop_requested));
+	if (rc < 0 || *emergency_stop)
+		return *emergency_stop ? -EINTR : 0;
+
+	/* intervals count from the start barrier, like the threads do, and
+	 * steady state from the end of the ramp, where their windows start */
+	iv->start = iv->last = READ_ONCE(sync->start);
+	smp_rmb();
+	kio_steady_start(ss, sync->ramp_end);
+
+	deadline = jiffies + HZ * (kc->ramp_seconds + kc->runtime_seconds);
+
+	while (!*emergency_stop && !READ_ONCE(*replay_finished)
+	       && !READ_ONCE(kio_run_stop_requested)) {
+		left = (long)(deadline - jiffies);
+		if (left <= 0)
+			break;
+
+		now = ktime_to_ns(ktime_get());
+		timeout = left;
+		if (iv->msec)
+			timeout = min(timeout, kio_run_jiffies_until(
+				iv->last + (s64)iv->msec * NSEC_PER_MSEC, now));
+		if (kio_steady_enabled(ss))
+			timeout = min(timeout,
+				      kio_run_jiffies_until(ss->next, now));
+
+		rc = wait_event_interruptible_timeout(*wqh,
+				*emergency_stop || READ_ONCE(*replay_finished)
+				|| READ_ONCE(kio_run_stop_requested),
+				timeout);
+		if (rc < 0 || *emergency_stop)
+			break;
+
+		now = ktime_to_ns(ktime_get());
+		if (iv->msec && now >= iv->last + (s64)iv->msec * NSEC_PER_MSEC)
+			kio_run_interval(iv, ths, kc->num_threads);
+
+		if (kio_steady_enabled(ss)
+		    && kio_run_steady(ss, ths, kc->num_threads, now))
+			break;
+	}
+
+	return *emergency_stop ? -EINTR : 0;
+}
+
+/* a cpu for an unplaced thread that puts its IOs on the queues of its
+ * device as queue_placement asks, or KIO_CPU_ANY */
+static int kio_thread_queue_cpu(const struct kio_thread *th,
+				const struct kio_config *kc)
+{
+	const struct kio_thread_config *ktc = th->config;
+	enum kio_op op = ktc->read_mix_percent >= 100 ? KIO_OP_READ
+		: KIO_OP_WRITE;
+	unsigned nth = 0, i;
+	int cpu;
+
+	if (kc->queue_placement == KIO_QUEUE_ANY)
+		return KIO_CPU_ANY;
+
+	/* threads bound to a cpu or a node stay there */
+	if (ktc->cpu != KIO_CPU_ANY || ktc->numa_node != NUMA_NO_NODE)
+		return KIO_CPU_ANY;
+
+	/* counted among the unplaced threads on the same target */
+	for (i = 0; i < th->index; i++)
+		nth += kc->threads[i].target == ktc->target
+			&& kc->threads[i].cpu == KIO_CPU_ANY
+			&& kc->threads[i].numa_node == NUMA_NO_NODE;
+
+	cpu = kio_io_dev_queue_cpu(th->tgt, op, ktc->poll, nth,
+				   kc->queue_placement == KIO_QUEUE_SPREAD);
+	return cpu < 0 ? KIO_CPU_ANY : cpu;
+}
+
+/* a cpu for a polled thread that is not bound to one
+ *
+ * A polled thread only polls the queue of its last bio; if it moved to a
+ * cpu that maps to another poll queue, the bios left on the old one would
+ * never be reaped. The nth such thread on a target goes to the nth cpu of
+ * its node, or is spread over the poll queues of its device.
+ */
+static int kio_thread_poll_cpu(const struct kio_thread *th,
+			       const struct kio_config *kc)
+{
+	const struct kio_thread_config *ktc = th->config;
+	const struct cpumask *mask = cpu_online_mask;
+	enum kio_op op = ktc->read_mix_percent >= 100 ? KIO_OP_READ
+		: KIO_OP_WRITE;
+	unsigned nth = 0, nr = 0, i;
+	int cpu;
+
+	for (i = 0; i < th->index; i++)
+		nth += kc->threads[i].target == ktc->target
+			&& kc->threads[i].poll
+			&& kc->threads[i].cpu == KIO_CPU_ANY;
+
+	if (th->nid == NUMA_NO_NODE) {
+		cpu = kio_io_dev_queue_cpu(th->tgt, op, true, nth, true);
+		if (cpu >= 0)
+			return cpu;
+	} else {
+		mask = cpumask_of_node(th->nid);
 	}
-#endif
 
-	pr_info("kio: setup for %u threads, %u seconds\n",
-		kc->num_threads, kc->runtime_seconds);
-	atomic_set(&kio_running, 1);
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		nr++;
+	if (!nr)
+		return raw_smp_processor_id();
+
+	nth %= nr;
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		if (!nth--)
+			break;
+	return cpu;
+}
+
+/* figure out where a thread and its buffers should live */
+static void kio_thread_placement(struct kio_thread *th,
+				 const struct kio_config *kc)
+{
+	const struct kio_thread_config *ktc = th->config;
+
+	th->cpu = ktc->cpu;
+	th->nid = ktc->numa_node;
+
+	if (th->cpu == KIO_CPU_ANY)
+		th->cpu = kio_thread_queue_cpu(th, kc);
+
+	if (th->nid == KIO_NUMA_NODE_AUTO && th->cpu == KIO_CPU_ANY)
+		th->nid = kio_io_dev_numa_node(th->tgt);
+	else if (th->nid < 0 && th->cpu != KIO_CPU_ANY)
+		th->nid = cpu_to_node(th->cpu);
+	else if (th->nid < 0)
+		th->nid = NUMA_NO_NODE;
+
+	if (ktc->poll && th->cpu == KIO_CPU_ANY) {
+		th->cpu = kio_thread_poll_cpu(th, kc);
+		if (th->nid == NUMA_NO_NODE)
+			th->nid = cpu_to_node(th->cpu);
+	}
+}
+
+static struct task_struct *kio_thread_create(struct kio_thread *th,
+					     const struct kio_config *kc)
+{
+	struct task_struct *task;
+
+	kio_thread_placement(th, kc);
+
+	task = kthread_create_on_node(kio_thread_fn, th, th->nid,
+				      "kio[%d]", th->index);
+	if (IS_ERR(task))
+		return task;
+
+	if (th->cpu != KIO_CPU_ANY)
+		kthread_bind(task, th->cpu);
+	else if (th->nid != NUMA_NO_NODE)
+		set_cpus_allowed_ptr(task, cpumask_of_node(th->nid));
+
+	/* woken by kio_run() once all threads are created */
+	return task;
+}
+
+/* run once, and hand back the results; they are only returned on success */
+static int kio_run(const struct kio_config *kc,
+		   struct kio_run_results **resp)
+{
+	int result = 0, i;
+	size_t ths_size;
+	struct kio_thread *ths;
+	struct kio_run_results *res;
+	struct kio_run_interval iv;
+	bool emergency_stop = false, replay_finished = false;
+	atomic_t replay_left = ATOMIC_INIT(0);
+	u32 replay_threads = 0, replay_index = 0;
+	struct kio_run_sync sync = {};
+	bool started = false;
+	struct kio_steady ss;
+
+	pr_info("kio: setup for %u threads, %u seconds after a %u second ramp\n",
+		kc->num_threads, kc->runtime_seconds, kc->ramp_seconds);
 
 	ths_size = kc->num_threads * sizeof(*ths);
 	ths = kzalloc(ths_size, GFP_KERNEL);
 	if (!ths)
 		return -ENOMEM;
 
+	res = kio_run_results_alloc(kc->num_threads);
+	if (!res) {
+		kfree(ths);
+		return -ENOMEM;
+	}
+
+	res->runtime_seconds = kc->runtime_seconds;
+	res->ramp_seconds = kc->ramp_seconds;
+	res->timestamp = ktime_get_real_seconds();
+
+	kio_run_interval_init(&iv, kc, ths);
+
+	atomic_set(&sync.waiting, kc->num_threads);
+	init_waitqueue_head(&sync.wqh);
+	sync.ramp_nsec = (s64)kc->ramp_seconds * NSEC_PER_SEC;
+
+	for (i=0; i<kc->num_threads; i++)
+		replay_threads += !!kc->threads[i].replay;
+	atomic_set(&replay_left, replay_threads);
+
 	for (i=0; i<kc->num_threads; i++) {
 		ths[i].index = i;
 		ths[i].config = &kc->threads[i];
-		ths[i].run_wqh = &wqh;
+		ths[i].tgt = kio_io_target_get(kc->threads[i].target);
+		ths[i].hist = kio_run_results_hist(res, i);
+		ths[i].run_wqh = &kio_run_wqh;
 		ths[i].emergency_stop = &emergency_stop;
+		ths[i].sync = &sync;
+
+		/* replaying threads take turns at the records of the trace */
+		if (ths[i].config->replay) {
+			ths[i].trace = kio_trace_get();
+			ths[i].replay_next = replay_index++;
+			ths[i].replay_stride = replay_threads;
+			ths[i].replay_left = &replay_left;
+			ths[i].replay_finished = &replay_finished;
+		}
+
+		/* a fixed seed repeats the same offsets, directions and data */
+		ths[i].seed = ths[i].config->seed;
+		if (!ths[i].seed)
+			get_random_bytes(&ths[i].seed, sizeof(ths[i].seed));
+		ths[i].gen.config = ths[i].config;
+		ths[i].gen.block_size = kio_io_dev_block_size(ths[i].tgt);
+		kio_rand_seed(&ths[i].gen.rand, ths[i].seed);
+		ths[i].data_seed = kio_rand_u32(&ths[i].gen.rand);
 
-		ths[i].thread = kthread_run(kio_thread_fn, &ths[i], "kio[%d]", i);
+		ths[i].last_cpu = -1;
 
+		ths[i].thread = kio_thread_create(&ths[i], kc);
 
 		if (IS_ERR(ths[i].thread)) {
 			result = PTR_ERR(ths[i].thread);
+			ths[i].thread = NULL;
 			if (i==0) {
+				if (iv.msec)
+					kio_stream_stop(result);
+				kio_run_interval_free(&iv);
+				kio_run_results_free(res);
 				kfree(ths);
 				return result;
 			}
@@ -408,30 +1772,285 @@ int kio_run(const struct kio_config *kc)
 		}
 	}
 
+	/* if a thread could not be created, the others never run */
 	if (!result) {
-		long jiffies = HZ * kc->runtime_seconds;
-		wait_event_interruptible_timeout(wqh, emergency_stop,
-						 jiffies);
-		if (emergency_stop)
-			result = -EINTR;
+		for (i=0; i<kc->num_threads; i++)
+			wake_up_process(ths[i].thread);
+		started = true;
 	}
 
+	kio_steady_init(&ss, &kc->steady);
+
+	if (!result)
+		result = kio_run_wait(kc, ths, &kio_run_wqh, &emergency_stop,
+				      &replay_finished, &iv, &sync, &ss);
+
+	if (!result && kio_steady_enabled(&ss)) {
+		kio_run_steady_report(&ss);
+		res->steady = ss.res;
+	}
+
+	atomic_set(&kio_state, KIO_STATE_STOPPING);
+
+	/* stop them all at once, kthread_stop() waits for each in turn */
+	WRITE_ONCE(sync.stop, true);
+	wake_up_all(&sync.wqh);
+	if (started)
+		for (i=0; i<kc->num_threads; i++)
+			wake_up_process(ths[i].thread);
+
 	for (i=0; i<kc->num_threads; i++) {
 		if (!ths[i].thread)
 			continue;
 		kthread_stop(ths[i].thread);
 	}
 
-	atomic_set(&kio_running, 0);
 	pr_info("kio: stopped threads, result=%d\n", result);
 
 	if (!result) {
 		struct kio_run_stats st = {};
-		for (i=0; i<kc->num_threads; i++)
+		struct kio_hist *total = kio_run_results_hist(res, -1);
+		struct kio_hist *modes;
+		int t, m, polled = 0;
+
+		/* interrupt driven threads first, then polled */
+		modes = kio_hist_alloc(2 * KIO_LAT_NR);
+
+		for (i=0; i<kc->num_threads; i++) {
+			m = !!ths[i].config->poll;
+			polled += m;
+
 			kio_run_stats_thread(&ths[i], &st);
-		kio_run_stats_total(&st);
+			kio_run_results_collect(res, &ths[i]);
+			for (t = 0; t < KIO_LAT_NR; t++) {
+				kio_hist_merge(&total[t], &ths[i].hist[t]);
+				if (modes)
+					kio_hist_merge(&modes[m * KIO_LAT_NR + t],
+						       &ths[i].hist[t]);
+			}
+		}
+		kio_run_stats_total(&st, total);
+		kio_run_stats_targets(ths, kc->num_threads);
+
+		/* show polled and interrupt latency side by side */
+		if (polled && modes) {
+			if (polled < kc->num_threads)
+				kio_run_stats_pct("summary[irq]", &modes[0]);
+			kio_run_stats_pct("summary[poll]", &modes[KIO_LAT_NR]);
+		}
+		kio_hist_free(modes);
+
+		res->result = result;
+		*resp = res;
+		res = NULL;
 	}
 
+	kio_run_results_free(res);
+
+	if (iv.msec)
+		kio_stream_stop(result);
+	kio_run_interval_free(&iv);
+
+	for (i=0; i<kc->num_threads; i++)
+		kfree(ths[i].hctx);
 	kfree(ths);
 	return result;
 }
+
+/* set the swept parameter on every thread for one step */
+static void kio_run_sweep_apply(struct kio_config *step,
+				const struct kio_sweep_plan *plan, u64 value)
+{
+	int i;
+
+	for (i = 0; i < step->num_threads; i++) {
+		struct kio_thread_config *ktc = &step->threads[i];
+
+		switch (plan->param) {
+		case KIO_SWEEP_QUEUE_DEPTH:
+			ktc->queue_depth = value;
+			break;
+		case KIO_SWEEP_RATE_IOPS:
+			ktc->rate_iops = value;
+			break;
+		case KIO_SWEEP_RATE_BPS:
+			ktc->rate_bps = value;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* run every step of the sweep plan, publishing results after each step
+ *
+ * Each step starts from the configured threads with the swept parameter
+ * overridden.  When there is a warm-up, the step is run for that long
+ * first and those results are thrown away, so that each measurement
+ * starts with the device at the new operating point.
+ */
+static int kio_run_sweep(const struct kio_config *kc)
+{
+	const struct kio_sweep_plan *plan = &kc->sweep;
+	struct kio_sweep_results *sr;
+	struct kio_run_results *res;
+	struct kio_config *step;
+	int result = 0, i;
+
+	sr = kio_sweep_results_alloc(plan->nr_steps);
+	step = kzalloc(sizeof(*step), GFP_KERNEL);
+	if (!sr || !step)
+		goto err_nomem;
+
+	step->ramp_seconds = kc->ramp_seconds;
+	step->steady = kc->steady;
+	step->queue_placement = kc->queue_placement;
+	step->stats_interval_msec = kc->stats_interval_msec;
+	step->num_threads = kc->num_threads;
+	step->threads = kmemdup(kc->threads,
+				kc->num_threads * sizeof(*kc->threads),
+				GFP_KERNEL);
+	if (!step->threads)
+		goto err_nomem;
+
+	sr->param = kio_sweep_param_name[plan->param];
+	sr->warmup_seconds = plan->warmup_seconds;
+	sr->runtime_seconds = kc->runtime_seconds;
+
+	/* an empty sweep replaces results from an older sweep */
+	kio_sweep_results_publish(NULL);
+
+	for (i = 0; i < plan->nr_steps; i++) {
+		u64 value = plan->values[i];
+
+		kio_run_sweep_step = i + 1;
+		atomic_set(&kio_state, KIO_STATE_RUNNING);
+
+		pr_info("kio: sweep step %d/%u, %s=%llu\n", i + 1,
+			plan->nr_steps, sr->param, value);
+
+		kio_run_sweep_apply(step, plan, value);
+
+		/* the warm-up runs for as long as it is told to */
+		if (plan->warmup_seconds) {
+			res = NULL;
+			step->runtime_seconds = plan->warmup_seconds;
+			step->steady.metric = KIO_STEADY_NONE;
+			result = kio_run(step, &res);
+			kio_run_results_free(res);
+			if (result || READ_ONCE(kio_run_stop_requested))
+				break;
+		}
+
+		res = NULL;
+		step->runtime_seconds = kc->runtime_seconds;
+		step->steady = kc->steady;
+		result = kio_run(step, &res);
+
+		kio_sweep_results_add(sr, value, result, res);
+		if (res)
+			kio_run_results_publish(res);
+
+		if (result || READ_ONCE(kio_run_stop_requested))
+			break;
+	}
+
+	kio_sweep_results_publish(sr);
+
+	kfree(step->threads);
+	kfree(step);
+	return result;
+
+err_nomem:
+	kfree(step);
+	kio_sweep_results_free(sr);
+	return -ENOMEM;
+}
+
+static void kio_run_work_fn(struct work_struct *work)
+{
+	const struct kio_config *kc = kio_run_config;
+	struct kio_run_results *res = NULL;
+	int result;
+
+	if (kc->stats_interval_msec)
+		kio_stream_reset();
+
+	if (kc->sweep.param) {
+		result = kio_run_sweep(kc);
+	} else {
+		result = kio_run(kc, &res);
+		if (res)
+			kio_run_results_publish(res);
+	}
+
+	kio_run_result = result;
+	kio_run_end_time = ktime_to_ns(ktime_get());
+	smp_wmb();
+	atomic_set(&kio_state, KIO_STATE_DONE);
+
+	pr_info("kio: run done, result=%d\n", result);
+}
+
+int kio_run_start(const struct kio_config *kc)
+{
+	if (kc->exiting)
+		return -ENODEV;
+
+	if (kio_is_running())
+		return -EBUSY;
+
+	kio_run_config = kc;
+	kio_run_result = 0;
+	kio_run_start_time = ktime_to_ns(ktime_get());
+	kio_run_end_time = 0;
+	kio_run_sweep_step = 0;
+	kio_run_sweep_steps = kc->sweep.param ? kc->sweep.nr_steps : 0;
+	WRITE_ONCE(kio_run_stop_requested, false);
+	smp_wmb();
+	atomic_set(&kio_state, KIO_STATE_RUNNING);
+
+	queue_work(system_long_wq, &kio_run_work);
+	return 0;
+}
+
+void kio_run_stop(void)
+{
+	if (!kio_is_running())
+		return;
+
+	WRITE_ONCE(kio_run_stop_requested, true);
+	wake_up_interruptible(&kio_run_wqh);
+}
+
+ssize_t kio_run_status_show(char *buf)
+{
+	int state = atomic_read(&kio_state);
+	s64 now;
+
+	smp_rmb();
+
+	switch (state) {
+	case KIO_STATE_RUNNING:
+	case KIO_STATE_STOPPING:
+		now = ktime_to_ns(ktime_get());
+		if (kio_run_sweep_steps)
+			return sprintf(buf, "%s step=%u/%u elapsed_ms=%lld\n",
+				       kio_state_name[state],
+				       READ_ONCE(kio_run_sweep_step),
+				       kio_run_sweep_steps,
+				       div_s64(now - kio_run_start_time,
+					       NSEC_PER_MSEC));
+		return sprintf(buf, "%s elapsed_ms=%lld\n",
+			       kio_state_name[state],
+			       div_s64(now - kio_run_start_time,
+				       NSEC_PER_MSEC));
+	case KIO_STATE_DONE:
+		return sprintf(buf, "%s result=%d elapsed_ms=%lld\n",
+			       kio_state_name[state], kio_run_result,
+			       div_s64(kio_run_end_time - kio_run_start_time,
+				       NSEC_PER_MSEC));
+	default:
+		return sprintf(buf, "%s\n", kio_state_name[state]);
+	}
+}
@@ -5,7 +5,20 @@
 #include <linux/mutex.h>
 #include <linux/kobject.h>
 
+enum kio_run_state {
+	KIO_STATE_IDLE,                 // nothing has run yet
+	KIO_STATE_RUNNING,              // threads are submitting IO
+	KIO_STATE_STOPPING,             // threads are stopping, stats pending
+	KIO_STATE_DONE,                 // results of the last run available
+};
+
 extern bool kio_is_running(void);
 
 struct kio_config;
-extern int kio_run(const struct kio_config *kc);
+/* start a run in the background, kio_config must not change until done;
+ * called with kc->mutex held, fails with -ENODEV once kc is exiting */
+extern int kio_run_start(const struct kio_config *kc);
+/* ask the current run to stop early, results are still reported */
+extern void kio_run_stop(void);
+extern ssize_t kio_run_status_show(char *buf);
+extern void kio_run_exit(void);
@@ -0,0 +1,115 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+
+#include "kio_steady.h"
+#include "kio_results.h"
+
+const char *kio_steady_metric_name[KIO_STEADY_NR] = {
+	[KIO_STEADY_NONE] = "none",
+	[KIO_STEADY_IOPS] = "iops",
+	[KIO_STEADY_LAT]  = "lat",
+};
+
+void kio_steady_init(struct kio_steady *ss,
+		     const struct kio_steady_plan *plan)
+{
+	memset(ss, 0, sizeof(*ss));
+
+	ss->plan = plan;
+	ss->res.metric = plan->metric;
+}
+
+void kio_steady_start(struct kio_steady *ss, s64 start)
+{
+	ss->start = ss->last = start;
+	ss->next = start + (s64)ss->plan->interval_msec * NSEC_PER_MSEC;
+}
+
+/* part of avg, in ppm, capped */
+static u32 kio_steady_ppm(u64 val, u64 avg)
+{
+	if (!avg)
+		return val ? U32_MAX : 0;
+	return min_t(u64, div64_u64(val * 1000000, avg), U32_MAX);
+}
+
+/* range and slope of the last window, oldest sample first
+ *
+ * With x centered on the middle of the window as d = 2x - (n-1), which
+ * keeps it an integer, the least squares slope is 2 * sum(d*y) / sum(d^2),
+ * and the line moves by (n-1) times that across the window.
+ */
+static bool kio_steady_check(struct kio_steady *ss)
+{
+	const struct kio_steady_plan *plan = ss->plan;
+	struct kio_steady_result *res = &ss->res;
+	const u32 n = plan->window;
+	u64 sum = 0, lo = U64_MAX, hi = 0, den = 0, change;
+	s64 num = 0, d;
+	u32 x, first = res->samples % n;
+
+	for (x = 0; x < n; x++) {
+		u64 y = ss->samples[(first + x) % n];
+
+		sum += y;
+		lo = min(lo, y);
+		hi = max(hi, y);
+
+		d = 2 * (s64)x - (n - 1);
+		num += d * (s64)y;
+		den += d * d;
+	}
+
+	change = div64_u64(2 * (u64)abs(num) * (n - 1), den);
+
+	res->avg = div_u64(sum, n);
+	res->min = lo;
+	res->max = hi;
+	res->range_ppm = kio_steady_ppm(hi - lo, res->avg);
+	res->slope_ppm = kio_steady_ppm(change, res->avg);
+
+	return res->avg
+		&& res->range_ppm <= plan->range_percent * 10000
+		&& res->slope_ppm <= plan->slope_percent * 10000;
+}
+
+bool kio_steady_sample(struct kio_steady *ss, s64 now, u64 ios, u64 lat_total)
+{
+	const struct kio_steady_plan *plan = ss->plan;
+	struct kio_steady_result *res = &ss->res;
+	u64 prev_ios = ss->last_ios, dios, val;
+	s64 dt;
+
+	if (!kio_steady_enabled(ss) || res->reached || now < ss->next)
+		return res->reached;
+
+	dios = ios - ss->last_ios;
+	dt = now - ss->last;
+	if (plan->metric == KIO_STEADY_IOPS)
+		val = kio_run_rate(dios, dt);
+	else
+		val = dios ? div64_u64(lat_total - ss->last_lat, dios) : 0;
+
+	ss->last = now;
+	ss->last_ios = ios;
+	ss->last_lat = lat_total;
+	ss->next = now + (s64)plan->interval_msec * NSEC_PER_MSEC;
+
+	/* nothing was counted before this interval, so it was still ramping
+	 * or starting up for some of it */
+	if (!prev_ios)
+		return false;
+
+	ss->samples[res->samples % plan->window] = val;
+	res->samples++;
+	res->msec = div64_u64(now - ss->start, NSEC_PER_MSEC);
+
+	if (res->samples < plan->window)
+		return false;
+
+	res->reached = kio_steady_check(ss);
+	return res->reached;
+}
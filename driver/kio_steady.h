@@ -0,0 +1,77 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "kio_config.h"
+
+/* steady state detection, to end a run once the device has settled
+ *
+ * While a run is going, the IOs and latency of all threads are sampled
+ * every interval_msec.  Once the last window samples agree, in the style
+ * of the SNIA Performance Test Specification, the run is in steady state
+ * and is stopped:
+ *
+ *  - range: the largest and smallest samples are within range_percent of
+ *    their average,
+ *  - slope: the best fit line across the window moves by no more than
+ *    slope_percent of the average, from its first sample to its last.
+ *
+ * The clock starts when the ramp ends, and samples with the first
+ * completed IO after it, so nothing of the ramp is used.  A run that gets to runtime_seconds without settling is reported
+ * as such.
+ */
+
+enum kio_steady_metric {
+	KIO_STEADY_NONE,                // run for runtime_seconds
+	KIO_STEADY_IOPS,                // IOs per second of all threads
+	KIO_STEADY_LAT,                 // average lat of all IOs, in nsec
+	KIO_STEADY_NR
+};
+
+extern const char *kio_steady_metric_name[KIO_STEADY_NR];
+
+#define KIO_STEADY_DEFAULT_WINDOW        5
+#define KIO_STEADY_DEFAULT_INTERVAL_MSEC 1000
+#define KIO_STEADY_DEFAULT_RANGE_PERCENT 20
+#define KIO_STEADY_DEFAULT_SLOPE_PERCENT 10
+
+/* how the run ended up, for the results */
+struct kio_steady_result {
+	u8 metric;                      // enum kio_steady_metric
+	bool reached;
+	u32 msec;                       // into the run, when reached or stopped
+	u32 samples;                    // taken so far
+	u64 avg;                        // of the last window
+	u64 min;
+	u64 max;
+	u32 range_ppm;                  // max-min, of avg
+	u32 slope_ppm;                  // best fit change across, of avg
+};
+
+struct kio_steady {
+	const struct kio_steady_plan *plan;
+	s64 start;                      // of the measured part of the run
+	s64 next;                       // when the next sample is due
+	s64 last;                       // when the last sample was taken
+	u64 last_ios;                   // totals at the last sample
+	u64 last_lat;
+	u64 samples[KIO_MAX_STEADY_WINDOW]; // ring of the last window
+	struct kio_steady_result res;
+};
+
+/* plan with metric KIO_STEADY_NONE disables sampling */
+extern void kio_steady_init(struct kio_steady *ss,
+			    const struct kio_steady_plan *plan);
+
+/* the measured part of the run starts at the given ktime_get() nsec */
+extern void kio_steady_start(struct kio_steady *ss, s64 start);
+
+/* take a sample from the totals of all threads, if one is due; returns
+ * true once in steady state */
+extern bool kio_steady_sample(struct kio_steady *ss, s64 now,
+			      u64 ios, u64 lat_total);
+
+static inline bool kio_steady_enabled(const struct kio_steady *ss)
+{
+	return ss->plan && ss->plan->metric != KIO_STEADY_NONE;
+}
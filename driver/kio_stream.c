@@ -0,0 +1,160 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/kfifo.h>
+#include <linux/debugfs.h>
+
+#include "kio_compat.h"
+#include "kio_stream.h"
+
+static struct kio_stream {
+	struct mutex mutex;
+	wait_queue_head_t wqh;
+	DECLARE_KFIFO(fifo, char, KIO_STREAM_SIZE);
+	u64 dropped;                    // lines that did not fit
+	struct dentry *dir;
+} kio_stream;
+
+void kio_stream_write(const char *line, size_t len)
+{
+	mutex_lock(&kio_stream.mutex);
+	if (kfifo_avail(&kio_stream.fifo) < len)
+		kio_stream.dropped ++;
+	else
+		kfifo_in(&kio_stream.fifo, line, len);
+	mutex_unlock(&kio_stream.mutex);
+
+	wake_up_interruptible(&kio_stream.wqh);
+}
+
+void kio_stream_reset(void)
+{
+	/* nobody cares about what was left over from the last workload */
+	mutex_lock(&kio_stream.mutex);
+	kfifo_reset(&kio_stream.fifo);
+	mutex_unlock(&kio_stream.mutex);
+}
+
+void kio_stream_start(u32 num_threads, u32 interval_msec)
+{
+	char line[64];
+	size_t len;
+
+	/* the lines of earlier sweep steps may not have been read yet */
+	mutex_lock(&kio_stream.mutex);
+	kio_stream.dropped = 0;
+	mutex_unlock(&kio_stream.mutex);
+
+	len = scnprintf(line, sizeof(line),
+			"start num_threads=%u interval_ms=%u\n",
+			num_threads, interval_msec);
+	kio_stream_write(line, len);
+}
+
+void kio_stream_stop(int result)
+{
+	char line[64];
+	size_t len;
+	u64 dropped;
+
+	mutex_lock(&kio_stream.mutex);
+	dropped = kio_stream.dropped;
+	mutex_unlock(&kio_stream.mutex);
+
+	len = scnprintf(line, sizeof(line), "end result=%d dropped=%llu\n",
+			result, dropped);
+	kio_stream_write(line, len);
+}
+
+static int kio_stream_open(struct inode *inode, struct file *file)
+{
+	/* a new reader only wants to see new runs */
+	mutex_lock(&kio_stream.mutex);
+	kfifo_reset(&kio_stream.fifo);
+	mutex_unlock(&kio_stream.mutex);
+
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t kio_stream_read(struct file *file, char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	unsigned copied;
+	int rc;
+
+	for (;;) {
+		if (mutex_lock_interruptible(&kio_stream.mutex))
+			return -ERESTARTSYS;
+		if (!kfifo_is_empty(&kio_stream.fifo))
+			break;
+		mutex_unlock(&kio_stream.mutex);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		rc = wait_event_interruptible(kio_stream.wqh,
+				!kfifo_is_empty(&kio_stream.fifo));
+		if (rc)
+			return rc;
+	}
+
+	rc = kfifo_to_user(&kio_stream.fifo, ubuf, count, &copied);
+	mutex_unlock(&kio_stream.mutex);
+
+	return rc ?: copied;
+}
+
+static __poll_t kio_stream_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &kio_stream.wqh, wait);
+
+	if (!kfifo_is_empty(&kio_stream.fifo))
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations kio_stream_fops = {
+	.owner = THIS_MODULE,
+	.open = kio_stream_open,
+	.read = kio_stream_read,
+	.poll = kio_stream_poll,
+	.llseek = no_llseek,
+};
+
+int kio_stream_init(void)
+{
+	struct dentry *file;
+
+	mutex_init(&kio_stream.mutex);
+	init_waitqueue_head(&kio_stream.wqh);
+	INIT_KFIFO(kio_stream.fifo);
+
+	/* live stats are optional, runs still report results without them */
+
+	kio_stream.dir = debugfs_create_dir("kio", NULL);
+	if (IS_ERR_OR_NULL(kio_stream.dir)) {
+		pr_warn("kio: debugfs not available, no live stats\n");
+		kio_stream.dir = NULL;
+		return 0;
+	}
+
+	file = debugfs_create_file("stats", 0400, kio_stream.dir, NULL,
+				   &kio_stream_fops);
+	if (IS_ERR_OR_NULL(file)) {
+		pr_warn("kio: failed to create debugfs stats file\n");
+		debugfs_remove_recursive(kio_stream.dir);
+		kio_stream.dir = NULL;
+	}
+
+	return 0;
+}
+
+void kio_stream_exit(void)
+{
+	debugfs_remove_recursive(kio_stream.dir);
+	kio_stream.dir = NULL;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+/* live statistics stream
+ *
+ * While a workload runs, kio_run() writes one text line per thread (and
+ * one for all threads) every stats_interval_msec into a fifo, which is
+ * read from /sys/kernel/debug/kio/stats.  Reads block until there is data
+ * (unless O_NONBLOCK), and the file supports poll().
+ *
+ * Each run, and each step of a sweep, starts with a "start ..." line and
+ * ends with an "end ..." line.  Opening the file, or starting a workload,
+ * discards anything left over.  Lines that do not fit
+ * in the fifo, because nobody is reading, are dropped and counted.  The
+ * stream is meant for a single reader.
+ */
+
+#define KIO_STREAM_SIZE         65536   // power of 2, for kfifo
+#define KIO_STREAM_LINE_MAX     1024
+
+extern int kio_stream_init(void);
+extern void kio_stream_exit(void);
+
+extern void kio_stream_reset(void);
+extern void kio_stream_start(u32 num_threads, u32 interval_msec);
+extern void kio_stream_write(const char *line, size_t len);
+extern void kio_stream_stop(int result);
@@ -0,0 +1,155 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/bug.h>
+
+#include "kio_trace.h"
+
+const char *kio_replay_mode_name[KIO_REPLAY_NR] = {
+	[KIO_REPLAY_OFF]   = "off",
+	[KIO_REPLAY_TIMED] = "timed",
+	[KIO_REPLAY_FAST]  = "fast",
+};
+
+static struct kio_trace *kio_trace;             // complete, can be replayed
+static struct kio_trace *kio_trace_loading;     // still being written
+static size_t kio_trace_received;               // bytes of records so far
+
+static void kio_trace_discard(struct kio_trace **tp)
+{
+	vfree(*tp);
+	*tp = NULL;
+}
+
+/* records were copied in as they came, convert and check them in place */
+static int kio_trace_finish(struct kio_trace *t)
+{
+	u64 i;
+
+	for (i = 0; i < t->nr; i++) {
+		const struct kio_trace_rec *rec = (void *)&t->ios[i];
+		struct kio_trace_io *io = &t->ios[i];
+		u64 time = le64_to_cpu(rec->time);
+		u64 offset = le64_to_cpu(rec->offset);
+		u32 len = le32_to_cpu(rec->len);
+		u32 flags = le32_to_cpu(rec->flags);
+
+		if (!len || len % 512 || len > KIO_TRACE_MAX_LEN
+		    || offset % 512) {
+			pr_warn("kio: trace record %llu offset %llu len %u "
+				"is not in whole sectors of at most %u bytes\n",
+				i, offset, len, KIO_TRACE_MAX_LEN);
+			return -EINVAL;
+		}
+
+		io->time = time;
+		io->offset = offset;
+		io->len = len;
+		io->flags = flags;
+
+		t->duration = max(t->duration, time);
+		t->max_len = max(t->max_len, len);
+		t->len_bits |= len | (u32)offset;
+		t->flag_bits |= flags;
+	}
+
+	return 0;
+}
+
+ssize_t kio_trace_write(const char *buf, loff_t off, size_t count)
+{
+	const size_t hdr_size = sizeof(struct kio_trace_hdr);
+	const ssize_t written = count;
+	struct kio_trace_hdr hdr;
+	struct kio_trace *t;
+	size_t total, pos;
+	int rc;
+
+	BUILD_BUG_ON(sizeof(struct kio_trace_rec)
+		     != sizeof(struct kio_trace_io));
+
+	if (!off) {
+		/* a new header always starts over */
+		kio_trace_discard(&kio_trace_loading);
+
+		if (count < hdr_size)
+			return -EINVAL;
+		memcpy(&hdr, buf, hdr_size);
+
+		if (le32_to_cpu(hdr.magic) != KIO_TRACE_MAGIC
+		    || le32_to_cpu(hdr.version) != KIO_TRACE_VERSION) {
+			pr_warn("kio: trace has bad magic or version %u\n",
+				le32_to_cpu(hdr.version));
+			return -EINVAL;
+		}
+
+		if (le64_to_cpu(hdr.nr) > KIO_TRACE_MAX_IOS) {
+			pr_warn("kio: trace of %llu IOs is over the limit of %u\n",
+				le64_to_cpu(hdr.nr), KIO_TRACE_MAX_IOS);
+			return -E2BIG;
+		}
+
+		kio_trace_discard(&kio_trace);
+		if (!hdr.nr) {
+			pr_info("kio: trace unloaded\n");
+			return written;
+		}
+
+		t = vzalloc(sizeof(*t) + le64_to_cpu(hdr.nr) * sizeof(t->ios[0]));
+		if (!t)
+			return -ENOMEM;
+		t->nr = le64_to_cpu(hdr.nr);
+
+		kio_trace_loading = t;
+		kio_trace_received = 0;
+
+		buf += hdr_size;
+		off += hdr_size;
+		count -= hdr_size;
+	}
+
+	t = kio_trace_loading;
+	if (!t)
+		return -EINVAL;
+
+	/* the rest of the blob has to come in order */
+	pos = off - hdr_size;
+	total = t->nr * sizeof(t->ios[0]);
+	if (pos != kio_trace_received || count > total - pos) {
+		kio_trace_discard(&kio_trace_loading);
+		return -EINVAL;
+	}
+
+	memcpy((char *)t->ios + pos, buf, count);
+	kio_trace_received += count;
+
+	if (kio_trace_received == total) {
+		kio_trace_loading = NULL;
+
+		rc = kio_trace_finish(t);
+		if (rc < 0) {
+			vfree(t);
+			return rc;
+		}
+
+		kio_trace = t;
+		pr_info("kio: trace loaded, %llu IOs over %llu.%03llu seconds\n",
+			t->nr, t->duration / NSEC_PER_SEC,
+			(t->duration % NSEC_PER_SEC) / NSEC_PER_MSEC);
+	}
+
+	return written;
+}
+
+const struct kio_trace *kio_trace_get(void)
+{
+	return kio_trace;
+}
+
+void kio_trace_exit(void)
+{
+	kio_trace_discard(&kio_trace_loading);
+	kio_trace_discard(&kio_trace);
+}
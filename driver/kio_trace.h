@@ -0,0 +1,76 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+/* recorded block traces, for replay
+ *
+ * A trace is loaded by writing a blob to the write-only trace attribute:
+ * a struct kio_trace_hdr followed by nr struct kio_trace_rec, all little
+ * endian (kio.py makes one from blkparse output).  The blob can be written
+ * in any number of chunks, in order.  The trace can be used once all of
+ * its records are in, and writing a header with nr 0 unloads it.
+ *
+ * Threads with replay set share the trace: with N of them, the j-th one
+ * issues records j, j+N, j+2N, ...  In timed mode a record is issued at
+ * its time since the thread started, and lat is measured from that time,
+ * as with rate_iops.  In fast mode records are issued as soon as there is
+ * room in the queue.  Offsets are relative to offset_low, and wrap to stay
+ * below offset_high.  A thread stops when it runs out of records.
+ */
+
+#define KIO_TRACE_MAGIC         0x6b696f74      // "kiot"
+#define KIO_TRACE_VERSION       1
+#define KIO_TRACE_MAX_IOS       (4 << 20)       // 96MiB of records
+#define KIO_TRACE_MAX_LEN       (1 << 20)       // same as block_size
+
+#define KIO_TRACE_WRITE         0x1
+#define KIO_TRACE_DISCARD       0x2
+#define KIO_TRACE_FUA           0x4     // with KIO_TRACE_WRITE
+
+struct kio_trace_hdr {
+	__le32 magic;
+	__le32 version;
+	__le64 nr;                      // records that follow
+};
+
+struct kio_trace_rec {
+	__le64 time;                    // nsec since the start of the trace
+	__le64 offset;                  // bytes
+	__le32 len;                     // bytes
+	__le32 flags;                   // KIO_TRACE_*
+};
+
+/* a record once loaded, in cpu byte order */
+struct kio_trace_io {
+	u64 time;
+	u64 offset;
+	u32 len;
+	u32 flags;
+};
+
+struct kio_trace {
+	u64 nr;
+	u64 duration;                   // time of the last record
+	u32 max_len;
+	u32 len_bits;                   // all lens or'ed, for alignment checks
+	u32 flag_bits;                  // all flags or'ed
+	struct kio_trace_io ios[];
+};
+
+enum kio_replay_mode {
+	KIO_REPLAY_OFF,                 // generate IOs from the config
+	KIO_REPLAY_TIMED,               // issue at the recorded times
+	KIO_REPLAY_FAST,                // issue as fast as the queue allows
+	KIO_REPLAY_NR
+};
+
+extern const char *kio_replay_mode_name[KIO_REPLAY_NR];
+
+/* called with the config mutex held, and never during a run, so a run
+ * can use the trace without locks */
+extern ssize_t kio_trace_write(const char *buf, loff_t off, size_t count);
+
+/* the loaded trace, or NULL */
+extern const struct kio_trace *kio_trace_get(void);
+
+extern void kio_trace_exit(void);
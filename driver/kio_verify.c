@@ -0,0 +1,131 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/highmem.h>
+#include <linux/crc32c.h>
+
+#include "kio_verify.h"
+
+#define KIO_VERIFY_CRC_START offsetof(struct kio_verify_hdr, offset)
+
+/* chunks never straddle a page, block sizes are powers of 2 */
+static inline unsigned kio_verify_chunk(unsigned chunk)
+{
+	return min_t(unsigned, chunk, PAGE_SIZE);
+}
+
+static inline void *kio_verify_map(const struct kio_buf *buf, unsigned pos)
+{
+	return kmap_atomic(buf->pages[pos >> PAGE_SHIFT])
+		+ (pos & ~PAGE_MASK);
+}
+
+static inline u32 kio_verify_crc(const void *data, unsigned chunk)
+{
+	return crc32c(~0, data + KIO_VERIFY_CRC_START,
+		      chunk - KIO_VERIFY_CRC_START);
+}
+
+/* xorshift64, cheap enough to not dominate the cost of a write */
+static void kio_verify_payload(u64 *p, unsigned words, u64 state)
+{
+	state |= 1;
+
+	while (words--) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		*p++ = state;
+	}
+}
+
+void kio_verify_fill(struct kio_buf *buf, u64 offset, unsigned chunk,
+		     u32 seed, u64 generation, u32 thread)
+{
+	struct kio_verify_hdr *hdr;
+	unsigned pos;
+	void *data;
+
+	chunk = kio_verify_chunk(chunk);
+
+	for (pos = 0; pos + chunk <= buf->len; pos += chunk) {
+		data = kio_verify_map(buf, pos);
+		hdr = data;
+
+		kio_verify_payload(data + sizeof(*hdr),
+				   (chunk - sizeof(*hdr)) / sizeof(u64),
+				   ((u64)seed << 32) ^ (offset + pos)
+				   ^ (generation * 0x9e3779b97f4a7c15ULL));
+
+		hdr->magic = cpu_to_le32(KIO_VERIFY_MAGIC);
+		hdr->offset = cpu_to_le64(offset + pos);
+		hdr->generation = cpu_to_le64(generation);
+		hdr->seed = cpu_to_le32(seed);
+		hdr->thread = cpu_to_le32(thread);
+		hdr->len = cpu_to_le32(chunk);
+		hdr->reserved = 0;
+		hdr->crc = cpu_to_le32(kio_verify_crc(data, chunk));
+
+		kunmap_atomic(data);
+	}
+}
+
+/* so that stale headers from the last IO in the buffer are not checked */
+void kio_verify_clear(struct kio_buf *buf, unsigned chunk)
+{
+	struct kio_verify_hdr *hdr;
+	unsigned pos;
+
+	chunk = kio_verify_chunk(chunk);
+
+	for (pos = 0; pos + chunk <= buf->len; pos += chunk) {
+		hdr = kio_verify_map(buf, pos);
+		hdr->magic = 0;
+		kunmap_atomic(hdr);
+	}
+}
+
+void kio_verify_check(const struct kio_buf *buf, u64 offset, unsigned chunk,
+		      struct kio_verify_result *vr)
+{
+	const struct kio_verify_hdr *hdr;
+	unsigned pos;
+	u32 crc;
+
+	chunk = kio_verify_chunk(chunk);
+
+	for (pos = 0; pos + chunk <= buf->len; pos += chunk) {
+		hdr = kio_verify_map(buf, pos);
+
+		if (le32_to_cpu(hdr->magic) != KIO_VERIFY_MAGIC) {
+			vr->unwritten++;
+			goto next;
+		}
+
+		vr->checked++;
+
+		if (le64_to_cpu(hdr->offset) != offset + pos
+		    || le32_to_cpu(hdr->len) != chunk) {
+			vr->errors++;
+			pr_warn_ratelimited("kio: verify: chunk at %llu has "
+				"offset %llu len %u, written by thread %u "
+				"generation %llu\n", offset + pos,
+				le64_to_cpu(hdr->offset), le32_to_cpu(hdr->len),
+				le32_to_cpu(hdr->thread),
+				le64_to_cpu(hdr->generation));
+			goto next;
+		}
+
+		crc = kio_verify_crc(hdr, chunk);
+		if (crc != le32_to_cpu(hdr->crc)) {
+			vr->errors++;
+			pr_warn_ratelimited("kio: verify: chunk at %llu has "
+				"crc32c %08x, expected %08x, written by thread "
+				"%u generation %llu\n", offset + pos, crc,
+				le32_to_cpu(hdr->crc), le32_to_cpu(hdr->thread),
+				le64_to_cpu(hdr->generation));
+		}
+next:
+		kunmap_atomic((void *)hdr);
+	}
+}
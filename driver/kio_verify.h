@@ -0,0 +1,47 @@
+#pragma once
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "kio_pool.h"
+
+/* data verification
+ *
+ * In verify mode every chunk (a device logical block, at most a page) of
+ * a write starts with a header, followed by a pseudo-random payload.  The
+ * header records where the chunk was meant to land, and carries a crc32c
+ * of the rest of the chunk.  Reads check each chunk they bring back:
+ *
+ *  - no magic: the chunk was never written in verify mode, it is counted
+ *    as unwritten and not checked,
+ *  - wrong offset: the chunk landed (or was read from) the wrong place,
+ *  - wrong crc: the contents are corrupt.
+ *
+ * crc32c goes through the kernel crypto library, so it uses the CPU's
+ * crc32 instructions where available.
+ */
+
+#define KIO_VERIFY_MAGIC        0x6b696f76      // "kiov"
+
+struct kio_verify_hdr {
+	__le32 magic;
+	__le32 crc;                     // of the chunk after this field
+	__le64 offset;                  // device byte offset of the chunk
+	__le64 generation;              // writes done by the thread so far
+	__le32 seed;                    // of the payload
+	__le32 thread;
+	__le32 len;                     // of the chunk
+	__le32 reserved;                // keeps the payload 8 byte aligned
+};
+
+/* what kio_verify_check() found, in chunks */
+struct kio_verify_result {
+	u32 checked;
+	u32 unwritten;
+	u32 errors;
+};
+
+extern void kio_verify_fill(struct kio_buf *buf, u64 offset, unsigned chunk,
+			    u32 seed, u64 generation, u32 thread);
+extern void kio_verify_clear(struct kio_buf *buf, unsigned chunk);
+extern void kio_verify_check(const struct kio_buf *buf, u64 offset,
+			     unsigned chunk, struct kio_verify_result *vr);
@@ -1,45 +1,331 @@
 #!/usr/bin/python3
 import os
-import re
 import sys
 import csv
+import json
 import yaml
+import time
 import socket
+import select
+import struct
 import argparse
 import textwrap
+import threading
 import subprocess
 from datetime import datetime
 from collections import namedtuple
 
-Results = namedtuple('Results', 'lines summary threads')
+Results = namedtuple('Results', 'raw summary threads targets intervals sweep')
+
+RESULTS_VERSION = 1
+
+PERCENTILES = ['p50', 'p90', 'p99', 'p99.9', 'p99.99', 'max']
+PERCENTILES_PPM = [500000, 900000, 990000, 999000, 999900]
+
+URING_BINARY = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            'uring', 'kio-uring')
+
+TRACE_MAGIC = 0x6b696f74
+TRACE_VERSION = 1
+TRACE_WRITE = 0x1
+TRACE_DISCARD = 0x2
+TRACE_FUA = 0x4
 
 def divider(name):
     print('--------------------------------------------------------------')
     print(f'{name}...')
 
-class Dmesg:
-    def read():
-        result = subprocess.run(['dmesg'], stdout=subprocess.PIPE, universal_newlines=True)
-        return result.stdout.rstrip().split('\n')
-
-    def last_timestamp():
-        last_line = Dmesg.read()[-1]
-        match = re.search(r'\[\s*([0-9.]+)\s*\]', last_line)
-        if not match:
-            return None
-        return match.group(1)
-
-    def lines_since(start):
-        lines = Dmesg.read()
-        last_match_index = None
-        for i,line in enumerate(lines):
-            if re.search(f'{start}', line):
-                last_match_index = i
+def parse_blkparse(path, action='Q'):
+    """(nsec, offset, len, flags) of reads, writes and discards in blkparse output
+
+    Only events of one action are used, Q (queued) by default, so that each
+    IO is counted once; use D (issued) to replay what the device saw.
+    Times are relative to the first IO.
+    """
+    ios = []
+    start = None
+    with open(path, 'r') as f:
+        for line in f:
+            # dev cpu seq time pid action rwbs sector + sectors [process]
+            fields = line.split()
+            if len(fields) < 10 or fields[5] != action or fields[8] != '+':
+                continue
+            # F before the op is a preflush, after a write it is FUA
+            rwbs = fields[6]
+            if 'D' in rwbs:
+                flags = TRACE_DISCARD
+            elif 'W' in rwbs:
+                flags = TRACE_WRITE
+                if 'F' in rwbs[rwbs.index('W'):]:
+                    flags |= TRACE_FUA
+            elif 'R' in rwbs:
+                flags = 0
+            else:
+                continue
+            try:
+                t = int(float(fields[3]) * 1000000000)
+                sector, sectors = int(fields[7]), int(fields[9])
+            except ValueError:
+                continue
+            if not sectors:
+                continue
+            if start is None:
+                start = t
+            ios.append((t - start, sector * 512, sectors * 512, flags))
+    return ios
+
+def pack_trace(ios):
+    """the blob that the trace attribute takes"""
+    blob = [ struct.pack('<IIQ', TRACE_MAGIC, TRACE_VERSION, len(ios)) ]
+    for t,offset,length,flags in ios:
+        blob.append(struct.pack('<QQII', max(t, 0), offset, length, flags))
+    return b''.join(blob)
+
+class StatsStream(threading.Thread):
+    """reads live stats from debugfs while a run is going"""
+
+    path = '/sys/kernel/debug/kio/stats'
+
+    def __init__(self, im_root, callback=None, runs=1):
+        super().__init__(daemon=True)
+        self.callback = callback
+        self.runs = runs
+        self.run_index = -1
+        self.intervals = []
+        self.stopping = threading.Event()
+        self.proc = None
+        if im_root:
+            self.fd = os.open(self.path, os.O_RDONLY | os.O_NONBLOCK)
+        else:
+            self.proc = subprocess.Popen(['sudo', 'cat', self.path],
+                    stdout=subprocess.PIPE)
+            self.fd = self.proc.stdout.fileno()
+            os.set_blocking(self.fd, False)
+
+    def parse(self, line):
+        fields = line.split()
+        if not fields:
+            return True
+        if fields[0] == 'start':
+            self.run_index += 1
+            return True
+        if fields[0] == 'end':
+            # a sweep runs several times, each with its own start/end
+            return self.run_index + 1 < self.runs
+        entry = dict()
+        if self.runs > 1:
+            entry['run'] = self.run_index
+        for kv in fields:
+            k,v = kv.split('=', 1)
+            try:
+                entry[k] = int(v)
+            except ValueError:
+                try:
+                    entry[k] = float(v)
+                except ValueError:
+                    entry[k] = v
+        self.intervals.append(entry)
+        if self.callback:
+            self.callback(entry)
+        return True
 
-        if last_match_index is None:
-            return lines
+    def run(self):
+        poller = select.poll()
+        poller.register(self.fd, select.POLLIN)
+        partial = ''
+        running = True
+        while running and not self.stopping.is_set():
+            if not poller.poll(200):
+                continue
+            try:
+                data = os.read(self.fd, 65536)
+            except BlockingIOError:
+                continue
+            if not data:
+                break
+            partial += data.decode()
+            *lines, partial = partial.split('\n')
+            for line in lines:
+                running = self.parse(line) and running
+
+    def stop(self, timeout=2):
+        self.join(timeout)
+        self.stopping.set()
+        self.join()
+        if self.proc:
+            self.proc.kill()
+            self.proc.wait()
+        else:
+            os.close(self.fd)
 
-        return lines[last_match_index+1:]
+def hist_percentiles(buckets, count, maxv):
+    """same as kio_hist_percentiles(), on results.json buckets, in nsec"""
+    res = dict.fromkeys(PERCENTILES, 0)
+    if not count:
+        return res
+    want = [max(1, -(-count * ppm // 1000000)) for ppm in PERCENTILES_PPM]
+    cumulative = 0
+    p = 0
+    for low,width,cnt in buckets:
+        cumulative += cnt
+        while p < len(want) and cumulative >= want[p]:
+            res[PERCENTILES[p]] = min(low + width // 2, maxv)
+            p += 1
+    for q in range(p, len(want)):
+        res[PERCENTILES[q]] = maxv
+    res['max'] = maxv
+    return res
+
+def merge_latency(entries):
+    """percentiles of the histograms of several threads, in nsec"""
+    res = dict()
+    for t in entries[0]['latency']:
+        buckets = dict()
+        count = 0
+        maxv = 0
+        for e in entries:
+            lat = e['latency'][t]
+            count += lat['count']
+            maxv = max(maxv, lat['max_ns'])
+            for low,width,cnt in lat['buckets']:
+                buckets[(low,width)] = buckets.get((low,width), 0) + cnt
+        merged = [[low,width,cnt] for (low,width),cnt in sorted(buckets.items())]
+        res[t] = hist_percentiles(merged, count, maxv)
+    return res
+
+def entry_results(e):
+    """thread or summary results, from raw nsec counters"""
+    cnt = e['completed']
+    runtime = e['runtime_ns']
+    slat = e['slat_total_ns'] / cnt / 1000 if cnt else 0
+    clat = e['clat_total_ns'] / cnt / 1000 if cnt else 0
+    res = {
+            'completed': cnt,
+            'lat_usec': slat + clat,
+            'slat_usec': slat,
+            'clat_usec': clat,
+            'iops': cnt * 1e9 / runtime if runtime else 0,
+            'bw_MBps': e['bytes'] * 1e3 / runtime if runtime else 0,
+            'verified': e.get('verified', 0),
+            'unwritten': e.get('unwritten', 0),
+            'verify_errors': e.get('verify_errors', 0) }
+    for t,lat in e['latency'].items():
+        for p in PERCENTILES:
+            res[f'{t}_{p}_usec'] = lat[f'{p}_ns'] / 1000
+    res.update(op_results(e))
+    res.update(coverage_results(e.get('coverage', [])))
+    return res
+
+def steady_results(e):
+    """how a run checked for steady state ended, if it was"""
+    ss = e.get('steady_state')
+    if not ss:
+        return {}
+    return {
+            'steady_state_reached': ss['reached'],
+            'steady_state_sec': ss['msec'] / 1000,
+            'steady_state_samples': ss['samples'],
+            f'steady_state_{ss["metric"]}_avg': ss['avg'],
+            'steady_state_range_pct': ss['range_ppm'] / 10000,
+            'steady_state_slope_pct': ss['slope_ppm'] / 10000 }
+
+def check_summary(raw, summary):
+    """the summary has to account for every IO of the threads, and its rates
+    have to agree with theirs; warn if not, the numbers are still reported"""
+    ths = raw['threads']
+    errors = []
+
+    completed = sum(th['completed'] for th in ths)
+    if summary['completed'] != completed:
+        errors.append(f'completed={summary["completed"]}, threads add up to {completed}')
+
+    # no more than all threads at full speed, and no less than that scaled
+    # down by how much shorter the shortest thread was
+    runtimes = [th['runtime_ns'] for th in ths]
+    scale = min(runtimes) / max(runtimes) if max(runtimes) else 1
+    for rate in ('iops', 'bw_MBps'):
+        total = summary[f'{rate}_thread_sum']
+        slack = total / 1000 + len(ths)
+        if not total * scale - slack <= summary[rate] <= total + slack:
+            errors.append(f'{rate}={summary[rate]:.3f}, threads add up to {total:.3f}')
+
+    for e in errors:
+        print(f'WARNING: summary self-check failed: {e}', file=sys.stderr)
+    return not errors
+
+def op_results(e):
+    """the same for each op (read, write, ...), so mixes can be told apart"""
+    runtime = e['runtime_ns']
+    res = {}
+    for op,c in e.get('ops', {}).items():
+        cnt = c['completed']
+        slat = c['slat_total_ns'] / cnt / 1000 if cnt else 0
+        clat = c['clat_total_ns'] / cnt / 1000 if cnt else 0
+        res[f'{op}_completed'] = cnt
+        res[f'{op}_iops'] = cnt * 1e9 / runtime if runtime else 0
+        res[f'{op}_bw_MBps'] = c['bytes'] * 1e3 / runtime if runtime else 0
+        res[f'{op}_lat_usec'] = slat + clat
+        res[f'{op}_slat_usec'] = slat
+        res[f'{op}_clat_usec'] = clat
+    return res
+
+def coverage_results(coverage):
+    """share of IOs in the hottest 1% and 10% of the offset range"""
+    total = sum(coverage)
+    hot = sorted(coverage, reverse=True)
+    return {
+            'coverage_touched_pct': sum(1 for c in coverage if c) * 100 / len(coverage) if coverage else 0,
+            'coverage_hot1_pct': hot[0] * 100 / total if total else 0,
+            'coverage_hot10_pct': sum(hot[:len(hot)//10]) * 100 / total if total else 0 }
+
+def hctx_results(ths):
+    """how IOs spread over the hardware queues of the devices, from the
+    per thread hctx counters; none for engines that do not keep them"""
+    if not any('hctx' in th for th in ths):
+        return {}
+    queues = dict()
+    remote = 0
+    for th in ths:
+        for q in th.get('hctx', []):
+            key = (th['target'], q['index'])
+            queues[key] = queues.get(key, 0) + q['completed']
+            remote += q['remote']
+    total = sum(queues.values())
+    return {
+            'hctx_used': len(queues),
+            'hctx_busiest_pct': max(queues.values()) * 100 / total if total else 0,
+            'hctx_remote_pct': remote * 100 / total if total else 0,
+            'cpu_migrations': sum(th.get('cpu_migrations', 0) for th in ths) }
+
+def knee_index(steps):
+    """step with the most IOPS per usec of p99 lat, where the curve bends"""
+    best = None
+    for i,st in enumerate(steps):
+        lat = st.get('lat_p99_usec') or 0
+        if not lat:
+            continue
+        power = st['iops'] / lat
+        if best is None or power > best[0]:
+            best = (power, i)
+    return best[1] if best else None
+
+def plot_curve(steps, knee, width=60, height=16):
+    """ASCII plot of p99 lat against IOPS, one digit/letter per step"""
+    marks = '0123456789abcdefghijklmnopqrstuvwxyz'
+    points = [(st['iops'], st['lat_p99_usec']) for st in steps]
+    if not points:
+        return
+    max_x = max(x for x,y in points) or 1
+    max_y = max(y for x,y in points) or 1
+    grid = [[' '] * (width + 1) for _ in range(height + 1)]
+    for i,(x,y) in enumerate(points):
+        col = int(x * width / max_x)
+        row = height - int(y * height / max_y)
+        grid[row][col] = '*' if i == knee else marks[i % len(marks)]
+    print(f'p99 lat_usec (max {max_y:.1f})')
+    for row in grid:
+        print('  |' + ''.join(row))
+    print('  +' + '-' * (width + 1) + f' iops (max {max_x:.0f})')
 
 def read_kio_version():
     with open('/sys/module/kio/version', 'r') as f:
@@ -52,11 +338,19 @@ class Kio():
         self.num_threads = num_threads
         self.runtime_seconds = runtime_seconds
 
-        self.conf_names = ['num_threads', 'runtime_seconds']
+        self.conf_names = ['num_threads', 'runtime_seconds', 'ramp_seconds',
+                'stats_interval_msec', 'sweep', 'steady_state',
+                'queue_placement']
         self.thread_names = ['block_size', 'burst_delay', 'burst_finish',
                 'offset_high', 'offset_low', 'offset_random', 'offset_stride',
                 'queue_depth', 'read_burst', 'read_mix_percent',
-                'read_sleep_usec', 'write_burst', 'write_sleep_usec']
+                'read_sleep_usec', 'write_burst', 'write_sleep_usec',
+                'submit_batch', 'poll', 'cpu', 'numa_node', 'target',
+                'rate_iops', 'rate_bps', 'verify', 'data_pattern',
+                'compress_percent', 'dedup_percent', 'offset_dist',
+                'offset_dist_param', 'hot_io_percent', 'seed', 'replay',
+                'fua_percent', 'discard_percent', 'write_zeroes_percent',
+                'flush_percent']
 
         cur = self.read('num_threads')
         #print(f"cur={cur} new={num_threads}")
@@ -80,6 +374,23 @@ class Kio():
             res[k] = self.read(k)
         return res
 
+    def get_targets(self):
+        res = {}
+        path = self.conf_file('targets')
+        if not os.path.exists(path):
+            return res
+        with open(path, 'r') as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) >= 2:
+                    res[int(fields[0])] = fields[1]
+        return res
+
+    def add_target(self, dev):
+        if dev in self.get_targets().values():
+            return
+        self.write('add_target', dev)
+
     def get_thread_config(self, tid):
         res = {}
         for k in self.thread_names:
@@ -100,6 +411,7 @@ class Kio():
 
         result = {
             'global': conf,
+            'targets': self.get_targets(),
             'threads': threads
         }
 
@@ -135,58 +447,203 @@ class Kio():
             subprocess.run(['sudo', 'sh' , '-c',
                 f'echo {value} > {path}'], check=True)
 
+    def status(self):
+        """state of the driver, and key=value details"""
+        fields = str(self.read('status') or 'idle').split()
+        res = { 'state': fields[0] }
+        for kv in fields[1:]:
+            k,v = kv.split('=', 1)
+            res[k] = int(v)
+        return res
+
+    def set_sweep(self, plan, warmup=None):
+        """plan is param=values, or none to run once"""
+        if not plan or plan == 'none':
+            self.write('sweep', 'none')
+            return
+        if warmup is not None:
+            plan = f'{plan} warmup={warmup}'
+        self.write('sweep', plan)
+
+    def sweep_runs(self):
+        """number of runs the kernel does for the current sweep plan"""
+        plan = str(self.read('sweep') or 'none').split()
+        if plan[0] == 'none':
+            return 1
+        param,values = plan[0].split('=', 1)
+        warmup = 0
+        for kv in plan[1:]:
+            k,v = kv.split('=', 1)
+            if k == 'warmup':
+                warmup = int(v)
+        return len(values.split(',')) * (2 if warmup else 1)
+
+    def load_trace(self, ios):
+        """load IOs from parse_blkparse() for threads to replay"""
+        blob = pack_trace(ios)
+        path = self.conf_file('trace')
+        if self.im_root:
+            with open(path, 'wb') as f:
+                f.write(blob)
+        else:
+            subprocess.run(['sudo', 'tee', path], input=blob,
+                    stdout=subprocess.DEVNULL, check=True)
+
+    def stop(self):
+        self.write('stop', 1)
+
+    def wait(self):
+        """wait for the run started by run_workload to be done"""
+        try:
+            while True:
+                status = self.status()
+                if status['state'] in ['done', 'idle']:
+                    return status
+                time.sleep(0.1)
+        except KeyboardInterrupt:
+            print('stopping run...')
+            self.stop()
+            while self.status()['state'] != 'done':
+                time.sleep(0.1)
+            raise
+
     def configure(self, *configs):
         for config in configs:
             pass
 
-    def run(self):
-        start = Dmesg.last_timestamp()
-        self.write('run_workload', 1);
-        lines = Dmesg.lines_since(start)
-
-        if len(lines) < 1:
-            raise ValueError('did not find any data in dmesg output')
-
-        return self.parse_results(lines)
+    def run(self, on_interval=None):
+        runs = self.sweep_runs()
+        stream = None
+        if self.read('stats_interval_msec'):
+            stream = StatsStream(self.im_root, on_interval, runs)
+            stream.start()
+
+        try:
+            self.write('run_workload', 1);
+            status = self.wait()
+        finally:
+            if stream:
+                stream.stop()
+
+        if status.get('result', 0) != 0:
+            raise RuntimeError(f"run failed with {status['result']}")
+
+        with open(self.conf_file('results.json'), 'r') as f:
+            raw = json.load(f)
+
+        if raw.get('version') != RESULTS_VERSION:
+            raise ValueError(f"unsupported results version {raw.get('version')}")
+
+        results = self.parse_results(raw)
+        if stream:
+            results = results._replace(intervals=stream.intervals)
+        if runs > 1:
+            results = results._replace(sweep=self.read_sweep_results())
+        return results
 
-    def parse_results(self, lines):
-        summary = None
+    def run_uring(self, binary=URING_BINARY):
+        """run the configured workload from user space, with io_uring"""
+        conf = self.get_config()
+        g = conf['global']
+        if self.sweep_runs() > 1 or str(g.get('steady_state') or 'none') != 'none':
+            raise ValueError('sweeps and steady state are only run by the module')
+        if str(g.get('queue_placement') or 'any') != 'any':
+            raise ValueError('queue placement is only done by the module')
+
+        cmd = [binary, f"num_threads={g['num_threads']}",
+               f"runtime_seconds={g['runtime_seconds']}",
+               f"ramp_seconds={g.get('ramp_seconds') or 0}"]
+        for idx,dev in sorted(conf['targets'].items()):
+            cmd.append(f'targets/{idx}={dev}')
+        for tid,tconf in sorted(conf['threads'].items()):
+            for k,v in tconf.items():
+                if v is not None:
+                    cmd.append(f'{tid}/{k}={v}')
+        if not self.im_root:
+            cmd = ['sudo'] + cmd
+
+        out = subprocess.run(cmd, check=True, stdout=subprocess.PIPE)
+        raw = json.loads(out.stdout)
+
+        if raw.get('version') != RESULTS_VERSION:
+            raise ValueError(f"unsupported results version {raw.get('version')}")
+
+        return self.parse_results(raw)
+
+    def read_sweep_results(self):
+        with open(self.conf_file('sweep_results.json'), 'r') as f:
+            raw = json.load(f)
+
+        if raw.get('version') != RESULTS_VERSION:
+            raise ValueError(f"unsupported sweep results version {raw.get('version')}")
+
+        steps = []
+        for st in raw['steps']:
+            step = { 'step': st['step'], raw['param']: st['value'],
+                     'result': st['result'] }
+            step.update(entry_results(st))
+            step.update(steady_results(st))
+            steps.append(step)
+        return steps
+
+    def parse_results(self, raw):
         threads = dict()
-
-        reth = re.compile(r'thread\[([0-9]+)\]: completed=([0-9]+) lat=([0-9.]+)\(([0-9.]+)\+([0-9.]+)\) iops=([0-9]+) MB/s=([0-9.]+)')
-        resm = re.compile(r'summary: completed=([0-9]+) lat=([0-9.]+)\(([0-9.]+)\+([0-9.]+)\) iops=([0-9]+) MB/s=([0-9.]+)')
-
-        for line in lines:
-            match = reth.search(line)
-            if match:
-                tid = int(match.group(1))
-                thread = {
-                        'completed': int(match.group(2)),
-                        'lat_usec': float(match.group(3)),
-                        'slat_usec': float(match.group(4)),
-                        'clat_usec': float(match.group(5)),
-                        'iops': float(match.group(6)),
-                        'bw_MBps': float(match.group(7)) }
-                threads[tid] = thread
-                continue
-            match = resm.search(line)
-            if match:
-                summary = {
-                        'completed': int(match.group(1)),
-                        'lat_usec': float(match.group(2)),
-                        'slat_usec': float(match.group(3)),
-                        'clat_usec': float(match.group(4)),
-                        'iops': float(match.group(5)),
-                        'bw_MBps': float(match.group(6)) }
-
-        if summary is None:
-            raise ValueError('did not find \'summary\' data in dmesg output')
+        targets = dict()
+
+        for th in raw['threads']:
+            thread = entry_results(th)
+            batches = th['latency']['bslat']['count']
+            if batches and th['batch_ios']:
+                thread['batches'] = batches
+                thread['ios_per_batch'] = th['batch_ios'] / batches
+                thread['bslat_per_io_usec'] = th['latency']['bslat']['sum_ns'] / th['batch_ios'] / 1000
+            thread.update(hctx_results([th]))
+            threads[th['index']] = thread
 
         if len(threads) < 1:
-            raise ValueError('did not find \'thread\' data in dmesg output')
-
-        results = Results(lines, summary, threads)
-        return results
+            raise ValueError('did not find \'thread\' data in results')
+
+        # threads run side by side, so the summary rates are over the
+        # runtime of the longest thread; the thread rates added up are kept
+        # to check against
+        summary = entry_results(raw['summary'])
+        summary['iops_thread_sum'] = sum(t['iops'] for t in threads.values())
+        summary['bw_MBps_thread_sum'] = sum(t['bw_MBps'] for t in threads.values())
+        check_summary(raw, summary)
+        summary.update(steady_results(raw))
+        summary.update(hctx_results(raw['threads']))
+
+        # polled and interrupt latency side by side
+        modes = { 'irq': [], 'poll': [] }
+        for th in raw['threads']:
+            modes['poll' if th['poll'] else 'irq'].append(th)
+        if modes['poll']:
+            for mode,ths in modes.items():
+                if not ths:
+                    continue
+                for t,lat in merge_latency(ths).items():
+                    for p,v in lat.items():
+                        summary[f'{mode}_{t}_{p}_usec'] = v / 1000
+
+        by_target = dict()
+        for th in raw['threads']:
+            by_target.setdefault(th['target'], []).append(th)
+        if len(by_target) > 1:
+            for idx,ths in sorted(by_target.items()):
+                runtime = max(th['runtime_ns'] for th in ths)
+                completed = sum(th['completed'] for th in ths)
+                target = {
+                        'device': ths[0]['device'],
+                        'completed': completed,
+                        'iops': completed * 1e9 / runtime if runtime else 0,
+                        'bw_MBps': sum(th['bytes'] for th in ths) * 1e3 / runtime if runtime else 0 }
+                target.update(hctx_results(ths))
+                for t,lat in merge_latency(ths).items():
+                    for p,v in lat.items():
+                        target[f'{t}_{p}_usec'] = v / 1000
+                targets[idx] = target
+
+        return Results(raw, summary, threads, targets, [], [])
 
 def main(args):
 
@@ -211,6 +668,46 @@ def main(args):
 
     print(f'KIO version {kio.version}')
 
+    if args.read_config:
+        for idx,dev in sorted(conf.get('targets', {}).items()):
+            kio.add_target(dev)
+
+    for dev in args.add_target or []:
+        kio.add_target(dev)
+
+    if args.ramp is None and args.read_config:
+        args.ramp = conf['global'].get('ramp_seconds')
+    if args.ramp is not None:
+        kio.write('ramp_seconds', args.ramp)
+
+    if args.steady_state is None and args.read_config:
+        args.steady_state = conf['global'].get('steady_state')
+    if args.steady_state is not None:
+        kio.write('steady_state', args.steady_state)
+
+    if args.queue_placement is None and args.read_config:
+        args.queue_placement = conf['global'].get('queue_placement')
+    if args.queue_placement is not None:
+        kio.write('queue_placement', args.queue_placement)
+
+    if args.stats_interval is None and args.read_config:
+        args.stats_interval = conf['global'].get('stats_interval_msec')
+    if args.stats_interval is not None:
+        kio.write('stats_interval_msec', args.stats_interval)
+
+    if args.sweep is None and args.read_config:
+        args.sweep = conf['global'].get('sweep')
+    kio.set_sweep(args.sweep, args.sweep_warmup)
+
+    if args.trace:
+        ios = parse_blkparse(args.trace, args.trace_action)
+        if not ios:
+            raise ValueError(f'no reads, writes or discards found in {args.trace}')
+        print(f'Loading {len(ios)} IOs from {args.trace}')
+        kio.load_trace(ios)
+        if args.replay is None:
+            args.replay = 'timed'
+
     if args.read_config:
         for tid in range(args.num_threads):
             if tid in conf['threads']:
@@ -239,10 +736,54 @@ def main(args):
 
     divider('Running')
     start = datetime.now()
-    results = kio.run()
+
+    stream_csv = None
+    def on_interval(entry):
+        nonlocal stream_csv
+        if entry.get('thread') == 'all':
+            print(f"{entry['time_ms']/1000:8.3f}s iops={entry['iops']} "
+                  f"MB/s={entry['bw_MBps']} clat_p99_usec={entry['clat_p99_usec']}")
+        if args.stream_csv:
+            if stream_csv is None:
+                f = open(args.stream_csv, 'w', newline='')
+                stream_csv = (f, csv.DictWriter(f, fieldnames=list(entry.keys())))
+                stream_csv[1].writeheader()
+            stream_csv[1].writerow(entry)
+            stream_csv[0].flush()
+
+    try:
+        if args.engine == 'uring':
+            results = kio.run_uring()
+        else:
+            results = kio.run(on_interval)
+    finally:
+        if stream_csv:
+            stream_csv[0].close()
 
     divider('Results')
-    print(yaml.dump(results, indent=4, width=200, default_flow_style=False))
+    print(yaml.dump({ 'summary': results.summary, 'threads': results.threads, 'targets': results.targets },
+                    indent=4, width=200, default_flow_style=False))
+
+    if results.summary.get('steady_state_reached') is False:
+        print(f"WARNING: steady state was not reached in {results.summary['steady_state_sec']:.1f}s",
+              file=sys.stderr)
+
+    if results.summary['verify_errors']:
+        print(f"WARNING: {results.summary['verify_errors']} chunks failed verification, see dmesg",
+              file=sys.stderr)
+
+    if results.sweep:
+        param = [k for k in results.sweep[0] if k not in ['step', 'result']][0]
+        knee = knee_index(results.sweep)
+        divider('Sweep')
+        print(f'{param:>12} {"iops":>10} {"MB/s":>10} {"clat_p50":>10} {"clat_p99":>10} {"lat_p99":>10}')
+        for i,st in enumerate(results.sweep):
+            print(f'{st[param]:>12} {st["iops"]:>10.0f} {st["bw_MBps"]:>10.1f} '
+                  f'{st["clat_p50_usec"]:>10.1f} {st["clat_p99_usec"]:>10.1f} '
+                  f'{st["lat_p99_usec"]:>10.1f}' + ('  <- knee' if i == knee else '')
+                  + ('  (not steady)' if st.get('steady_state_reached') is False else ''))
+        print()
+        plot_curve(results.sweep, knee)
 
     if not args.output_yaml and not args.output_csv:
         return
@@ -253,16 +794,18 @@ def main(args):
     if args.output_yaml:
         everything = {
                 'run_label': args.label,
-                'system': { 'timestamp': timestamp, 'hostname': hostname, 'kio_version': kio.version },
+                'system': { 'timestamp': timestamp, 'hostname': hostname, 'kio_version': kio.version,
+                            'engine': args.engine },
                 'config': conf,
-                'results': { 'summary': results.summary, 'threads': results.threads }
+                'results': { 'summary': results.summary, 'threads': results.threads, 'targets': results.targets,
+                             'intervals': results.intervals, 'sweep': results.sweep }
         }
         with open(args.output_yaml, 'w') as f:
             yaml.dump(everything, f, indent=4, width=200, default_flow_style=False)
 
     if args.output_csv:
-        columns = [ 'timestamp', 'hostname', 'kio_version', 'label' ]
-        values = [ timestamp, hostname, kio.version, kio.run_label ]
+        columns = [ 'timestamp', 'hostname', 'kio_version', 'label', 'engine' ]
+        values = [ timestamp, hostname, kio.version, kio.run_label, args.engine ]
 
         for k,v in conf['global'].items():
             columns.append(k)
@@ -283,9 +826,11 @@ def main(args):
             else:
                 values.append('/'.join(vs))
 
-        for k,v in results.summary.items():
-            columns.append(k)
-            values.append(v)
+        # a sweep gets one row per step, instead of one for the summary
+        rows = []
+        for st in results.sweep or [results.summary]:
+            rows.append(values + list(st.values()))
+        columns += list((results.sweep or [results.summary])[0].keys())
 
         write_mode = 'w'
         if os.path.exists(args.output_csv):
@@ -306,7 +851,7 @@ def main(args):
             if write_mode == 'w':
                 writer.writerow(columns)
 
-            writer.writerow(values)
+            writer.writerows(rows)
 
 EXAMPLES = """
 Run a one off configuration.  If multiple threads are used, they will use
@@ -329,6 +874,18 @@ Generate a config file, edit the details, and run it:
 # vim config.yaml
 # {0} --runtime 5 --config config.yaml
 
+Find the knee of the latency/throughput curve, doubling the queue depth
+every step, with 5 seconds of warm-up before each 10 second step:
+
+# {0} --config config.yaml --runtime 10 \\
+        --sweep queue_depth=1:128:x2 --sweep-warmup 5
+
+Run the same config from user space with io_uring (make -C uring first),
+to compare against the module:
+
+# {0} --config config.yaml --engine uring -o compare.csv -L uring
+# {0} --config config.yaml --engine kio -o compare.csv -L kio
+
 """
 
 if __name__ == "__main__":
@@ -346,7 +903,23 @@ if __name__ == "__main__":
     group = parser.add_argument_group('Run config')
     group.add_argument('-t', '--num-threads', dest='num_threads',     metavar='NUM', type=int, help='number of threads')
     group.add_argument('-s', '--runtime',     dest='runtime_seconds', metavar='SEC', type=int, help='seconds to run for')
+    group.add_argument('--ramp',              dest='ramp',            metavar='SEC', type=int, help='seconds to run before measuring starts')
     group.add_argument('-L', '--label',       default='',             metavar='STR', type=str, help='user label')
+    group.add_argument('-i', '--stats-interval', dest='stats_interval', metavar='MS', type=int, help='stream live stats every MS milliseconds, 0 to disable')
+    group.add_argument('--stream-csv',        dest='stream_csv',      metavar='CSV', type=str, help='write live stats to CSV as the run progresses')
+    group.add_argument('--sweep',             dest='sweep',           metavar='PLAN', type=str, help='run a step per value, e.g. queue_depth=1:128:x2 or rate_iops=10000:100000:10000')
+    group.add_argument('--queue-placement',   dest='queue_placement', metavar='P', type=str, choices=['any', 'spread', 'concentrate'], help='run threads without a cpu where their IOs spread over the hardware queues of the device (spread), or all go to one (concentrate); any (default) leaves it to the scheduler')
+    group.add_argument('--steady-state',      dest='steady_state',    metavar='SPEC', type=str, help='end runs once in steady state, e.g. iops or "lat window=10 range=10", none to disable')
+    group.add_argument('--engine',            dest='engine',          metavar='E', type=str, default='kio', choices=['kio', 'uring'], help='run in the kernel module (kio, default), or from user space with io_uring (uring)')
+    group.add_argument('--sweep-warmup',      dest='sweep_warmup',    metavar='SEC', type=int, help='discarded run before each sweep step')
+
+    group = parser.add_argument_group('Trace replay')
+    group.add_argument('--trace',        dest='trace',        metavar='FILE', type=str, help='load blkparse output to replay')
+    group.add_argument('--trace-action', dest='trace_action', metavar='A', type=str, default='Q', help='blkparse action to replay, Q (queued, default) or D (issued)')
+    group.add_argument('--replay',       dest='replay',       metavar='MODE', type=str, choices=['off', 'timed', 'fast'], help='replay the trace at its recorded times, or as fast as possible')
+
+    group = parser.add_argument_group('Target config')
+    group.add_argument('-a', '--add-target', dest='add_target', metavar='DEV', type=str, action='append', help='open another block device as a target')
 
     group = parser.add_argument_group('Workload config')
     group.add_argument('--bs', '--block-size',        dest='block_size',       metavar='N', type=int)
@@ -355,6 +928,10 @@ if __name__ == "__main__":
     group.add_argument('--ol', '--offset-low',        dest='offset_low',       metavar='N', type=int, help='lowest offset for IOs')
     group.add_argument('--oh', '--offset-high',       dest='offset_high',      metavar='N', type=int, help='highest offset for IOs')
     group.add_argument('--or', '--offset-random',     dest='offset_random',    metavar='N', type=int, help='1 to generate random offsets')
+    group.add_argument('--od', '--offset-dist',       dest='offset_dist',      metavar='D', type=str, choices=['uniform', 'zipf', 'pareto', 'normal', 'hotset'], help='distribution of random offsets')
+    group.add_argument('--op', '--offset-dist-param', dest='offset_dist_param', metavar='N', type=int, help='in thousandths: zipf theta, pareto h, normal sigma or hotset size (of range), 0 for default')
+    group.add_argument('--hp', '--hot-io-percent',    dest='hot_io_percent',   metavar='N', type=int, help='percent of IOs to the hot set, for --offset-dist hotset')
+    group.add_argument('--seed',                      dest='seed',             metavar='N', type=int, help='seed for offsets, directions and data, 0 for random each run')
     group.add_argument('--os', '--offset-stride',     dest='offset_stride',    metavar='N', type=int, help='when not-random, increment offset after each IO by this')
     group.add_argument('--qd', '--queue-depth',       dest='queue_depth',      metavar='N', type=int, help='dispatch no more than this number of IOs concurrently')
     group.add_argument('--rm', '--read-mix-percent',  dest='read_mix_percent', metavar='N', type=int, help='0..100 percent read bursts')
@@ -362,6 +939,21 @@ if __name__ == "__main__":
     group.add_argument('--wb', '--write-burst',       dest='write_burst',      metavar='N', type=int, help='number of IOs to dispatch as writes in one burst')
     group.add_argument('--rs', '--read-sleep-usec',   dest='read_sleep_usec',  metavar='N', type=int, help='sleep usec after read IO/burst')
     group.add_argument('--ws', '--write-sleep-usec',  dest='write_sleep_usec', metavar='N', type=int, help='sleep usec after write IO/burst')
+    group.add_argument('--cpu',                       dest='cpu',              metavar='N', type=int, help='bind threads to this cpu, -1 for any')
+    group.add_argument('--nn', '--numa-node',         dest='numa_node',        metavar='N', type=str, help='NUMA node for threads and buffers, -1 for any, auto for the device node')
+    group.add_argument('--po', '--poll',              dest='poll',             metavar='N', type=int, help='1 to poll for completions instead of sleeping')
+    group.add_argument('--tg', '--target',            dest='target',           metavar='N', type=int, help='index of the target device, see /sys/kernel/kio/targets')
+    group.add_argument('--ri', '--rate-iops',         dest='rate_iops',        metavar='N', type=int, help='pace each thread to this many IOPS, 0 for no limit')
+    group.add_argument('--rB', '--rate-bps',          dest='rate_bps',         metavar='N', type=int, help='pace each thread to this many bytes/s, 0 for no limit')
+    group.add_argument('--vf', '--verify',            dest='verify',           metavar='N', type=int, help='1 to write checksummed patterns and verify reads')
+    group.add_argument('--dp', '--data-pattern',      dest='data_pattern',     metavar='P', type=str, choices=['zeros', 'random', 'compress', 'dedup'], help='what writes carry: zeros, random, compress or dedup')
+    group.add_argument('--cp', '--compress-percent',  dest='compress_percent', metavar='N', type=int, help='percent of each block that is zeroes, with --data-pattern compress')
+    group.add_argument('--dd', '--dedup-percent',     dest='dedup_percent',    metavar='N', type=int, help='percent of writes that are duplicates, with --data-pattern dedup')
+    group.add_argument('--fua', '--fua-percent',      dest='fua_percent',      metavar='N', type=int, help='percent of writes with forced unit access')
+    group.add_argument('--dc', '--discard-percent',   dest='discard_percent',  metavar='N', type=int, help='percent of IOs that are discards instead')
+    group.add_argument('--wz', '--write-zeroes-percent', dest='write_zeroes_percent', metavar='N', type=int, help='percent of IOs that are write zeroes instead')
+    group.add_argument('--fl', '--flush-percent',     dest='flush_percent',    metavar='N', type=int, help='percent of IOs that are flushes instead')
+    group.add_argument('--sb', '--submit-batch',      dest='submit_batch',     metavar='N', type=int, help='plug this many submissions together, 0/1 to disable')
 
     group = parser.add_argument_group('Configuration file')
     group.add_argument('-g','--generate-config', type=str, metavar='YAML', help='generates YAML config file')
@@ -21,6 +21,31 @@ echo ------------------------------------------------------------------------
 
 write runtime_seconds 5
 
+# run this long first, without counting anything, to fill caches and let
+# all threads get going
+write ramp_seconds 0
+
+# stream live stats to /sys/kernel/debug/kio/stats (0 to disable)
+write stats_interval_msec 0
+
+# end the run once iops or lat settle (none to always run runtime_seconds),
+# e.g.: write steady_state "iops window=5 interval=1000 range=20 slope=10"
+write steady_state        none
+
+# where threads without a cpu run: any, or one per hardware queue of the
+# device (spread), or all on its first queue (concentrate)
+write queue_placement     any
+
+# run once (none), or a step per value of queue_depth, rate_iops or rate_bps,
+# e.g.: write sweep "queue_depth=1:128:x2 warmup=5"
+write sweep               none
+
+# targets opened so far (block_device module parameter is target 0),
+# more can be added with: write add_target /dev/nvme1n1
+cat /sys/kernel/kio/targets
+
+write 0/target            0
+
 write 0/offset_low        0
 write 0/offset_high       0xFFFFFFFF
 
@@ -30,6 +55,13 @@ write 0/offset_stride     4096          # advance offset by this amount
 write 0/queue_depth       16
 
 write 0/offset_random     0
+
+# how random offsets are spread: uniform, zipf (param is theta), pareto (h of
+# the range gets 1-h of IOs), normal (sigma) or hotset (size of the hot set,
+# which gets hot_io_percent of IOs); params are in thousandths, 0 for default
+write 0/offset_dist       uniform
+write 0/offset_dist_param 0
+write 0/hot_io_percent    0
 write 0/read_mix_percent  100
 
 # how often to switch directions / apply burst delay / burst finish
@@ -44,8 +76,50 @@ write 0/burst_finish      0
 write 0/read_sleep_usec   0
 write 0/write_sleep_usec  0
 
+# seed random offsets, directions and data (0 for a new seed each run)
+write 0/seed              0
+
+# replay the loaded trace instead: off, timed (at recorded times) or fast
+write 0/replay            off
+
+# percent of writes with FUA, and of IOs replaced by ops without data
+write 0/fua_percent       0
+write 0/discard_percent   0
+write 0/write_zeroes_percent 0
+write 0/flush_percent     0
+
+# plug this many submissions together (0 or 1 to submit each IO alone)
+write 0/submit_batch      0
+
+# pace the thread to a fixed load (0 for as fast as possible); latency is
+# then measured from when each IO was scheduled to be issued
+write 0/rate_iops         0
+write 0/rate_bps          0
+
+# what writes carry: zeros, random, compress (compress_percent of each 4k is
+# zeroes) or dedup (dedup_percent of writes repeat earlier data)
+write 0/data_pattern      zeros
+write 0/compress_percent  0
+write 0/dedup_percent     0
+
+# 1 to write a checksummed header in every block, and check it on reads
+write 0/verify            0
+
+# 1 to spin polling for completions, instead of waiting for interrupts
+write 0/poll              0
+
+# bind to a cpu (-1 for any), and pick a NUMA node (-1 for any, auto for device's)
+write 0/cpu               -1
+write 0/numa_node         auto
+
 write run_workload 1
 
+# the run happens in the background, write 1 to stop to end it early
+while ! grep -q ^done /sys/kernel/kio/status ; do
+        sleep 0.5
+done
+cat /sys/kernel/kio/status
+
 echo ------------------------------------------------------------------------
 
 grep . /sys/module/kio/parameters/* $(find /sys/kernel/kio/ -type f | sort) | column -t -s:
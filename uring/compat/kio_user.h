@@ -0,0 +1,170 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* just enough of the kernel for kio_dist.c, kio_hist.c, kio_steady.c and
+ * kio_json.c to build in user space, so kio-uring makes the same choices,
+ * keeps the same histograms and writes the same results as the module */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;   // as in the kernel, for printf
+typedef int32_t s32;
+typedef long long s64;
+typedef s64 time64_t;
+
+#ifndef U32_MAX
+#define U32_MAX ((u32)~0U)
+#endif
+#ifndef U64_MAX
+#define U64_MAX ((u64)~0ULL)
+#endif
+
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC  1000000000L
+#define MSEC_PER_SEC  1000L
+
+#define NUMA_NO_NODE  (-1)
+#define GFP_KERNEL    0
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#define max_t(t, a, b) max((t)(a), (t)(b))
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+#define abs(x) ({ __typeof__(x) _x = (x); _x < 0 ? -_x : _x; })
+
+#define __printf(a, b) __attribute__((format(printf, a, b)))
+
+static inline int vscnprintf(char *buf, size_t size, const char *fmt,
+			     va_list args)
+{
+	int len = vsnprintf(buf, size, fmt, args);
+
+	if (len < 0 || !size)
+		return 0;
+	return (size_t)len < size ? len : (int)size - 1;
+}
+
+#define pr_warn(...) fprintf(stderr, __VA_ARGS__)
+#define pr_info(...) fprintf(stderr, __VA_ARGS__)
+
+/* math64 */
+
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline s64 div64_s64(s64 a, s64 b) { return a / b; }
+
+static inline u64 div_u64_rem(u64 a, u32 b, u32 *rem)
+{
+	*rem = a % b;
+	return a / b;
+}
+
+static inline u64 mul_u64_u64_shr(u64 a, u64 b, unsigned shift)
+{
+	return (u64)(((unsigned __int128)a * b) >> shift);
+}
+
+static inline u64 mul_u64_u32_shr(u64 a, u32 b, unsigned shift)
+{
+	return mul_u64_u64_shr(a, b, shift);
+}
+
+/* bitops */
+
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#define ilog2(n) (fls64(n) - 1)
+
+static inline bool is_power_of_2(u64 n)
+{
+	return n && !(n & (n - 1));
+}
+
+/* atomic, only the 64 bit ones the histograms use */
+
+typedef struct {
+	s64 counter;
+} atomic64_t;
+
+static inline s64 atomic64_read(const atomic64_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_set(atomic64_t *v, s64 i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_add(s64 i, atomic64_t *v)
+{
+	__atomic_add_fetch(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_inc(atomic64_t *v)
+{
+	atomic64_add(1, v);
+}
+
+static inline s64 atomic64_cmpxchg(atomic64_t *v, s64 old, s64 new)
+{
+	__atomic_compare_exchange_n(&v->counter, &old, new, false,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	return old;
+}
+
+/* allocations */
+
+static inline void *kmalloc_node(size_t size, int flags, int nid)
+{
+	return malloc(size);
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+static inline void *vmalloc(size_t size)
+{
+	return malloc(size);
+}
+
+static inline void *vzalloc(size_t size)
+{
+	return calloc(1, size);
+}
+
+static inline void vfree(const void *p)
+{
+	free((void *)p);
+}
+
+/* only named by kio_config.h */
+
+struct mutex {
+	int unused;
+};
+
+struct kobject;
@@ -0,0 +1,3 @@
+#pragma once
+#include_next <linux/kernel.h>
+#include "../kio_user.h"
@@ -0,0 +1,1230 @@
+/* Copyright 2023 Bart Trojanowski <bart@jukie.net> */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/random.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "kio_config.h"
+#include "kio_hist.h"
+#include "kio_gen.h"
+#include "kio_results.h"
+#include "kio_json.h"
+
+/* the workload of the kio module, driven from user space with io_uring
+ *
+ * Threads are configured with the same attributes as the module's sysfs
+ * files, make the same offset and direction choices from the same seeds
+ * (kio_gen.h is shared), and report in the same results.json format
+ * (kio_json.c is shared), so a run of each can be compared line by line.
+ *
+ * Each thread has its own ring, with an SQ polling thread unless sqpoll=0,
+ * and its queue_depth buffers and the target registered with it, so an IO
+ * costs a READ_FIXED or WRITE_FIXED sqe and no system call.
+ */
+
+#define KIO_URING_MAX_TARGETS   64      // as KIO_MAX_TARGETS in the module
+#define KIO_URING_SQ_IDLE_MSEC  1000    // before the SQ thread sleeps
+
+/* names of the enum attributes, as the module shows them */
+static const char *kio_uring_pattern_name[] = {
+	"zeros", "random", "compress", "dedup",
+};
+
+static const char *kio_uring_replay_name[] = {
+	"off", "timed", "fast",
+};
+
+// ------------------------------------------------------------------------
+// configuration
+
+struct kio_uring_target {
+	char *dev_name;
+	int fd;
+	u64 dev_byte_size;
+	unsigned dev_block_size;
+};
+
+struct kio_uring_config {
+	u32 num_threads;
+	u32 runtime_seconds;
+	u32 ramp_seconds;
+	bool sqpoll;
+
+	struct kio_uring_target targets[KIO_URING_MAX_TARGETS];
+	struct kio_thread_config *threads;
+};
+
+static int kio_uring_match(const char **names, unsigned count,
+			   const char *val)
+{
+	unsigned i;
+
+	for (i = 0; i < count; i++)
+		if (!strcmp(names[i], val))
+			return i;
+	return -1;
+}
+
+static int kio_uring_parse_long(const char *val, long *out)
+{
+	char *end;
+
+	errno = 0;
+	*out = strtol(val, &end, 0);
+	if (errno || end == val || *end)
+		return -EINVAL;
+	return 0;
+}
+
+/* same names, and the same names for enum values, as in sysfs */
+static int kio_uring_thread_set(struct kio_thread_config *ktc,
+				const char *name, const char *val)
+{
+	long value;
+	int rc;
+
+	if (!strcmp(name, "seed")) {
+		char *end;
+
+		errno = 0;
+		ktc->seed = strtoull(val, &end, 0);
+		return (errno || end == val || *end) ? -EINVAL : 0;
+	}
+
+	if (!strcmp(name, "numa_node") && !strcmp(val, "auto"))
+		value = KIO_NUMA_NODE_AUTO;
+	else if (!strcmp(name, "data_pattern")
+		 && (rc = kio_uring_match(kio_uring_pattern_name,
+					  ARRAY_SIZE(kio_uring_pattern_name),
+					  val)) >= 0)
+		value = rc;
+	else if (!strcmp(name, "offset_dist")
+		 && (rc = kio_uring_match(kio_offset_dist_name,
+					  KIO_DIST_NR, val)) >= 0)
+		value = rc;
+	else if (!strcmp(name, "replay")
+		 && (rc = kio_uring_match(kio_uring_replay_name,
+					  ARRAY_SIZE(kio_uring_replay_name),
+					  val)) >= 0)
+		value = rc;
+	else if (kio_uring_parse_long(val, &value))
+		return -EINVAL;
+
+#define VAR_SET(_name_) \
+	if (!strcmp(name, #_name_)) { \
+		ktc->_name_ = value; \
+		return 0; \
+	}
+
+	VAR_SET(block_size);
+	VAR_SET(queue_depth);
+	VAR_SET(offset_low);
+	VAR_SET(offset_high);
+	VAR_SET(offset_stride);
+	VAR_SET(offset_random);
+	VAR_SET(offset_dist);
+	VAR_SET(offset_dist_param);
+	VAR_SET(hot_io_percent);
+	VAR_SET(replay);
+	VAR_SET(burst_delay);
+	VAR_SET(burst_finish);
+	VAR_SET(poll);
+	VAR_SET(verify);
+	VAR_SET(read_mix_percent);
+	VAR_SET(fua_percent);
+	VAR_SET(discard_percent);
+	VAR_SET(write_zeroes_percent);
+	VAR_SET(flush_percent);
+	VAR_SET(read_burst);
+	VAR_SET(write_burst);
+	VAR_SET(read_sleep_usec);
+	VAR_SET(write_sleep_usec);
+	VAR_SET(submit_batch);
+	VAR_SET(rate_iops);
+	VAR_SET(rate_bps);
+	VAR_SET(data_pattern);
+	VAR_SET(compress_percent);
+	VAR_SET(dedup_percent);
+	VAR_SET(target);
+	VAR_SET(cpu);
+	VAR_SET(numa_node);
+
+#undef VAR_SET
+
+	return -ENOENT;
+}
+
+/* num_threads=N ..., then targets/T=PATH and N/attr=VALUE in any order */
+static int kio_uring_parse(struct kio_uring_config *kc, int argc, char **argv)
+{
+	long value, cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, pass, rc;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < argc; i++) {
+			char *arg = strdup(argv[i]);
+			char *val = strchr(arg, '=');
+			char *attr;
+
+			if (!val) {
+				fprintf(stderr, "kio-uring: expected key=value, "
+					"not '%s'\n", argv[i]);
+				free(arg);
+				return -EINVAL;
+			}
+			*val++ = 0;
+			attr = strchr(arg, '/');
+			if (attr)
+				*attr++ = 0;
+
+			rc = 0;
+			if (pass == 0 && !attr) {
+				if (!strcmp(arg, "targets") || kio_uring_parse_long(val, &value))
+					rc = -EINVAL;
+				else if (!strcmp(arg, "num_threads"))
+					kc->num_threads = value;
+				else if (!strcmp(arg, "runtime_seconds"))
+					kc->runtime_seconds = value;
+				else if (!strcmp(arg, "ramp_seconds"))
+					kc->ramp_seconds = value;
+				else if (!strcmp(arg, "sqpoll"))
+					kc->sqpoll = !!value;
+				else
+					rc = -ENOENT;
+
+			} else if (pass == 1 && attr && !strcmp(arg, "targets")) {
+				if (kio_uring_parse_long(attr, &value)
+				    || value < 0 || value >= KIO_URING_MAX_TARGETS)
+					rc = -EINVAL;
+				else {
+					free(kc->targets[value].dev_name);
+					kc->targets[value].dev_name = strdup(val);
+				}
+
+			} else if (pass == 1 && attr) {
+				if (kio_uring_parse_long(arg, &value)
+				    || value < 0 || value >= kc->num_threads)
+					rc = -EINVAL;
+				else
+					rc = kio_uring_thread_set(&kc->threads[value],
+								  attr, val);
+			}
+
+			if (rc)
+				fprintf(stderr, "kio-uring: %s '%s'\n",
+					rc == -ENOENT ? "unknown attribute in"
+					: "invalid", argv[i]);
+			free(arg);
+			if (rc)
+				return rc;
+		}
+
+		if (pass)
+			break;
+
+		if (kc->num_threads < 1 || kc->num_threads > cpus) {
+			fprintf(stderr, "kio-uring: num_threads must be in "
+				"range [1,%ld]\n", cpus);
+			return -EINVAL;
+		}
+
+		if (kc->runtime_seconds < 1
+		    || kc->runtime_seconds > KIO_MAX_RUNTIME_SECONDS
+		    || kc->ramp_seconds > KIO_MAX_RUNTIME_SECONDS) {
+			fprintf(stderr, "kio-uring: runtime_seconds and "
+				"ramp_seconds must be at most %u\n",
+				KIO_MAX_RUNTIME_SECONDS);
+			return -EINVAL;
+		}
+
+		kc->threads = calloc(kc->num_threads, sizeof(*kc->threads));
+		if (!kc->threads)
+			return -ENOMEM;
+		for (i = 0; i < kc->num_threads; i++) {
+			kc->threads[i].cpu = KIO_CPU_ANY;
+			kc->threads[i].numa_node = NUMA_NO_NODE;
+		}
+	}
+
+	return 0;
+}
+
+static int kio_uring_target_open(struct kio_uring_target *tgt)
+{
+	struct stat st;
+	u64 size;
+	int bsz;
+
+	tgt->fd = open(tgt->dev_name, O_RDWR | O_DIRECT);
+	if (tgt->fd < 0) {
+		fprintf(stderr, "kio-uring: cannot open %s: %s\n",
+			tgt->dev_name, strerror(errno));
+		return -errno;
+	}
+
+	if (fstat(tgt->fd, &st))
+		return -errno;
+
+	/* regular files work too, which is handy for trying things out */
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(tgt->fd, BLKGETSIZE64, &size)
+		    || ioctl(tgt->fd, BLKSSZGET, &bsz))
+			return -errno;
+		tgt->dev_byte_size = size;
+		tgt->dev_block_size = bsz;
+	} else {
+		tgt->dev_byte_size = st.st_size;
+		tgt->dev_block_size = 512;
+	}
+
+	return 0;
+}
+
+#define CHECK_THRD_VAR(_i_, _name_, _min_, _max_) \
+({ \
+	long long val = ktc->_name_, lo = (_min_), hi = (_max_); \
+	if (val < lo || val > hi) { \
+		fprintf(stderr, "kio-uring: thread %u %s value %lld " \
+			"is out of range [%lld,%lld]\n", \
+			_i_, #_name_, val, lo, hi); \
+		return -EINVAL; \
+	} \
+})
+
+#define CHECK_THRD_UNSUPPORTED(_i_, _name_) \
+({ \
+	if (ktc->_name_) { \
+		fprintf(stderr, "kio-uring: thread %u %s is not supported, " \
+			"use the module\n", _i_, #_name_); \
+		return -EOPNOTSUPP; \
+	} \
+})
+
+/* the module's checks of kio_config_valid(), for what is supported here,
+ * with offset_high capped the same way */
+static int kio_uring_check(struct kio_uring_config *kc)
+{
+	unsigned i;
+	int rc;
+
+	for (i = 0; i < KIO_URING_MAX_TARGETS; i++) {
+		if (!kc->targets[i].dev_name)
+			continue;
+		rc = kio_uring_target_open(&kc->targets[i]);
+		if (rc)
+			return rc;
+	}
+
+	for (i = 0; i < kc->num_threads; i++) {
+		struct kio_thread_config *ktc = &kc->threads[i];
+		struct kio_uring_target *tgt;
+
+		if (ktc->target < 0 || ktc->target >= KIO_URING_MAX_TARGETS
+		    || !kc->targets[ktc->target].dev_name) {
+			fprintf(stderr, "kio-uring: thread %u target %d "
+				"does not exist\n", i, ktc->target);
+			return -EINVAL;
+		}
+		tgt = &kc->targets[ktc->target];
+
+		CHECK_THRD_UNSUPPORTED(i, replay);
+		CHECK_THRD_UNSUPPORTED(i, verify);
+		CHECK_THRD_UNSUPPORTED(i, data_pattern);
+		CHECK_THRD_UNSUPPORTED(i, rate_iops);
+		CHECK_THRD_UNSUPPORTED(i, rate_bps);
+		CHECK_THRD_UNSUPPORTED(i, burst_delay);
+		CHECK_THRD_UNSUPPORTED(i, burst_finish);
+		CHECK_THRD_UNSUPPORTED(i, read_sleep_usec);
+		CHECK_THRD_UNSUPPORTED(i, write_sleep_usec);
+		CHECK_THRD_UNSUPPORTED(i, discard_percent);
+		CHECK_THRD_UNSUPPORTED(i, write_zeroes_percent);
+
+		CHECK_THRD_VAR(i, block_size, 512, 1<<20);
+		CHECK_THRD_VAR(i, offset_stride, 512, 1<<20);
+		CHECK_THRD_VAR(i, queue_depth, 1, 1024);
+		CHECK_THRD_VAR(i, offset_low, 0, LONG_MAX);
+		CHECK_THRD_VAR(i, offset_high, 0, LONG_MAX);
+		CHECK_THRD_VAR(i, read_mix_percent, 0, 100);
+		CHECK_THRD_VAR(i, read_burst, 0, 1024);
+		CHECK_THRD_VAR(i, write_burst, 0, 1024);
+		CHECK_THRD_VAR(i, submit_batch, 0, 1024);
+		CHECK_THRD_VAR(i, offset_dist, 0, KIO_DIST_NR - 1);
+		CHECK_THRD_VAR(i, hot_io_percent, 0, 100);
+		CHECK_THRD_VAR(i, fua_percent, 0, 100);
+		CHECK_THRD_VAR(i, flush_percent, 0, 100);
+		if (ktc->offset_dist == KIO_DIST_ZIPF)
+			CHECK_THRD_VAR(i, offset_dist_param, 0, 5000);
+		else
+			CHECK_THRD_VAR(i, offset_dist_param, 0, 999);
+
+		if (ktc->cpu != KIO_CPU_ANY
+		    && (ktc->cpu < 0
+			|| ktc->cpu >= sysconf(_SC_NPROCESSORS_CONF))) {
+			fprintf(stderr, "kio-uring: thread %u cpu %d is not "
+				"online\n", i, ktc->cpu);
+			return -EINVAL;
+		}
+
+		/* buffers are touched first by the thread, so they are on
+		 * its node; a node of its own needs a cpu on it */
+		if (ktc->numa_node != NUMA_NO_NODE
+		    && ktc->numa_node != KIO_NUMA_NODE_AUTO) {
+			fprintf(stderr, "kio-uring: thread %u numa_node is not "
+				"supported, use cpu\n", i);
+			return -EOPNOTSUPP;
+		}
+
+		if (!is_power_of_2(ktc->block_size)
+		    || ktc->block_size < tgt->dev_block_size) {
+			fprintf(stderr, "kio-uring: thread %u block_size value "
+				"%u must be a power of 2, at least %u for %s\n",
+				i, ktc->block_size, tgt->dev_block_size,
+				tgt->dev_name);
+			return -EINVAL;
+		}
+
+		if (ktc->offset_low + ktc->block_size > tgt->dev_byte_size) {
+			fprintf(stderr, "kio-uring: thread %u offset_low %ld "
+				"+ block_size %u cannot exceed %s size %llu\n",
+				i, (long)ktc->offset_low, ktc->block_size,
+				tgt->dev_name,
+				(unsigned long long)tgt->dev_byte_size);
+			return -EINVAL;
+		}
+
+		if (ktc->offset_high + ktc->block_size > tgt->dev_byte_size)
+			ktc->offset_high = tgt->dev_byte_size - ktc->block_size;
+
+		if (ktc->offset_low >= ktc->offset_high) {
+			fprintf(stderr, "kio-uring: thread %u offset_low %ld "
+				"must be smaller than offset_high %ld\n", i,
+				(long)ktc->offset_low, (long)ktc->offset_high);
+			return -EINVAL;
+		}
+
+		if (!ktc->read_burst && !ktc->write_burst) {
+			fprintf(stderr, "kio-uring: thread %u has neither "
+				"read_burst nor write_burst set\n", i);
+			return -EINVAL;
+		}
+
+		if (ktc->read_mix_percent == 100 && !ktc->read_burst) {
+			fprintf(stderr, "kio-uring: thread %u is read-only but "
+				"does not set read_burst\n", i);
+			return -EINVAL;
+		}
+
+		if (ktc->read_mix_percent == 0 && !ktc->write_burst) {
+			fprintf(stderr, "kio-uring: thread %u is write-only but "
+				"does not set write_burst\n", i);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+// ------------------------------------------------------------------------
+// io_uring, without liburing: setup, the two rings, and registration
+
+struct kio_ring {
+	int fd;
+	bool sqpoll;
+	bool iopoll;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+};
+
+static int kio_ring_enter(struct kio_ring *r, unsigned to_submit,
+			  unsigned min_complete, unsigned flags)
+{
+	int rc = syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+			 flags, NULL, 0);
+
+	return rc < 0 ? -errno : rc;
+}
+
+static int kio_ring_register(struct kio_ring *r, unsigned opcode,
+			     const void *arg, unsigned nr_args)
+{
+	int rc = syscall(__NR_io_uring_register, r->fd, opcode, arg, nr_args);
+
+	return rc < 0 ? -errno : rc;
+}
+
+static void kio_ring_exit(struct kio_ring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_len);
+	if (r->sq_ptr)
+		munmap(r->sq_ptr, r->sq_len);
+	if (r->fd > 0)
+		close(r->fd);
+	memset(r, 0, sizeof(*r));
+}
+
+static int kio_ring_init(struct kio_ring *r, unsigned entries, bool sqpoll,
+			 bool iopoll)
+{
+	struct io_uring_params p = {};
+	void *ptr;
+
+	p.flags = (sqpoll ? IORING_SETUP_SQPOLL : 0)
+		| (iopoll ? IORING_SETUP_IOPOLL : 0);
+	p.sq_thread_idle = KIO_URING_SQ_IDLE_MSEC;
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) {
+		r->fd = 0;
+		return -errno;
+	}
+	r->sqpoll = sqpoll;
+	r->iopoll = iopoll;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes
+		+ p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_len = r->cq_len = max(r->sq_len, r->cq_len);
+
+	ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto error;
+	r->sq_ptr = ptr;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, r->fd,
+			   IORING_OFF_CQ_RING);
+		if (ptr == MAP_FAILED)
+			goto error;
+		r->cq_ptr = ptr;
+	}
+
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		goto error;
+	r->sqes = ptr;
+
+	r->sq_head = r->sq_ptr + p.sq_off.head;
+	r->sq_tail = r->sq_ptr + p.sq_off.tail;
+	r->sq_mask = r->sq_ptr + p.sq_off.ring_mask;
+	r->sq_flags = r->sq_ptr + p.sq_off.flags;
+	r->sq_array = r->sq_ptr + p.sq_off.array;
+	r->cq_head = r->cq_ptr + p.cq_off.head;
+	r->cq_tail = r->cq_ptr + p.cq_off.tail;
+	r->cq_mask = r->cq_ptr + p.cq_off.ring_mask;
+	r->cqes = r->cq_ptr + p.cq_off.cqes;
+
+	return 0;
+
+error:
+	ptr = (void *)(long)-errno;
+	kio_ring_exit(r);
+	return (long)ptr;
+}
+
+/* in-flight IOs never outnumber the sq entries, so there is always room */
+static struct io_uring_sqe *kio_ring_sqe(struct kio_ring *r, unsigned *tail)
+{
+	unsigned idx = *tail & *r->sq_mask;
+
+	r->sq_array[idx] = idx;
+	(*tail)++;
+	return memset(&r->sqes[idx], 0, sizeof(struct io_uring_sqe));
+}
+
+/* hand the sqes up to tail to the kernel */
+static int kio_ring_submit(struct kio_ring *r, unsigned tail, unsigned n)
+{
+	__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+	if (r->sqpoll) {
+		/* the SQ thread may have gone to sleep, see liburing */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED)
+		    & IORING_SQ_NEED_WAKEUP)
+			return kio_ring_enter(r, 0, 0, IORING_ENTER_SQ_WAKEUP);
+		return 0;
+	}
+
+	return kio_ring_enter(r, n, 0,
+			      r->iopoll ? IORING_ENTER_GETEVENTS : 0);
+}
+
+// ------------------------------------------------------------------------
+// threads
+
+/* threads get ready, and wait for the main thread to start them all, as
+ * struct kio_run_sync does in the module */
+struct kio_uring_run {
+	const struct kio_uring_config *kc;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned waiting;               // threads not ready yet
+	bool go;                        // start was set, or the run called off
+	s64 start;
+	s64 ramp_end;
+	bool stop;
+	bool emergency_stop;
+};
+
+struct kio_uring_io {
+	off_t offset;
+	u8 op;
+	bool ramp;                      // not accounted
+	s64 start;                      // issued
+	s64 submitted;                  // handed to the kernel
+};
+
+struct kio_uring_thread {
+	unsigned index;
+	const struct kio_thread_config *config;
+	const struct kio_uring_target *tgt;
+	struct kio_uring_run *run;
+	pthread_t pthread;
+	int result;
+
+	struct kio_ring ring;
+	void *bufs;                     // queue_depth of block_size
+	struct kio_uring_io *ios;       // one per buffer
+	unsigned *free;                 // indexes of idle buffers
+	unsigned nr_free;
+
+	u64 dispatched;                 // in flight
+	u64 completed;
+	u64 bytes;
+	u64 runtime;
+	s64 window_start;
+	bool ramping;
+	u64 slat_total;
+	u64 clat_total;
+	u64 batch_ios;
+	struct kio_op_counters ops[KIO_OP_NR];
+
+	u64 seed;
+	struct kio_gen gen;             // picks the IOs, as in the module
+	u32 data_seed;
+
+	struct kio_hist *hist;          // KIO_LAT_NR histograms, in the results
+	u64 coverage[KIO_COVERAGE_BUCKETS];
+};
+
+static inline s64 kio_uring_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void kio_uring_complete(struct kio_uring_thread *th,
+			       const struct io_uring_cqe *cqe, s64 now)
+{
+	const struct kio_thread_config *ktc = th->config;
+	unsigned slot = cqe->user_data;
+	struct kio_uring_io *io = &th->ios[slot];
+	s64 clat_nsec, lat_nsec;
+
+	th->free[th->nr_free++] = slot;
+	th->dispatched--;
+
+	if (unlikely(cqe->res < 0
+		     || (kio_op_has_data(io->op)
+			 && cqe->res != ktc->block_size))) {
+		fprintf(stderr, "kio-uring: thread[%u]: %s at %ld failed "
+			"with %d\n", th->index, kio_op_name[io->op],
+			(long)io->offset, cqe->res);
+		if (!th->result)
+			th->result = cqe->res < 0 ? cqe->res : -EIO;
+		return;
+	}
+
+	if (unlikely(io->ramp))
+		return;
+
+	clat_nsec = now - io->submitted;
+	lat_nsec = now - io->start;
+	th->clat_total += clat_nsec;
+
+	kio_hist_add(&th->hist[KIO_LAT_CLAT], clat_nsec);
+	kio_hist_add(&th->hist[KIO_LAT_LAT], lat_nsec);
+	kio_hist_add(&th->hist[KIO_LAT_OP + io->op], lat_nsec);
+	th->ops[io->op].clat_total += clat_nsec;
+	th->ops[io->op].completed++;
+
+	if (kio_op_has_data(io->op)) {
+		th->bytes += ktc->block_size;
+		th->ops[io->op].bytes += ktc->block_size;
+	}
+
+	th->completed++;
+}
+
+/* reap what has completed, waiting for at least min_complete */
+static int kio_uring_reap(struct kio_uring_thread *th, unsigned min_complete)
+{
+	struct kio_ring *r = &th->ring;
+	unsigned head, tail;
+	s64 now;
+	int rc;
+
+	if (min_complete || (r->iopoll && !r->sqpoll)) {
+		rc = kio_ring_enter(r, 0, min_complete,
+				    IORING_ENTER_GETEVENTS);
+		if (rc < 0 && rc != -EINTR && rc != -EAGAIN)
+			return rc;
+	}
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return 0;
+
+	now = kio_uring_now();
+	for (; head != tail; head++)
+		kio_uring_complete(th, &r->cqes[head & *r->cq_mask], now);
+
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* queue one IO in the ring, the caller submits the batch */
+static void kio_uring_prep_one(struct kio_uring_thread *th, unsigned *tail)
+{
+	const struct kio_thread_config *ktc = th->config;
+	unsigned slot = th->free[--th->nr_free];
+	struct kio_uring_io *io = &th->ios[slot];
+	struct io_uring_sqe *sqe;
+	struct kio_dir dir;
+
+	if (unlikely(th->ramping) && kio_uring_now() >= th->window_start)
+		th->ramping = false;
+
+	dir = kio_gen_next_dir(&th->gen);
+	kio_gen_next_op(&th->gen, &dir);
+
+	io->offset = kio_gen_next_offset(&th->gen);
+	if (likely(!th->ramping))
+		kio_gen_coverage(ktc, th->coverage, io->offset);
+	io->op = dir.op;
+	io->ramp = th->ramping;
+	io->start = kio_uring_now();
+
+	sqe = kio_ring_sqe(&th->ring, tail);
+	sqe->fd = 0;                    // registered
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->user_data = slot;
+
+	if (dir.op == KIO_OP_FLUSH) {
+		sqe->opcode = IORING_OP_FSYNC;
+	} else {
+		sqe->opcode = kio_op_has_data(dir.op) && dir.op != KIO_OP_READ
+			? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->off = io->offset;
+		sqe->addr = (unsigned long)th->bufs
+			+ (size_t)slot * ktc->block_size;
+		sqe->len = ktc->block_size;
+		sqe->buf_index = slot;
+		/* forced unit access, on devices with a volatile cache */
+		if (dir.op == KIO_OP_WRITE_FUA)
+			sqe->rw_flags = RWF_DSYNC;
+	}
+
+	th->dispatched++;
+}
+
+static int kio_uring_thread_setup(struct kio_uring_thread *th)
+{
+	const struct kio_thread_config *ktc = th->config;
+	struct iovec *iov;
+	cpu_set_t cpus;
+	unsigned i;
+	int rc;
+
+	if (ktc->cpu != KIO_CPU_ANY) {
+		CPU_ZERO(&cpus);
+		CPU_SET(ktc->cpu, &cpus);
+		rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (rc)
+			return -rc;
+	}
+
+	rc = posix_memalign(&th->bufs, 4096,
+			    (size_t)ktc->queue_depth * ktc->block_size);
+	if (rc)
+		return -rc;
+	/* first touch, on the thread's node */
+	memset(th->bufs, 0, (size_t)ktc->queue_depth * ktc->block_size);
+
+	th->ios = calloc(ktc->queue_depth, sizeof(*th->ios));
+	th->free = calloc(ktc->queue_depth, sizeof(*th->free));
+	if (!th->ios || !th->free)
+		return -ENOMEM;
+	for (i = 0; i < ktc->queue_depth; i++)
+		th->free[i] = ktc->queue_depth - 1 - i;
+	th->nr_free = ktc->queue_depth;
+
+	rc = kio_ring_init(&th->ring, ktc->queue_depth, th->run->kc->sqpoll,
+			   ktc->poll);
+	if (rc) {
+		fprintf(stderr, "kio-uring: thread[%u]: io_uring setup failed: "
+			"%s\n", th->index, strerror(-rc));
+		return rc;
+	}
+
+	rc = kio_ring_register(&th->ring, IORING_REGISTER_FILES,
+			       &th->tgt->fd, 1);
+	if (rc < 0)
+		return rc;
+
+	iov = calloc(ktc->queue_depth, sizeof(*iov));
+	if (!iov)
+		return -ENOMEM;
+	for (i = 0; i < ktc->queue_depth; i++) {
+		iov[i].iov_base = th->bufs + (size_t)i * ktc->block_size;
+		iov[i].iov_len = ktc->block_size;
+	}
+	rc = kio_ring_register(&th->ring, IORING_REGISTER_BUFFERS,
+			       iov, ktc->queue_depth);
+	free(iov);
+	if (rc < 0) {
+		fprintf(stderr, "kio-uring: thread[%u]: cannot register "
+			"buffers: %s\n", th->index, strerror(-rc));
+		return rc;
+	}
+
+	if (ktc->offset_random) {
+		rc = kio_dist_init(&th->gen.dist, ktc,
+				   div64_u64(ktc->offset_high - ktc->offset_low,
+					     ktc->block_size), NUMA_NO_NODE);
+		if (rc < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void kio_uring_thread_cleanup(struct kio_uring_thread *th)
+{
+	kio_dist_free(&th->gen.dist);
+	kio_ring_exit(&th->ring);
+	free(th->free);
+	free(th->ios);
+	free(th->bufs);
+	th->free = NULL;
+	th->ios = NULL;
+	th->bufs = NULL;
+}
+
+static void *kio_uring_thread_fn(void *data)
+{
+	struct kio_uring_thread *th = data;
+	const struct kio_thread_config *ktc = th->config;
+	struct kio_uring_run *run = th->run;
+	s64 thread_start, batch_start, slat_nsec, now;
+	unsigned batch = max_t(unsigned, ktc->submit_batch, 1);
+	unsigned n, i, tail;
+	int rc;
+
+	th->result = kio_uring_thread_setup(th);
+	if (th->result)
+		__atomic_store_n(&run->emergency_stop, true, __ATOMIC_RELAXED);
+
+	/* the main thread sets the start for all, once they are all ready */
+	pthread_mutex_lock(&run->lock);
+	run->waiting--;
+	pthread_cond_broadcast(&run->cond);
+	while (!run->go)
+		pthread_cond_wait(&run->cond, &run->lock);
+	pthread_mutex_unlock(&run->lock);
+
+	thread_start = run->start;
+	th->window_start = run->ramp_end;
+	th->ramping = th->window_start > thread_start;
+
+	while (!th->result && !__atomic_load_n(&run->stop, __ATOMIC_RELAXED)) {
+		rc = kio_uring_reap(th, th->nr_free ? 0 : 1);
+		if (rc < 0) {
+			th->result = rc;
+			break;
+		}
+		if (!th->nr_free || th->result)
+			continue;
+
+		/* a batch is queued in the ring and handed over at once */
+		tail = *th->ring.sq_tail;
+		batch_start = kio_uring_now();
+		for (n = 0; n < batch && th->nr_free; n++)
+			kio_uring_prep_one(th, &tail);
+
+		rc = kio_ring_submit(&th->ring, tail, n);
+		if (rc < 0) {
+			fprintf(stderr, "kio-uring: thread[%u]: failed to "
+				"submit %u IOs, with %d\n", th->index, n, rc);
+			th->result = rc;
+			break;
+		}
+
+		/* the cost of the handover is shared by the batch */
+		now = kio_uring_now();
+		slat_nsec = (now - batch_start) / n;
+		for (i = 0; i < n; i++) {
+			struct kio_uring_io *io;
+
+			io = &th->ios[th->free[th->nr_free + i]];
+			io->submitted = now;
+			if (io->ramp)
+				continue;
+			th->slat_total += slat_nsec;
+			th->ops[io->op].slat_total += slat_nsec;
+			kio_hist_add(&th->hist[KIO_LAT_SLAT], slat_nsec);
+		}
+
+		if (batch > 1 && !th->ramping) {
+			kio_hist_add(&th->hist[KIO_LAT_BATCH], now - batch_start);
+			th->batch_ios += n;
+		}
+	}
+
+	if (th->result)
+		__atomic_store_n(&run->emergency_stop, true, __ATOMIC_RELAXED);
+
+	while (th->dispatched && th->ring.fd) {
+		rc = kio_uring_reap(th, 1);
+		if (rc < 0)
+			break;
+	}
+
+	/* a thread that never got past the ramp has nothing measured */
+	if (!th->ramping)
+		th->runtime = kio_uring_now() - th->window_start;
+
+	if (th->dispatched)
+		fprintf(stderr, "kio-uring: thread[%u]: %llu pending requests, "
+			"completed=%llu, result=%d\n", th->index,
+			(unsigned long long)th->dispatched,
+			(unsigned long long)th->completed, th->result);
+
+	kio_uring_thread_cleanup(th);
+	return NULL;
+}
+
+// ------------------------------------------------------------------------
+// results, in the module's kio_run_results so kio_json.c renders them
+
+static void kio_uring_results_free(struct kio_run_results *res)
+{
+	if (!res)
+		return;
+	free(res->counters);
+	kio_hist_free(res->hist);
+	free(res);
+}
+
+/* as kio_run_results_alloc(), the threads keep their histograms in it */
+static struct kio_run_results *kio_uring_results_alloc(u32 num_threads)
+{
+	struct kio_run_results *res;
+
+	res = calloc(1, sizeof(*res));
+	if (!res)
+		return NULL;
+
+	res->num_threads = num_threads;
+	res->counters = calloc(num_threads + 1, sizeof(*res->counters));
+	res->hist = kio_hist_alloc((num_threads + 1) * KIO_LAT_NR);
+	if (!res->counters || !res->hist) {
+		kio_uring_results_free(res);
+		return NULL;
+	}
+
+	kio_run_results_counters(res, -1)->target = -1;
+
+	return res;
+}
+
+/* the counters of a thread, and its part of the summary */
+static void kio_uring_results_collect(struct kio_run_results *res,
+				      const struct kio_uring_thread *th)
+{
+	struct kio_run_counters *c = kio_run_results_counters(res, th->index);
+	struct kio_run_counters *sum = kio_run_results_counters(res, -1);
+	struct kio_hist *total = kio_run_results_hist(res, -1);
+	int i;
+
+	c->target = th->config->target;
+	c->dev_name = th->tgt->dev_name;
+	c->poll = th->config->poll;
+	c->seed = th->seed;
+	c->dispatched = th->dispatched;
+	c->completed = th->completed;
+	c->bytes = th->bytes;
+	c->runtime = th->runtime;
+	c->slat_total = th->slat_total;
+	c->clat_total = th->clat_total;
+	c->batch_ios = th->batch_ios;
+	for (i = 0; i < KIO_COVERAGE_BUCKETS; i++) {
+		c->coverage[i] = th->coverage[i];
+		sum->coverage[i] += c->coverage[i];
+	}
+
+	for (i = 0; i < KIO_OP_NR; i++) {
+		c->ops[i] = th->ops[i];
+		sum->ops[i].completed += c->ops[i].completed;
+		sum->ops[i].bytes += c->ops[i].bytes;
+		sum->ops[i].slat_total += c->ops[i].slat_total;
+		sum->ops[i].clat_total += c->ops[i].clat_total;
+	}
+
+	sum->dispatched += c->dispatched;
+	sum->completed += c->completed;
+	sum->bytes += c->bytes;
+	sum->runtime = max(sum->runtime, c->runtime);
+	sum->slat_total += c->slat_total;
+	sum->clat_total += c->clat_total;
+	sum->batch_ios += c->batch_ios;
+
+	for (i = 0; i < KIO_LAT_NR; i++)
+		kio_hist_merge(&total[i], &th->hist[i]);
+}
+
+static int kio_uring_results_write(const struct kio_run_results *res,
+				   FILE *out)
+{
+	size_t len;
+	char *json = kio_json_run_results(res, &len);
+
+	if (!json)
+		return -ENOMEM;
+	fwrite(json, 1, len, out);
+	vfree(json);
+	return 0;
+}
+
+// ------------------------------------------------------------------------
+
+/* sleep until the end of the run, or until a thread fails */
+static void kio_uring_wait(struct kio_uring_run *run, s64 deadline)
+{
+	s64 now, step;
+	struct timespec ts;
+
+	while (!__atomic_load_n(&run->emergency_stop, __ATOMIC_RELAXED)) {
+		now = kio_uring_now();
+		if (now >= deadline)
+			break;
+		step = min_t(s64, deadline - now, 100 * NSEC_PER_MSEC);
+		ts.tv_sec = step / NSEC_PER_SEC;
+		ts.tv_nsec = step % NSEC_PER_SEC;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* let the threads go: to run, or to stop right away */
+static void kio_uring_go(struct kio_uring_run *run, bool stop)
+{
+	pthread_mutex_lock(&run->lock);
+	if (stop) {
+		run->stop = true;
+		run->emergency_stop = true;
+	}
+	run->go = true;
+	pthread_cond_broadcast(&run->cond);
+	pthread_mutex_unlock(&run->lock);
+}
+
+static int kio_uring_run(const struct kio_uring_config *kc, FILE *out)
+{
+	struct kio_uring_run run = {
+		.kc = kc,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.waiting = kc->num_threads,
+	};
+	struct kio_uring_thread *ths;
+	struct kio_run_results *res;
+	int result = 0, rc;
+	unsigned i, started = 0;
+
+	ths = calloc(kc->num_threads, sizeof(*ths));
+	res = kio_uring_results_alloc(kc->num_threads);
+	if (!ths || !res) {
+		free(ths);
+		kio_uring_results_free(res);
+		return -ENOMEM;
+	}
+
+	res->runtime_seconds = kc->runtime_seconds;
+	res->ramp_seconds = kc->ramp_seconds;
+	res->timestamp = time(NULL);
+	res->engine = "io_uring";
+	res->sqpoll = kc->sqpoll;
+
+	for (i = 0; i < kc->num_threads; i++) {
+		struct kio_uring_thread *th = &ths[i];
+
+		th->index = i;
+		th->config = &kc->threads[i];
+		th->tgt = &kc->targets[th->config->target];
+		th->run = &run;
+		th->hist = kio_run_results_hist(res, i);
+
+		/* a fixed seed repeats the same offsets and directions */
+		th->seed = th->config->seed;
+		while (!th->seed) {
+			if (getrandom(&th->seed, sizeof(th->seed), 0) < 0) {
+				result = -errno;
+				goto out_free;
+			}
+		}
+		th->gen.config = th->config;
+		th->gen.block_size = th->tgt->dev_block_size;
+		kio_rand_seed(&th->gen.rand, th->seed);
+		th->data_seed = kio_rand_u32(&th->gen.rand);
+	}
+
+	/* no thread goes before they are all created and ready */
+	for (i = 0; i < kc->num_threads; i++) {
+		rc = pthread_create(&ths[i].pthread, NULL,
+				    kio_uring_thread_fn, &ths[i]);
+		if (rc) {
+			fprintf(stderr, "kio-uring: cannot create thread %u: "
+				"%s\n", i, strerror(rc));
+			result = -rc;
+			break;
+		}
+		started++;
+	}
+
+	/* the threads that were created stop as soon as they are let go */
+	if (result) {
+		kio_uring_go(&run, true);
+		for (i = 0; i < started; i++)
+			pthread_join(ths[i].pthread, NULL);
+		goto out_free;
+	}
+
+	pthread_mutex_lock(&run.lock);
+	while (run.waiting)
+		pthread_cond_wait(&run.cond, &run.lock);
+	pthread_mutex_unlock(&run.lock);
+
+	run.start = kio_uring_now();
+	run.ramp_end = run.start + (s64)kc->ramp_seconds * NSEC_PER_SEC;
+	kio_uring_go(&run, __atomic_load_n(&run.emergency_stop,
+					   __ATOMIC_RELAXED));
+
+	kio_uring_wait(&run, run.ramp_end
+		       + (s64)kc->runtime_seconds * NSEC_PER_SEC);
+
+	/* stop them all at once */
+	__atomic_store_n(&run.stop, true, __ATOMIC_RELAXED);
+	for (i = 0; i < started; i++)
+		pthread_join(ths[i].pthread, NULL);
+
+	for (i = 0; i < kc->num_threads; i++) {
+		if (ths[i].result && !result)
+			result = ths[i].result;
+		fprintf(stderr, "kio-uring: thread[%u]: done, completed=%llu, "
+			"result=%d\n", i, (unsigned long long)ths[i].completed,
+			ths[i].result);
+		kio_uring_results_collect(res, &ths[i]);
+	}
+
+	if (!result)
+		result = kio_uring_results_write(res, out);
+
+out_free:
+	kio_uring_results_free(res);
+	free(ths);
+	return result;
+}
+
+static void usage(FILE *f)
+{
+	fprintf(f, "usage: kio-uring [-o results.json] num_threads=N "
+		"runtime_seconds=S [ramp_seconds=S] [sqpoll=0]\n"
+		"                 targets/T=PATH... N/ATTR=VALUE...\n"
+		"\n"
+		"Runs the workload of the kio module with io_uring, and writes "
+		"results.json\n"
+		"to stdout or the -o file.  Attributes are those of "
+		"/sys/kernel/kio/N/.\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct kio_uring_config kc = { .sqpoll = true };
+	const char *out_name = NULL;
+	FILE *out = stdout;
+	int opt, rc;
+
+	while ((opt = getopt(argc, argv, "ho:")) != -1) {
+		switch (opt) {
+		case 'o':
+			out_name = optarg;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 2;
+		}
+	}
+
+	rc = kio_uring_parse(&kc, argc - optind, argv + optind);
+	if (!rc)
+		rc = kio_uring_check(&kc);
+	if (rc)
+		return 2;
+
+	if (out_name) {
+		out = fopen(out_name, "w");
+		if (!out) {
+			fprintf(stderr, "kio-uring: cannot write %s: %s\n",
+				out_name, strerror(errno));
+			return 1;
+		}
+	}
+
+	rc = kio_uring_run(&kc, out);
+	if (rc)
+		fprintf(stderr, "kio-uring: run failed with %d\n", rc);
+
+	if (out != stdout)
+		fclose(out);
+	return rc ? 1 : 0;
+}